@@ -23,6 +23,24 @@ struct _DgSettingsPrivate {
   gboolean      monitor_enabled;
   GFileMonitor *monitor;
   GValue      **values;
+
+  /* See dg_settings_get_snapshot() */
+  DgSettingsSnapshot *snapshot;
+  gint                readers[2];
+  gint                epoch;
+  GMutex              publish_lock;
+};
+
+
+/*
+ * Snapshots hold the values of all the settings at a given point in time,
+ * and never change once published, so they can be used from any thread.
+ */
+struct _DgSettingsSnapshot {
+  gint         ref_count;
+  guint        n_values;
+  GParamSpec **pspecs;
+  GValue      *values;
 };
 
 G_DEFINE_ABSTRACT_TYPE_WITH_PRIVATE (DgSettings, dg_settings, G_TYPE_OBJECT)
@@ -76,14 +94,11 @@ read_uint (GFile *file, GValue *value)
 }
 
 
-void
-dg_settings__get_property__ (GObject    *object,
-                             guint       prop_id,
-                             GValue     *value,
-                             GParamSpec *pspec)
+static void
+read_setting (DgSettingsPrivate *priv,
+              GParamSpec        *pspec,
+              GValue            *value)
 {
-    DgSettingsPrivate *priv = dg_settings_get_instance_private (DG_SETTINGS (object));
-
     g_autoptr(GFile) setting_file = g_file_get_child (priv->settings_path,
                                                       g_param_spec_get_name (pspec));
 
@@ -107,6 +122,216 @@ dg_settings__get_property__ (GObject    *object,
 }
 
 
+/* Properties have the values of the current snapshot. */
+void
+dg_settings__get_property__ (GObject    *object,
+                             guint       prop_id,
+                             GValue     *value,
+                             GParamSpec *pspec)
+{
+    g_autoptr(DgSettingsSnapshot) snapshot = dg_settings_get_snapshot (DG_SETTINGS (object));
+    g_value_copy (dg_settings_snapshot_get_nth (snapshot, prop_id - 1), value);
+}
+
+
+static inline gboolean
+is_setting (GParamSpec *pspec)
+{
+    return (pspec->flags & DG_SETTING__FLAG) != 0;
+}
+
+
+/*
+ * Creates a snapshot reading all the settings, or only the one with the
+ * given name, copying the rest from the previous snapshot.
+ */
+static DgSettingsSnapshot*
+snapshot_new (DgSettings         *settings,
+              DgSettingsSnapshot *previous,
+              const gchar        *name)
+{
+    DgSettingsPrivate *priv = dg_settings_get_instance_private (settings);
+
+    guint n_pspecs = 0;
+    g_autofree GParamSpec **pspecs =
+        g_object_class_list_properties (G_OBJECT_GET_CLASS (settings), &n_pspecs);
+
+    DgSettingsSnapshot *snapshot = g_new0 (DgSettingsSnapshot, 1);
+    snapshot->ref_count = 1;
+    snapshot->pspecs = g_new0 (GParamSpec*, n_pspecs);
+    snapshot->values = g_new0 (GValue, n_pspecs);
+
+    for (guint i = 0; i < n_pspecs; i++) {
+        if (!is_setting (pspecs[i]))
+            continue;
+
+        /* Kept in the order they were installed, see dg_settings_snapshot_get_nth(). */
+        const guint n = pspecs[i]->param_id - 1;
+        g_assert (n < n_pspecs);
+        snapshot->n_values = MAX (snapshot->n_values, n + 1);
+        snapshot->pspecs[n] = g_param_spec_ref (pspecs[i]);
+        g_value_init (&snapshot->values[n], G_PARAM_SPEC_VALUE_TYPE (pspecs[i]));
+
+        if (previous && name && n < previous->n_values &&
+            previous->pspecs[n] == pspecs[i] &&
+            !g_str_equal (name, g_param_spec_get_name (pspecs[i])))
+            g_value_copy (&previous->values[n], &snapshot->values[n]);
+        else
+            read_setting (priv, pspecs[i], &snapshot->values[n]);
+    }
+    return snapshot;
+}
+
+
+/*
+ * Reads the setting with the given name again, or all of them if NULL,
+ * and publishes a new snapshot. Readers never wait: they briefly announce
+ * themselves in the counter for the current epoch while they take a
+ * reference to the snapshot. After the pointer to the new snapshot has
+ * been swapped in, the epoch is advanced, and the old snapshot is released
+ * once no reader which might have seen it remains in the previous epoch.
+ */
+void
+dg_settings_reload (DgSettings  *settings,
+                    const gchar *name)
+{
+    g_return_if_fail (DG_IS_SETTINGS (settings));
+
+    DgSettingsPrivate *priv = dg_settings_get_instance_private (settings);
+
+    g_mutex_lock (&priv->publish_lock);
+    DgSettingsSnapshot *old = priv->snapshot;
+    g_atomic_pointer_set (&priv->snapshot, snapshot_new (settings, old, name));
+
+    const gint epoch = g_atomic_int_add (&priv->epoch, 1) & 1;
+    while (g_atomic_int_get (&priv->readers[epoch]) > 0)
+        g_thread_yield ();
+    g_mutex_unlock (&priv->publish_lock);
+
+    if (old)
+        dg_settings_snapshot_unref (old);
+}
+
+
+/*
+ * Returns a reference to the current snapshot of the settings. This can
+ * be called from any thread, and does not block. Changes are picked up
+ * by new snapshots after the configuration files have been read again,
+ * which happens when they are monitored for changes, or when
+ * dg_settings_reload() is called.
+ */
+DgSettingsSnapshot*
+dg_settings_get_snapshot (DgSettings *settings)
+{
+    g_return_val_if_fail (DG_IS_SETTINGS (settings), NULL);
+
+    DgSettingsPrivate *priv = dg_settings_get_instance_private (settings);
+
+    gint epoch;
+    for (;;) {
+        epoch = g_atomic_int_get (&priv->epoch) & 1;
+        g_atomic_int_inc (&priv->readers[epoch]);
+        if ((g_atomic_int_get (&priv->epoch) & 1) == epoch)
+            break;
+        /* A new snapshot was published meanwhile, try again. */
+        g_atomic_int_add (&priv->readers[epoch], -1);
+    }
+
+    DgSettingsSnapshot *snapshot =
+        dg_settings_snapshot_ref (g_atomic_pointer_get (&priv->snapshot));
+    g_atomic_int_add (&priv->readers[epoch], -1);
+    return snapshot;
+}
+
+
+DgSettingsSnapshot*
+dg_settings_snapshot_ref (DgSettingsSnapshot *snapshot)
+{
+    g_return_val_if_fail (snapshot, NULL);
+    g_atomic_int_inc (&snapshot->ref_count);
+    return snapshot;
+}
+
+
+void
+dg_settings_snapshot_unref (DgSettingsSnapshot *snapshot)
+{
+    g_return_if_fail (snapshot);
+
+    if (!g_atomic_int_dec_and_test (&snapshot->ref_count))
+        return;
+
+    for (guint i = 0; i < snapshot->n_values; i++) {
+        g_value_unset (&snapshot->values[i]);
+        g_param_spec_unref (snapshot->pspecs[i]);
+    }
+    g_free (snapshot->values);
+    g_free (snapshot->pspecs);
+    g_free (snapshot);
+}
+
+
+const GValue*
+dg_settings_snapshot_get_value (DgSettingsSnapshot *snapshot,
+                                const gchar        *name)
+{
+    g_return_val_if_fail (snapshot, NULL);
+    g_return_val_if_fail (name, NULL);
+
+    for (guint i = 0; i < snapshot->n_values; i++) {
+        if (g_str_equal (name, g_param_spec_get_name (snapshot->pspecs[i])))
+            return &snapshot->values[i];
+    }
+    g_critical ("%s: no setting named '%s'", G_STRFUNC, name);
+    return NULL;
+}
+
+
+gboolean
+dg_settings_snapshot_get_boolean (DgSettingsSnapshot *snapshot,
+                                  const gchar        *name)
+{
+    const GValue *value = dg_settings_snapshot_get_value (snapshot, name);
+    g_return_val_if_fail (value && G_VALUE_HOLDS_BOOLEAN (value), FALSE);
+    return g_value_get_boolean (value);
+}
+
+
+guint
+dg_settings_snapshot_get_uint (DgSettingsSnapshot *snapshot,
+                               const gchar        *name)
+{
+    const GValue *value = dg_settings_snapshot_get_value (snapshot, name);
+    g_return_val_if_fail (value && G_VALUE_HOLDS_UINT (value), 0);
+    return g_value_get_uint (value);
+}
+
+
+/*
+ * Returns the value of the setting installed in the given position (the
+ * first one is zero), which avoids looking it up by name in hot paths.
+ */
+const GValue*
+dg_settings_snapshot_get_nth (DgSettingsSnapshot *snapshot,
+                              guint               index)
+{
+    g_return_val_if_fail (snapshot, NULL);
+    g_return_val_if_fail (index < snapshot->n_values, NULL);
+    return &snapshot->values[index];
+}
+
+
+/* The string is valid as long as the snapshot. */
+const gchar*
+dg_settings_snapshot_get_string (DgSettingsSnapshot *snapshot,
+                                 const gchar        *name)
+{
+    const GValue *value = dg_settings_snapshot_get_value (snapshot, name);
+    g_return_val_if_fail (value && G_VALUE_HOLDS_STRING (value), NULL);
+    return g_value_get_string (value);
+}
+
+
 static void
 write_line (GFile       *file,
             GParamSpec  *pspec,
@@ -154,6 +379,9 @@ dg_settings__set_property__ (GObject      *object,
                         g_value_get_boolean (value) ? "true" : "false");
             break;
     }
+
+    /* Make the new value visible right away, without waiting for the monitor. */
+    dg_settings_reload (DG_SETTINGS (object), g_param_spec_get_name (pspec));
 }
 
 
@@ -208,6 +436,8 @@ dg_settings_finalize (GObject *object)
   if (priv->monitor_enabled)
       g_object_unref (priv->monitor);
   g_object_unref (priv->settings_path);
+  g_clear_pointer (&priv->snapshot, dg_settings_snapshot_unref);
+  g_mutex_clear (&priv->publish_lock);
   G_OBJECT_CLASS (dg_settings_parent_class)->finalize (object);
 }
 
@@ -215,6 +445,8 @@ dg_settings_finalize (GObject *object)
 static void
 dg_settings_init (DgSettings *settings)
 {
+  DgSettingsPrivate *priv = dg_settings_get_instance_private (settings);
+  g_mutex_init (&priv->publish_lock);
 }
 
 
@@ -234,16 +466,24 @@ dg_settings_monitor_changed (GFileMonitor      *monitor,
         case G_FILE_MONITOR_EVENT_RENAMED:
         case G_FILE_MONITOR_EVENT_MOVED_IN:
         case G_FILE_MONITOR_EVENT_MOVED_OUT:
-        case G_FILE_MONITOR_EVENT_CREATED:
             return;
 
+        /*
+         * Files replaced by renaming another one over them, as many editors
+         * do, are reported as created (the monitor does not watch moves),
+         * without a hint that changes are done afterwards.
+         */
+        case G_FILE_MONITOR_EVENT_CREATED:
         case G_FILE_MONITOR_EVENT_DELETED:
         case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT: {
             g_autofree char *filename = g_file_get_basename (file);
             GParamSpec *pspec =
                 g_object_class_find_property (G_OBJECT_GET_CLASS (settings),
                                               filename);
-            if (pspec) g_object_notify_by_pspec (G_OBJECT (settings), pspec);
+            if (pspec && is_setting (pspec)) {
+                dg_settings_reload (settings, filename);
+                g_object_notify_by_pspec (G_OBJECT (settings), pspec);
+            }
         }
     }
 }
@@ -255,6 +495,8 @@ dg_settings__constructed__ (GObject *object)
   DgSettingsPrivate *priv = dg_settings_get_instance_private (DG_SETTINGS (object));
 
   g_assert (priv->settings_path);
+  dg_settings_reload (DG_SETTINGS (object), NULL);
+
   if (priv->monitor_enabled) {
     g_autoptr(GError) error = NULL;
     priv->monitor = g_file_monitor_directory (priv->settings_path,
@@ -16,8 +16,9 @@ G_BEGIN_DECLS
 #define DG_SETTINGS(obj)     (G_TYPE_CHECK_INSTANCE_CAST ((obj), DG_SETTINGS_TYPE, DgSettings))
 #define DG_IS_SETTINGS(obj)  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), DG_SETTINGS_TYPE))
 
-typedef struct _DgSettingsClass DgSettingsClass;
-typedef struct _DgSettings      DgSettings;
+typedef struct _DgSettingsClass    DgSettingsClass;
+typedef struct _DgSettings         DgSettings;
+typedef struct _DgSettingsSnapshot DgSettingsSnapshot;
 
 struct _DgSettingsClass {
   GObjectClass parent_class;
@@ -29,6 +30,25 @@ struct _DgSettings {
 
 GType dg_settings_get_type (void);
 
+void                dg_settings_reload       (DgSettings  *settings,
+                                              const gchar *name);
+DgSettingsSnapshot* dg_settings_get_snapshot (DgSettings  *settings);
+
+DgSettingsSnapshot* dg_settings_snapshot_ref         (DgSettingsSnapshot *snapshot);
+void                dg_settings_snapshot_unref       (DgSettingsSnapshot *snapshot);
+const GValue*       dg_settings_snapshot_get_value   (DgSettingsSnapshot *snapshot,
+                                                      const gchar        *name);
+const GValue*       dg_settings_snapshot_get_nth     (DgSettingsSnapshot *snapshot,
+                                                      guint               index);
+gboolean            dg_settings_snapshot_get_boolean (DgSettingsSnapshot *snapshot,
+                                                      const gchar        *name);
+guint               dg_settings_snapshot_get_uint    (DgSettingsSnapshot *snapshot,
+                                                      const gchar        *name);
+const gchar*        dg_settings_snapshot_get_string  (DgSettingsSnapshot *snapshot,
+                                                      const gchar        *name);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (DgSettingsSnapshot, dg_settings_snapshot_unref)
+
 void dg_settings__get_property__ (GObject      *object,
                                   guint         prop_id,
                                   GValue       *value,
@@ -0,0 +1,569 @@
+/*
+ * dwt-cast.c
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include "dwt-cast.h"
+#include <string.h>
+
+
+/*
+ * Recordings use the asciicast v2 format: a line with a JSON object as
+ * header, followed by one line per event, each one a JSON array with the
+ * time in seconds since the start, the event type, and its data:
+ *
+ *   {"version": 2, "width": 80, "height": 24, "timestamp": 1700000000}
+ *   [0.104512, "o", "\u001b[1mhello\u001b[0m\r\n"]
+ *   [1.500007, "r", "100x30"]
+ *
+ * Data is stored as JSON strings, which must be valid UTF-8. Characters
+ * split between two chunks of output are written along with the second,
+ * and invalid bytes are replaced with U+FFFD, as other recorders do.
+ *
+ * Events are formatted into a buffer, which is written from a worker
+ * thread when it reaches a batch size, or a while after the last write,
+ * so the main loop does not wait for disk I/O while recording. Freeing
+ * the writer waits for the batch being written, if any, then writes the
+ * rest and closes the file before returning: it is usually freed when
+ * the main loop is about to finish, and nothing would be left to
+ * complete asynchronous operations.
+ */
+
+#define WRITE_BATCH_SIZE  (64 * 1024)
+#define WRITE_BATCH_DELAY 1  /* seconds */
+
+struct _DwtCastWriter {
+    gint           ref_count;
+    gchar         *path;
+    GOutputStream *stream;
+    GString       *pending;
+    GString       *writing;
+    GMutex         lock;
+    GCond          written;
+    gboolean       writing_active;  /* Protected by the lock. */
+    gboolean       failed;          /* Set with the lock held, atomically. */
+    gboolean       closing;
+    guint          flush_id;
+    gint64         start_time;
+    gchar          partial[4];
+    gsize          n_partial;
+};
+
+
+static void
+skip_spaces (const gchar **p,
+             const gchar  *end)
+{
+    while (*p < end && g_ascii_isspace (**p))
+        (*p)++;
+}
+
+
+static gboolean
+expect_char (const gchar **p,
+             const gchar  *end,
+             gchar         c)
+{
+    skip_spaces (p, end);
+    if (*p < end && **p == c) {
+        (*p)++;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+
+static gboolean
+parse_hex4 (const gchar **p,
+            const gchar  *end,
+            gunichar     *ch)
+{
+    if (end - *p < 4)
+        return FALSE;
+
+    *ch = 0;
+    for (guint i = 0; i < 4; i++) {
+        const gint digit = g_ascii_xdigit_value ((*p)[i]);
+        if (digit < 0)
+            return FALSE;
+        *ch = (*ch << 4) | digit;
+    }
+    *p += 4;
+    return TRUE;
+}
+
+
+static gboolean
+parse_string (const gchar **p,
+              const gchar  *end,
+              GString      *out)
+{
+    if (!expect_char (p, end, '"'))
+        return FALSE;
+
+    while (*p < end) {
+        gchar c = *(*p)++;
+        if (c == '"')
+            return TRUE;
+        if (c != '\\') {
+            g_string_append_c (out, c);
+            continue;
+        }
+        if (*p >= end)
+            return FALSE;
+
+        switch ((c = *(*p)++)) {
+            case '"':
+            case '\\':
+            case '/':
+                g_string_append_c (out, c);
+                break;
+            case 'b': g_string_append_c (out, '\b'); break;
+            case 'f': g_string_append_c (out, '\f'); break;
+            case 'n': g_string_append_c (out, '\n'); break;
+            case 'r': g_string_append_c (out, '\r'); break;
+            case 't': g_string_append_c (out, '\t'); break;
+            case 'u': {
+                gunichar ch, low;
+                if (!parse_hex4 (p, end, &ch))
+                    return FALSE;
+                if (ch >= 0xD800 && ch < 0xDC00) {
+                    /* High surrogate, which must be followed by a low one. */
+                    if (end - *p >= 6 && (*p)[0] == '\\' && (*p)[1] == 'u') {
+                        *p += 2;
+                        if (!parse_hex4 (p, end, &low))
+                            return FALSE;
+                        ch = (low >= 0xDC00 && low < 0xE000)
+                            ? 0x10000 + ((ch - 0xD800) << 10) + (low - 0xDC00)
+                            : 0xFFFD;
+                    } else {
+                        ch = 0xFFFD;
+                    }
+                } else if (ch >= 0xDC00 && ch < 0xE000) {
+                    ch = 0xFFFD;
+                }
+                gchar utf8[6];
+                g_string_append_len (out, utf8, g_unichar_to_utf8 (ch, utf8));
+                break;
+            }
+            default:
+                return FALSE;
+        }
+    }
+    return FALSE;
+}
+
+
+static gboolean
+header_get_uint (const gchar *line,
+                 const gchar *end,
+                 const gchar *key,
+                 guint       *value)
+{
+    g_autofree gchar *quoted_key = g_strdup_printf ("\"%s\"", key);
+    const gchar *p = g_strstr_len (line, end - line, quoted_key);
+    if (!p)
+        return FALSE;
+
+    p += strlen (quoted_key);
+    if (!expect_char (&p, end, ':'))
+        return FALSE;
+    skip_spaces (&p, end);
+
+    gchar *number_end = NULL;
+    const guint64 number = g_ascii_strtoull (p, &number_end, 10);
+    if (number_end == p || number_end > end || number > G_MAXUINT)
+        return FALSE;
+
+    *value = number;
+    return TRUE;
+}
+
+
+static gboolean
+parse_event (const gchar  *line,
+             const gchar  *end,
+             DwtCastEvent *event)
+{
+    const gchar *p = line;
+    if (!expect_char (&p, end, '['))
+        return FALSE;
+    skip_spaces (&p, end);
+
+    gchar *number_end = NULL;
+    event->time = g_ascii_strtod (p, &number_end);
+    if (number_end == p || number_end > end)
+        return FALSE;
+    p = number_end;
+
+    g_autoptr(GString) type = g_string_new (NULL);
+    g_autoptr(GString) data = g_string_new (NULL);
+    if (!expect_char (&p, end, ',') || !parse_string (&p, end, type) ||
+        !expect_char (&p, end, ',') || !parse_string (&p, end, data) ||
+        !expect_char (&p, end, ']'))
+        return FALSE;
+
+    event->type = (type->len == 1) ? type->str[0] : '\0';
+    event->length = data->len;
+    event->data = g_string_free (g_steal_pointer (&data), FALSE);
+    return TRUE;
+}
+
+
+static void
+event_clear (gpointer userdata)
+{
+    DwtCastEvent *event = userdata;
+    g_free (event->data);
+}
+
+
+DwtCast*
+dwt_cast_parse (const gchar *text,
+                gsize        length,
+                GError     **error)
+{
+    g_return_val_if_fail (text || !length, NULL);
+
+    const gchar *end = text + length;
+    const gchar *line = text;
+    const gchar *line_end = memchr (line, '\n', end - line);
+    if (!line_end)
+        line_end = end;
+
+    guint version = 0;
+    g_autoptr(DwtCast) cast = g_new0 (DwtCast, 1);
+    if (!header_get_uint (line, line_end, "version", &version) || version != 2 ||
+        !header_get_uint (line, line_end, "width", &cast->width) ||
+        !header_get_uint (line, line_end, "height", &cast->height))
+    {
+        g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "Not an asciicast v2 recording");
+        return NULL;
+    }
+
+    cast->events = g_array_new (FALSE, FALSE, sizeof (DwtCastEvent));
+    g_array_set_clear_func (cast->events, event_clear);
+
+    for (guint line_number = 2; line_end < end; line_number++) {
+        line = line_end + 1;
+        if (!(line_end = memchr (line, '\n', end - line)))
+            line_end = end;
+
+        const gchar *p = line;
+        skip_spaces (&p, line_end);
+        if (p == line_end)
+            continue;
+
+        DwtCastEvent event = { 0, };
+        if (!parse_event (line, line_end, &event)) {
+            g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                         "Invalid event at line %u", line_number);
+            return NULL;
+        }
+        /* Event types other than output and resize are not replayed. */
+        if (event.type == DWT_CAST_OUTPUT || event.type == DWT_CAST_RESIZE)
+            g_array_append_val (cast->events, event);
+        else
+            event_clear (&event);
+    }
+    return g_steal_pointer (&cast);
+}
+
+
+void
+dwt_cast_free (DwtCast *cast)
+{
+    g_return_if_fail (cast);
+
+    if (cast->events)
+        g_array_unref (cast->events);
+    g_free (cast);
+}
+
+
+/*
+ * Returns the amount of bytes at the end which are part of an incomplete
+ * UTF-8 sequence, and were not added.
+ */
+static gsize
+append_string (GString     *out,
+               const gchar *data,
+               gsize        length)
+{
+    const gchar *end = data + length;
+
+    g_string_append_c (out, '"');
+    while (data < end) {
+        const guchar c = *data;
+        if (c < 0x80) {
+            switch (c) {
+                case '"':  g_string_append (out, "\\\""); break;
+                case '\\': g_string_append (out, "\\\\"); break;
+                case '\b': g_string_append (out, "\\b"); break;
+                case '\f': g_string_append (out, "\\f"); break;
+                case '\n': g_string_append (out, "\\n"); break;
+                case '\r': g_string_append (out, "\\r"); break;
+                case '\t': g_string_append (out, "\\t"); break;
+                default:
+                    if (c < 0x20 || c == 0x7F)
+                        g_string_append_printf (out, "\\u%04x", c);
+                    else
+                        g_string_append_c (out, c);
+            }
+            data++;
+            continue;
+        }
+
+        const gunichar ch = g_utf8_get_char_validated (data, end - data);
+        if (ch == (gunichar) -2)
+            break;
+        if (ch == (gunichar) -1) {
+            g_string_append (out, "\\ufffd");
+            data++;
+            continue;
+        }
+        const gchar *next = g_utf8_next_char (data);
+        g_string_append_len (out, data, next - data);
+        data = next;
+    }
+    g_string_append_c (out, '"');
+    return end - data;
+}
+
+
+static void
+writer_unref (DwtCastWriter *writer)
+{
+    if (!g_atomic_int_dec_and_test (&writer->ref_count))
+        return;
+
+    g_object_unref (writer->stream);
+    g_string_free (writer->pending, TRUE);
+    g_string_free (writer->writing, TRUE);
+    g_mutex_clear (&writer->lock);
+    g_cond_clear (&writer->written);
+    g_free (writer->path);
+    g_free (writer);
+}
+
+
+static void
+writer_write_thread (GTask        *task,
+                     gpointer      source_object,
+                     gpointer      task_data,
+                     GCancellable *cancellable)
+{
+    DwtCastWriter *writer = task_data;
+    g_autoptr(GError) error = NULL;
+    g_output_stream_write_all (writer->stream,
+                               writer->writing->str,
+                               writer->writing->len,
+                               NULL, NULL, &error);
+    if (error)
+        g_warning ("Cannot write recording '%s', recording stopped: %s",
+                   writer->path, error->message);
+
+    g_mutex_lock (&writer->lock);
+    g_string_truncate (writer->writing, 0);
+    writer->writing_active = FALSE;
+    if (error)
+        g_atomic_int_set (&writer->failed, TRUE);
+    g_cond_signal (&writer->written);
+    g_mutex_unlock (&writer->lock);
+
+    g_task_return_boolean (task, TRUE);
+}
+
+
+static void writer_flush (DwtCastWriter *writer);
+
+
+static void
+writer_written (GObject      *source,
+                GAsyncResult *result,
+                gpointer      userdata)
+{
+    DwtCastWriter *writer = g_task_get_task_data (G_TASK (result));
+    if (!writer->closing && writer->pending->len >= WRITE_BATCH_SIZE)
+        writer_flush (writer);
+}
+
+
+static void
+writer_flush (DwtCastWriter *writer)
+{
+    if (writer->flush_id) {
+        g_source_remove (writer->flush_id);
+        writer->flush_id = 0;
+    }
+    if (!writer->pending->len)
+        return;
+
+    g_mutex_lock (&writer->lock);
+    const gboolean busy = writer->writing_active || writer->failed;
+    if (!busy)
+        writer->writing_active = TRUE;
+    g_mutex_unlock (&writer->lock);
+    if (busy)
+        return;
+
+    GString *tmp = writer->writing;
+    writer->writing = writer->pending;
+    writer->pending = tmp;
+
+    g_atomic_int_inc (&writer->ref_count);
+    g_autoptr(GTask) task = g_task_new (NULL, NULL, writer_written, NULL);
+    g_task_set_task_data (task, writer, (GDestroyNotify) writer_unref);
+    g_task_run_in_thread (task, writer_write_thread);
+}
+
+
+static gboolean
+writer_flush_timeout (gpointer userdata)
+{
+    DwtCastWriter *writer = userdata;
+    writer->flush_id = 0;
+    writer_flush (writer);
+    return G_SOURCE_REMOVE;
+}
+
+
+/* Returns the amount of bytes at the end which were not added, see above. */
+static gsize
+writer_append_event (DwtCastWriter *writer,
+                     gchar          type,
+                     const gchar   *data,
+                     gsize          length)
+{
+    if (g_atomic_int_get (&writer->failed))
+        return 0;
+
+    gchar time[G_ASCII_DTOSTR_BUF_SIZE];
+    g_ascii_formatd (time, sizeof (time), "%.6f",
+                     (g_get_monotonic_time () - writer->start_time) /
+                     (gdouble) G_TIME_SPAN_SECOND);
+    g_string_append_printf (writer->pending, "[%s, \"%c\", ", time, type);
+    const gsize incomplete = append_string (writer->pending, data, length);
+    g_string_append (writer->pending, "]\n");
+
+    if (writer->pending->len >= WRITE_BATCH_SIZE)
+        writer_flush (writer);
+    else if (!writer->flush_id)
+        writer->flush_id = g_timeout_add_seconds (WRITE_BATCH_DELAY,
+                                                  writer_flush_timeout,
+                                                  writer);
+    return incomplete;
+}
+
+
+DwtCastWriter*
+dwt_cast_writer_new (const gchar *path,
+                     guint        width,
+                     guint        height,
+                     GError     **error)
+{
+    g_return_val_if_fail (path, NULL);
+
+    g_autoptr(GFile) file = g_file_new_for_path (path);
+    GFileOutputStream *stream =
+        g_file_replace (file, NULL, FALSE, G_FILE_CREATE_PRIVATE, NULL, error);
+    if (!stream)
+        return NULL;
+
+    DwtCastWriter *writer = g_new0 (DwtCastWriter, 1);
+    writer->ref_count = 1;
+    g_mutex_init (&writer->lock);
+    g_cond_init (&writer->written);
+    writer->path = g_strdup (path);
+    writer->stream = G_OUTPUT_STREAM (stream);
+    writer->pending = g_string_sized_new (WRITE_BATCH_SIZE);
+    writer->writing = g_string_sized_new (WRITE_BATCH_SIZE);
+    writer->start_time = g_get_monotonic_time ();
+
+    g_string_append_printf (writer->pending,
+                            "{\"version\": 2, \"width\": %u, \"height\": %u,"
+                            " \"timestamp\": %" G_GINT64_FORMAT ","
+                            " \"env\": {\"TERM\": \"xterm-256color\"}}\n",
+                            width, height,
+                            g_get_real_time () / G_USEC_PER_SEC);
+    return writer;
+}
+
+
+void
+dwt_cast_writer_output (DwtCastWriter *writer,
+                        const gchar   *data,
+                        gsize          length)
+{
+    g_return_if_fail (writer);
+    g_return_if_fail (data || !length);
+
+    /* Complete the character split at the end of the previous chunk. */
+    g_autofree gchar *joined = NULL;
+    if (writer->n_partial) {
+        joined = g_malloc (writer->n_partial + length);
+        memcpy (joined, writer->partial, writer->n_partial);
+        memcpy (joined + writer->n_partial, data, length);
+        data = joined;
+        length += writer->n_partial;
+        writer->n_partial = 0;
+    }
+    const gsize incomplete = writer_append_event (writer, DWT_CAST_OUTPUT, data, length);
+    g_assert (incomplete < sizeof (writer->partial));
+    memcpy (writer->partial, data + length - incomplete, incomplete);
+    writer->n_partial = incomplete;
+}
+
+
+void
+dwt_cast_writer_resize (DwtCastWriter *writer,
+                        guint          width,
+                        guint          height)
+{
+    g_return_if_fail (writer);
+
+    g_autofree gchar *size = g_strdup_printf ("%ux%u", width, height);
+    writer_append_event (writer, DWT_CAST_RESIZE, size, strlen (size));
+}
+
+
+/*
+ * Waits for the batch being written, then writes pending events and closes
+ * the file, see above. Batches are small enough for this to be quick.
+ */
+void
+dwt_cast_writer_free (DwtCastWriter *writer)
+{
+    g_return_if_fail (writer);
+    g_return_if_fail (!writer->closing);
+
+    writer->closing = TRUE;
+    if (writer->flush_id) {
+        g_source_remove (writer->flush_id);
+        writer->flush_id = 0;
+    }
+
+    g_mutex_lock (&writer->lock);
+    while (writer->writing_active)
+        g_cond_wait (&writer->written, &writer->lock);
+    const gboolean failed = writer->failed;
+    g_mutex_unlock (&writer->lock);
+
+    g_autoptr(GError) error = NULL;
+    if (!failed && writer->pending->len &&
+        !g_output_stream_write_all (writer->stream,
+                                    writer->pending->str,
+                                    writer->pending->len,
+                                    NULL, NULL, &error))
+    {
+        g_warning ("Cannot write recording '%s': %s", writer->path, error->message);
+        g_clear_error (&error);
+    }
+    if (!g_output_stream_close (writer->stream, NULL, &error))
+        g_warning ("Cannot close recording '%s': %s", writer->path, error->message);
+
+    writer_unref (writer);
+}
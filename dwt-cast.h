@@ -0,0 +1,57 @@
+/*
+ * dwt-cast.h
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#ifndef DWT_CAST_H
+#define DWT_CAST_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define DWT_CAST_OUTPUT 'o'
+#define DWT_CAST_RESIZE 'r'
+
+typedef struct {
+    gdouble  time;
+    gchar    type;
+    gchar   *data;
+    gsize    length;
+} DwtCastEvent;
+
+typedef struct {
+    guint   width;
+    guint   height;
+    GArray *events;
+} DwtCast;
+
+DwtCast* dwt_cast_parse (const gchar *text,
+                         gsize        length,
+                         GError     **error);
+void     dwt_cast_free  (DwtCast     *cast);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (DwtCast, dwt_cast_free)
+
+
+typedef struct _DwtCastWriter DwtCastWriter;
+
+DwtCastWriter* dwt_cast_writer_new    (const gchar   *path,
+                                       guint          width,
+                                       guint          height,
+                                       GError       **error);
+void           dwt_cast_writer_output (DwtCastWriter *writer,
+                                       const gchar   *data,
+                                       gsize          length);
+void           dwt_cast_writer_resize (DwtCastWriter *writer,
+                                       guint          width,
+                                       guint          height);
+void           dwt_cast_writer_free   (DwtCastWriter *writer);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (DwtCastWriter, dwt_cast_writer_free)
+
+G_END_DECLS
+
+#endif /* !DWT_CAST_H */
@@ -0,0 +1,308 @@
+/*
+ * dwt-log.c
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include "dwt-log.h"
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <string.h>
+
+
+/*
+ * Data to be logged is copied into a ring buffer of each log, and written
+ * to disk by a single writer thread shared by all logs, so the main loop
+ * never waits for disk I/O. The thread waits until a log has accumulated
+ * a batch (or a while has passed) to issue large writes, and writes
+ * directly from its ring buffer. When a buffer is full, data is dropped
+ * instead of waiting for the thread: a warning is printed, and a note with
+ * the amount of data lost is added to the log. The thread is started with
+ * the first log, and exits once the last one has been closed.
+ *
+ * Optionally the output is gzip-compressed, and the file is rotated after
+ * a given amount of data has been written to it.
+ */
+
+#define RING_SIZE   (1024 * 1024)
+#define BATCH_SIZE  (64 * 1024)
+#define BATCH_DELAY G_TIME_SPAN_SECOND
+
+/* Protects the list of logs and their queued data. */
+static GMutex writer_mutex;
+static GCond writer_cond;
+static GCond writer_closed;
+static gboolean writer_running = FALSE;
+static GQueue writer_logs = G_QUEUE_INIT;
+
+struct _DwtLog {
+    gchar    *ring;
+    gsize     head;
+    gsize     length;
+    gsize     dropped;
+    gint64    queued_time;
+    gboolean  closing;
+    gboolean  closed;
+    gboolean  overflowing;
+
+    /* Only used by the writer thread once it is started. */
+    gchar         *path;
+    guint64        max_size;
+    gboolean       compress;
+    GOutputStream *stream;
+    guint64        written;
+    guint          rotation;
+};
+
+
+static gchar*
+log_file_path (DwtLog *log,
+               guint   rotation)
+{
+    g_autofree gchar *base = rotation
+        ? g_strdup_printf ("%s.%u", log->path, rotation)
+        : g_strdup (log->path);
+    return log->compress ? g_strconcat (base, ".gz", NULL) : g_steal_pointer (&base);
+}
+
+
+static GOutputStream*
+log_open_stream (DwtLog  *log,
+                 GError **error)
+{
+    g_autofree gchar *path = log_file_path (log, 0);
+    g_autoptr(GFile) file = g_file_new_for_path (path);
+    g_autoptr(GFileOutputStream) stream =
+        g_file_append_to (file, G_FILE_CREATE_PRIVATE, NULL, error);
+    if (!stream)
+        return NULL;
+
+    if (!log->compress)
+        return G_OUTPUT_STREAM (g_steal_pointer (&stream));
+
+    g_autoptr(GZlibCompressor) compressor =
+        g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1);
+    return g_converter_output_stream_new (G_OUTPUT_STREAM (stream),
+                                          G_CONVERTER (compressor));
+}
+
+
+static void
+log_close_stream (DwtLog *log)
+{
+    g_autoptr(GError) error = NULL;
+    if (!g_output_stream_close (log->stream, NULL, &error))
+        g_warning ("Cannot close log: %s", error->message);
+    g_clear_object (&log->stream);
+}
+
+
+static void
+log_rotate (DwtLog *log)
+{
+    log_close_stream (log);
+
+    g_autofree gchar *path = log_file_path (log, 0);
+    g_autofree gchar *rotated_path = log_file_path (log, ++log->rotation);
+    if (g_rename (path, rotated_path) == -1)
+        g_warning ("Cannot rotate log '%s': %s", path, g_strerror (errno));
+
+    g_autoptr(GError) error = NULL;
+    if (!(log->stream = log_open_stream (log, &error)))
+        g_warning ("Cannot reopen log: %s", error->message);
+    log->written = 0;
+}
+
+
+static void
+log_output (DwtLog      *log,
+            const gchar *data,
+            gsize        length)
+{
+    if (!log->stream || !length)
+        return;
+
+    g_autoptr(GError) error = NULL;
+    if (!g_output_stream_write_all (log->stream, data, length, NULL, NULL, &error)) {
+        g_warning ("Cannot write log, logging stopped: %s", error->message);
+        log_close_stream (log);
+        return;
+    }
+
+    log->written += length;
+    if (log->max_size && log->written >= log->max_size)
+        log_rotate (log);
+}
+
+
+/* Whether the thread has something to do for a log. Called locked. */
+static gboolean
+log_is_due (DwtLog *log,
+            gint64  now)
+{
+    if (log->closing)
+        return TRUE;
+    if (log->dropped || log->length >= BATCH_SIZE)
+        return TRUE;
+    return log->length && now >= log->queued_time + BATCH_DELAY;
+}
+
+
+static gpointer
+log_writer_thread (gpointer userdata)
+{
+    g_mutex_lock (&writer_mutex);
+    while (!g_queue_is_empty (&writer_logs)) {
+        const gint64 now = g_get_monotonic_time ();
+        gint64 deadline = G_MAXINT64;
+        DwtLog *log = NULL;
+
+        for (GList *item = writer_logs.head; item; item = g_list_next (item)) {
+            DwtLog *candidate = item->data;
+            if (log_is_due (candidate, now)) {
+                log = candidate;
+                break;
+            }
+            if (candidate->length)
+                deadline = MIN (deadline, candidate->queued_time + BATCH_DELAY);
+        }
+
+        if (!log) {
+            if (deadline == G_MAXINT64)
+                g_cond_wait (&writer_cond, &writer_mutex);
+            else
+                g_cond_wait_until (&writer_cond, &writer_mutex, deadline);
+            continue;
+        }
+
+        /* Take turns, so a busy log does not starve the rest. */
+        g_queue_remove (&writer_logs, log);
+
+        if (!log->length && !log->dropped) {
+            /* Closing, and everything has been written. */
+            g_mutex_unlock (&writer_mutex);
+            if (log->stream)
+                log_close_stream (log);
+            g_mutex_lock (&writer_mutex);
+            log->closed = TRUE;
+            g_cond_broadcast (&writer_closed);
+            continue;
+        }
+        g_queue_push_tail (&writer_logs, log);
+
+        /* The main thread does not touch queued data, write it unlocked. */
+        const gsize head = log->head;
+        const gsize chunk = MIN (log->length, RING_SIZE - head);
+        const gsize dropped = log->dropped;
+        log->dropped = 0;
+        g_mutex_unlock (&writer_mutex);
+
+        log_output (log, log->ring + head, chunk);
+        if (dropped) {
+            g_autofree gchar *note =
+                g_strdup_printf ("\n[%" G_GSIZE_FORMAT " bytes not logged]\n", dropped);
+            log_output (log, note, strlen (note));
+        }
+
+        g_mutex_lock (&writer_mutex);
+        log->head = (head + chunk) % RING_SIZE;
+        log->length -= chunk;
+        log->queued_time = g_get_monotonic_time ();
+    }
+    writer_running = FALSE;
+    g_mutex_unlock (&writer_mutex);
+    return NULL;
+}
+
+
+DwtLog*
+dwt_log_new (const gchar *path,
+             guint64      max_size,
+             gboolean     compress,
+             GError     **error)
+{
+    g_return_val_if_fail (path, NULL);
+
+    DwtLog *log = g_new0 (DwtLog, 1);
+    log->path = g_strdup (path);
+    log->max_size = max_size;
+    log->compress = compress;
+
+    /* Open the file here to report errors right away. */
+    if (!(log->stream = log_open_stream (log, error))) {
+        g_free (log->path);
+        g_free (log);
+        return NULL;
+    }
+
+    log->ring = g_malloc (RING_SIZE);
+
+    g_mutex_lock (&writer_mutex);
+    g_queue_push_tail (&writer_logs, log);
+    /* Logs wait for the thread to close them, it need not be joined. */
+    if (!writer_running) {
+        writer_running = TRUE;
+        g_thread_unref (g_thread_new ("dwt-log", log_writer_thread, NULL));
+    }
+    g_mutex_unlock (&writer_mutex);
+    return log;
+}
+
+
+void
+dwt_log_write (DwtLog      *log,
+               const gchar *data,
+               gsize        length)
+{
+    g_return_if_fail (log);
+    g_return_if_fail (data || !length);
+
+    g_mutex_lock (&writer_mutex);
+
+    const gsize space = RING_SIZE - log->length;
+    const gboolean overflow = length > space;
+    const gboolean warn = overflow && !log->overflowing;
+    log->overflowing = overflow;
+    if (overflow) {
+        log->dropped += length - space;
+        length = space;
+    }
+
+    const gsize tail = (log->head + log->length) % RING_SIZE;
+    const gsize first = MIN (length, RING_SIZE - tail);
+    memcpy (log->ring + tail, data, first);
+    memcpy (log->ring, data + first, length - first);
+
+    /* Wake up the thread when there is new data, or a full batch. */
+    const gsize old_length = log->length;
+    log->length += length;
+    if (!old_length)
+        log->queued_time = g_get_monotonic_time ();
+    if (!old_length || (old_length < BATCH_SIZE && log->length >= BATCH_SIZE) || overflow)
+        g_cond_signal (&writer_cond);
+
+    g_mutex_unlock (&writer_mutex);
+
+    if (warn)
+        g_warning ("Log buffer full, dropping output for '%s'", log->path);
+}
+
+
+void
+dwt_log_free (DwtLog *log)
+{
+    g_return_if_fail (log);
+
+    /* Pending data is written and the file closed before returning. */
+    g_mutex_lock (&writer_mutex);
+    log->closing = TRUE;
+    g_cond_signal (&writer_cond);
+    while (!log->closed)
+        g_cond_wait (&writer_closed, &writer_mutex);
+    g_mutex_unlock (&writer_mutex);
+
+    g_free (log->ring);
+    g_free (log->path);
+    g_free (log);
+}
@@ -0,0 +1,30 @@
+/*
+ * dwt-log.h
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#ifndef DWT_LOG_H
+#define DWT_LOG_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef struct _DwtLog DwtLog;
+
+DwtLog* dwt_log_new   (const gchar *path,
+                       guint64      max_size,
+                       gboolean     compress,
+                       GError     **error);
+void    dwt_log_write (DwtLog      *log,
+                       const gchar *data,
+                       gsize        length);
+void    dwt_log_free  (DwtLog      *log);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (DwtLog, dwt_log_free)
+
+G_END_DECLS
+
+#endif /* !DWT_LOG_H */
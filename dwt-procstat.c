@@ -0,0 +1,321 @@
+/*
+ * dwt-procstat.c
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#define _GNU_SOURCE
+
+#include "dwt-procstat.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+
+/*
+ * Resource usage of a process tree, read from /proc (Linux only). Only
+ * the files of processes in the tree are read: /proc/PID/stat has the
+ * CPU time, thread count and resident set size, and the children list of
+ * each thread in /proc/PID/task/TID/children gives the rest of the tree.
+ * Kernels built without CONFIG_PROC_CHILDREN do not have the lists, and
+ * then only the process itself is accounted for.
+ *
+ * Sampling is incremental: a DwtProcTree keeps the processes found in
+ * previous samples, with their files open, and each sample re-reads them
+ * in place with pread() into buffers on the stack. Files are only opened
+ * (and memory allocated) for processes which were not seen before, and
+ * closed for those which are gone. The children of threads other than
+ * the main one are still listed with opendir(), which allocates, but
+ * only for processes with more than one thread. The open files also
+ * make PID reuse harmless: reading them fails once the process exits.
+ *
+ * CPU time is that of the processes alive in the tree at the moment of
+ * sampling: time used by children which already exited is not included.
+ * Trees are limited in size to bound the number of open files, and
+ * processes beyond the limit are not accounted for.
+ */
+#define PROC_TREE_MAX_PROCESSES 64
+#define PROC_READ_BUFFER_SIZE   1024
+
+typedef struct {
+    GPid     pid;
+    gint     stat_fd;
+    gint     children_fd;
+    guint    n_threads;
+    gboolean seen;
+} ProcEntry;
+
+struct _DwtProcTree {
+    GArray *entries;  /* ProcEntry, the root process first. */
+};
+
+
+static gssize
+read_proc_fd (gint   fd,
+              gchar *buffer,
+              gsize  size)
+{
+    gsize length = 0;
+    while (length < size - 1) {
+        const gssize n = pread (fd, buffer + length, size - 1 - length, length);
+        if (n < 0 && length == 0)
+            return -1;
+        if (n <= 0)
+            break;
+        length += n;
+    }
+    buffer[length] = '\0';
+    return length;
+}
+
+
+static gssize
+read_proc_file (const gchar *path,
+                gchar       *buffer,
+                gsize        size)
+{
+    const gint fd = open (path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    const gssize length = read_proc_fd (fd, buffer, size);
+    close (fd);
+    return length;
+}
+
+
+static gboolean
+proc_entry_open (ProcEntry *entry,
+                 GPid       pid)
+{
+    gchar path[64];
+    snprintf (path, sizeof (path), "/proc/%d/stat", (gint) pid);
+    entry->stat_fd = open (path, O_RDONLY | O_CLOEXEC);
+    if (entry->stat_fd < 0)
+        return FALSE;
+
+    /* Missing without CONFIG_PROC_CHILDREN, which is fine. */
+    snprintf (path, sizeof (path), "/proc/%d/task/%d/children", (gint) pid, (gint) pid);
+    entry->children_fd = open (path, O_RDONLY | O_CLOEXEC);
+
+    entry->pid = pid;
+    entry->n_threads = 1;
+    entry->seen = FALSE;
+    return TRUE;
+}
+
+
+static void
+proc_entry_close (ProcEntry *entry)
+{
+    close (entry->stat_fd);
+    if (entry->children_fd >= 0)
+        close (entry->children_fd);
+}
+
+
+static gboolean
+proc_entry_sample (ProcEntry   *entry,
+                   DwtProcStat *stat)
+{
+    static glong clock_ticks = 0, page_size = 0;
+    if (G_UNLIKELY (!clock_ticks)) {
+        clock_ticks = sysconf (_SC_CLK_TCK);
+        page_size = sysconf (_SC_PAGESIZE);
+    }
+
+    gchar buffer[PROC_READ_BUFFER_SIZE];
+    if (read_proc_fd (entry->stat_fd, buffer, sizeof (buffer)) <= 0)
+        return FALSE;
+
+    /*
+     * The command name, between parentheses, may contain spaces and
+     * parentheses itself. Fields after it are separated by spaces: the
+     * state is the third field, user and system time the 14th and 15th
+     * (in clock ticks), the number of threads the 20th, and the resident
+     * set size the 24th (in pages).
+     */
+    const gchar *p = strrchr (buffer, ')');
+    if (!p)
+        return FALSE;
+
+    guint64 utime = 0, stime = 0, n_threads = 1, rss = 0;
+    for (guint field = 3; field <= 24; field++) {
+        while (*p && *p != ' ')
+            p++;
+        if (!*p++)
+            return FALSE;
+        switch (field) {
+            case 14: utime = g_ascii_strtoull (p, NULL, 10); break;
+            case 15: stime = g_ascii_strtoull (p, NULL, 10); break;
+            case 20: n_threads = g_ascii_strtoull (p, NULL, 10); break;
+            case 24: rss = g_ascii_strtoull (p, NULL, 10); break;
+        }
+    }
+
+    stat->cpu_time += (utime + stime) * G_USEC_PER_SEC / clock_ticks;
+    stat->rss += rss * page_size;
+    stat->n_processes++;
+    entry->n_threads = n_threads;
+    return TRUE;
+}
+
+
+/* Index of the entry for a child, which is added if not known yet. */
+static gint
+proc_tree_lookup_child (DwtProcTree *tree,
+                        GPid         pid)
+{
+    for (guint i = 0; i < tree->entries->len; i++)
+        if (g_array_index (tree->entries, ProcEntry, i).pid == pid)
+            return i;
+
+    ProcEntry entry;
+    if (tree->entries->len >= PROC_TREE_MAX_PROCESSES || !proc_entry_open (&entry, pid))
+        return -1;
+
+    g_array_append_val (tree->entries, entry);
+    return tree->entries->len - 1;
+}
+
+
+/* Space-separated PIDs. Long lists may be cut, which is fine. */
+static void
+proc_tree_add_children (DwtProcTree *tree,
+                        const gchar *list,
+                        guint       *queue,
+                        guint       *queue_length)
+{
+    const gchar *p = list;
+    while (*p) {
+        gchar *end = NULL;
+        const guint64 child = g_ascii_strtoull (p, &end, 10);
+        if (end == p)
+            break;
+        p = end;
+
+        const gint index = (child > 0 && child <= G_MAXINT)
+            ? proc_tree_lookup_child (tree, child) : -1;
+        if (index < 0)
+            continue;
+
+        ProcEntry *entry = &g_array_index (tree->entries, ProcEntry, index);
+        if (!entry->seen) {
+            entry->seen = TRUE;
+            queue[(*queue_length)++] = index;
+        }
+    }
+}
+
+
+static void
+proc_tree_add_thread_children (DwtProcTree *tree,
+                               GPid         pid,
+                               guint       *queue,
+                               guint       *queue_length)
+{
+    gchar path[64];
+    snprintf (path, sizeof (path), "/proc/%d/task", (gint) pid);
+    DIR *tasks = opendir (path);
+    if (!tasks)
+        return;
+
+    struct dirent *dirent;
+    while ((dirent = readdir (tasks))) {
+        gchar *end = NULL;
+        const guint64 tid = g_ascii_strtoull (dirent->d_name, &end, 10);
+        if (end == dirent->d_name || *end || tid > G_MAXINT || tid == (guint64) pid)
+            continue;
+
+        gchar buffer[PROC_READ_BUFFER_SIZE];
+        snprintf (path, sizeof (path), "/proc/%d/task/%d/children",
+                  (gint) pid, (gint) tid);
+        if (read_proc_file (path, buffer, sizeof (buffer)) > 0)
+            proc_tree_add_children (tree, buffer, queue, queue_length);
+    }
+    closedir (tasks);
+}
+
+
+/* Returns NULL if the process does not exist. */
+DwtProcTree*
+dwt_proc_tree_new (GPid pid)
+{
+    g_return_val_if_fail (pid > 0, NULL);
+
+    ProcEntry root;
+    if (!proc_entry_open (&root, pid))
+        return NULL;
+
+    DwtProcTree *tree = g_new0 (DwtProcTree, 1);
+    tree->entries = g_array_sized_new (FALSE, FALSE, sizeof (ProcEntry), 8);
+    g_array_append_val (tree->entries, root);
+    return tree;
+}
+
+
+/*
+ * Adds up the usage of the process and all its descendants. Returns
+ * FALSE if the process does not exist (anymore).
+ */
+gboolean
+dwt_proc_tree_sample (DwtProcTree *tree,
+                      DwtProcStat *stat)
+{
+    g_return_val_if_fail (tree, FALSE);
+    g_return_val_if_fail (stat, FALSE);
+
+    memset (stat, 0x00, sizeof (DwtProcStat));
+    for (guint i = 0; i < tree->entries->len; i++)
+        g_array_index (tree->entries, ProcEntry, i).seen = FALSE;
+
+    /* Breadth-first from the root, entries may be added meanwhile. */
+    guint queue[PROC_TREE_MAX_PROCESSES];
+    guint queue_length = 0;
+    g_array_index (tree->entries, ProcEntry, 0).seen = TRUE;
+    queue[queue_length++] = 0;
+
+    for (guint head = 0; head < queue_length; head++) {
+        ProcEntry *entry = &g_array_index (tree->entries, ProcEntry, queue[head]);
+        if (!proc_entry_sample (entry, stat)) {
+            entry->seen = FALSE;
+            if (head == 0)
+                return FALSE;
+            continue;
+        }
+
+        const GPid pid = entry->pid;
+        const guint n_threads = entry->n_threads;
+        gchar buffer[PROC_READ_BUFFER_SIZE];
+        if (entry->children_fd >= 0 &&
+            read_proc_fd (entry->children_fd, buffer, sizeof (buffer)) > 0)
+            proc_tree_add_children (tree, buffer, queue, &queue_length);
+        if (n_threads > 1)
+            proc_tree_add_thread_children (tree, pid, queue, &queue_length);
+    }
+
+    /* Forget processes which exited or left the tree. */
+    for (guint i = tree->entries->len; i-- > 1;) {
+        ProcEntry *entry = &g_array_index (tree->entries, ProcEntry, i);
+        if (!entry->seen) {
+            proc_entry_close (entry);
+            g_array_remove_index_fast (tree->entries, i);
+        }
+    }
+    return TRUE;
+}
+
+
+void
+dwt_proc_tree_free (DwtProcTree *tree)
+{
+    g_return_if_fail (tree);
+
+    for (guint i = 0; i < tree->entries->len; i++)
+        proc_entry_close (&g_array_index (tree->entries, ProcEntry, i));
+    g_array_unref (tree->entries);
+    g_free (tree);
+}
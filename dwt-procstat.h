@@ -0,0 +1,32 @@
+/*
+ * dwt-procstat.h
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#ifndef DWT_PROCSTAT_H
+#define DWT_PROCSTAT_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct {
+    guint64 cpu_time;     /* microseconds, user + system */
+    guint64 rss;          /* bytes */
+    guint   n_processes;
+} DwtProcStat;
+
+typedef struct _DwtProcTree DwtProcTree;
+
+DwtProcTree* dwt_proc_tree_new    (GPid         pid);
+gboolean     dwt_proc_tree_sample (DwtProcTree *tree,
+                                   DwtProcStat *stat);
+void         dwt_proc_tree_free   (DwtProcTree *tree);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (DwtProcTree, dwt_proc_tree_free)
+
+G_END_DECLS
+
+#endif /* !DWT_PROCSTAT_H */
@@ -0,0 +1,367 @@
+/*
+ * dwt-relay.c
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include "dwt-relay.h"
+#include <glib-unix.h>
+#include <gio/gio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+
+/*
+ * A relay copies data between the master side of the PTY where a child
+ * process runs, and the slave side of the PTY read by a terminal widget,
+ * using sources in the main loop. Output from the child is read with a
+ * configurable priority and at most a given amount of bytes per main loop
+ * iteration (the budget), so a busy child can be kept from monopolizing
+ * the main loop. Input for the child is always relayed promptly.
+ *
+ * The slave side of the terminal PTY is set to raw mode, so data passes
+ * through unmodified: line discipline, echo and signals are handled by
+ * the child PTY, as usual.
+ */
+
+#define RELAY_BUFFER_SIZE (64 * 1024)
+#define INPUT_PRIORITY    G_PRIORITY_HIGH
+
+typedef struct {
+    DwtRelay   *relay;
+    gint        source_fd;
+    gint        target_fd;
+    GByteArray *pending;
+    guint       source_id;
+} RelayStream;
+
+struct _DwtRelay {
+    gint        slave_fd;
+    RelayStream output;  /* Child to terminal. */
+    RelayStream input;   /* Terminal to child. */
+    gint        priority;
+    gsize       budget;
+
+    DwtRelayOutputFunc output_func;
+    gpointer           output_userdata;
+
+    /* Statistics, reported with g_debug() about once a second. */
+    guint64     bytes;
+    guint64     bounded;
+    gint64      report_time;
+};
+
+
+static void relay_stream_watch (RelayStream *stream);
+
+
+static void
+relay_stream_stop (RelayStream *stream)
+{
+    if (stream->source_id) {
+        g_source_remove (stream->source_id);
+        stream->source_id = 0;
+    }
+    stream->source_fd = -1;
+    g_byte_array_set_size (stream->pending, 0);
+}
+
+
+static void
+relay_close (DwtRelay *relay)
+{
+    relay_stream_stop (&relay->output);
+    relay_stream_stop (&relay->input);
+
+    /* Closing the slave lets the terminal know that the child is gone. */
+    if (relay->slave_fd >= 0) {
+        close (relay->slave_fd);
+        relay->slave_fd = -1;
+    }
+}
+
+
+static void
+relay_stream_closed (RelayStream *stream)
+{
+    stream->source_id = 0;
+    if (stream == &stream->relay->output)
+        relay_close (stream->relay);
+    else
+        relay_stream_stop (stream);
+}
+
+
+static void
+relay_report (DwtRelay *relay)
+{
+    const gint64 now = g_get_monotonic_time ();
+    if (now - relay->report_time < G_TIME_SPAN_SECOND)
+        return;
+
+    const gdouble elapsed = (now - relay->report_time) / (gdouble) G_TIME_SPAN_SECOND;
+    if (relay->budget)
+        g_debug ("Relay %p: %" G_GUINT64_FORMAT " bytes in %.2f s,"
+                 " budget of %" G_GSIZE_FORMAT " bytes reached %" G_GUINT64_FORMAT " times",
+                 relay, relay->bytes, elapsed, relay->budget, relay->bounded);
+    else
+        g_debug ("Relay %p: %" G_GUINT64_FORMAT " bytes in %.2f s, no budget",
+                 relay, relay->bytes, elapsed);
+    relay->bytes = relay->bounded = 0;
+    relay->report_time = now;
+}
+
+
+static gboolean
+relay_stream_writable (gint         fd,
+                       GIOCondition condition,
+                       gpointer     userdata)
+{
+    RelayStream *stream = userdata;
+
+    ssize_t written = write (stream->target_fd,
+                             stream->pending->data,
+                             stream->pending->len);
+    if (written < 0) {
+        if (errno == EAGAIN || errno == EINTR)
+            return G_SOURCE_CONTINUE;
+        relay_stream_closed (stream);
+        return G_SOURCE_REMOVE;
+    }
+
+    g_byte_array_remove_range (stream->pending, 0, written);
+    if (stream->pending->len)
+        return G_SOURCE_CONTINUE;
+
+    /* All written, go back to reading. */
+    stream->source_id = 0;
+    relay_stream_watch (stream);
+    return G_SOURCE_REMOVE;
+}
+
+
+static gboolean
+relay_stream_readable (gint         fd,
+                       GIOCondition condition,
+                       gpointer     userdata)
+{
+    RelayStream *stream = userdata;
+    DwtRelay *relay = stream->relay;
+    const gboolean is_output = (stream == &relay->output);
+
+    gsize size = RELAY_BUFFER_SIZE;
+    if (is_output && relay->budget)
+        size = MIN (relay->budget, size);
+
+    guint8 buffer[RELAY_BUFFER_SIZE];
+    ssize_t nread = read (stream->source_fd, buffer, size);
+    if (nread < 0 && (errno == EAGAIN || errno == EINTR))
+        return G_SOURCE_CONTINUE;
+    if (nread <= 0) {
+        /* EIO means that the other side of the PTY was closed. */
+        relay_stream_closed (stream);
+        return G_SOURCE_REMOVE;
+    }
+
+    if (is_output) {
+        relay->bytes += nread;
+        if (relay->budget && (gsize) nread == size)
+            relay->bounded++;
+        relay_report (relay);
+        if (relay->output_func)
+            (*relay->output_func) ((const gchar*) buffer, nread, relay->output_userdata);
+    }
+
+    ssize_t written = 0;
+    while (written < nread) {
+        ssize_t n = write (stream->target_fd, buffer + written, nread - written);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                break;
+            relay_stream_closed (stream);
+            return G_SOURCE_REMOVE;
+        }
+        written += n;
+    }
+    if (written == nread)
+        return G_SOURCE_CONTINUE;
+
+    /* Stop reading until the rest has been written. */
+    g_byte_array_append (stream->pending, buffer + written, nread - written);
+    stream->source_id = 0;
+    relay_stream_watch (stream);
+    return G_SOURCE_REMOVE;
+}
+
+
+static void
+relay_stream_watch (RelayStream *stream)
+{
+    if (stream->source_id) {
+        g_source_remove (stream->source_id);
+        stream->source_id = 0;
+    }
+    if (stream->source_fd < 0)
+        return;
+
+    const gint priority = (stream == &stream->relay->output)
+        ? stream->relay->priority : INPUT_PRIORITY;
+
+    if (stream->pending->len) {
+        stream->source_id = g_unix_fd_add_full (priority,
+                                                stream->target_fd,
+                                                G_IO_OUT | G_IO_ERR | G_IO_HUP,
+                                                relay_stream_writable,
+                                                stream,
+                                                NULL);
+    } else {
+        stream->source_id = g_unix_fd_add_full (priority,
+                                                stream->source_fd,
+                                                G_IO_IN | G_IO_ERR | G_IO_HUP,
+                                                relay_stream_readable,
+                                                stream,
+                                                NULL);
+    }
+}
+
+
+static void
+relay_stream_init (RelayStream *stream,
+                   DwtRelay    *relay,
+                   gint         source_fd,
+                   gint         target_fd)
+{
+    stream->relay = relay;
+    stream->source_fd = source_fd;
+    stream->target_fd = target_fd;
+    stream->pending = g_byte_array_new ();
+    relay_stream_watch (stream);
+}
+
+
+static gboolean
+set_raw_mode (gint     fd,
+              GError **error)
+{
+    struct termios tios;
+    if (tcgetattr (fd, &tios) < 0)
+        goto failed;
+
+    tios.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP |
+                      INLCR | IGNCR | ICRNL | IXON);
+    tios.c_oflag &= ~OPOST;
+    tios.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+    tios.c_cflag &= ~(CSIZE | PARENB);
+    tios.c_cflag |= CS8;
+    tios.c_cc[VMIN] = 1;
+    tios.c_cc[VTIME] = 0;
+
+    if (tcsetattr (fd, TCSANOW, &tios) == 0)
+        return TRUE;
+
+failed:
+    g_set_error_literal (error, G_IO_ERROR,
+                         g_io_error_from_errno (errno),
+                         g_strerror (errno));
+    return FALSE;
+}
+
+
+/*
+ * Both file descriptors are master sides of PTYs, and are not owned by the
+ * relay. The slave side of the terminal PTY is opened by the relay.
+ */
+DwtRelay*
+dwt_relay_new (gint     terminal_fd,
+               gint     child_fd,
+               GError **error)
+{
+    g_return_val_if_fail (terminal_fd >= 0, NULL);
+    g_return_val_if_fail (child_fd >= 0, NULL);
+
+    const char *slave_path = ptsname (terminal_fd);
+    gint slave_fd = slave_path
+        ? open (slave_path, O_RDWR | O_NOCTTY | O_CLOEXEC) : -1;
+    if (slave_fd < 0) {
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                     "Cannot open terminal PTY: %s", g_strerror (errno));
+        return NULL;
+    }
+
+    if (!set_raw_mode (slave_fd, error) ||
+        !g_unix_set_fd_nonblocking (slave_fd, TRUE, error) ||
+        !g_unix_set_fd_nonblocking (child_fd, TRUE, error))
+    {
+        close (slave_fd);
+        return NULL;
+    }
+
+    DwtRelay *relay = g_new0 (DwtRelay, 1);
+    relay->slave_fd = slave_fd;
+    relay->priority = G_PRIORITY_DEFAULT;
+    relay->report_time = g_get_monotonic_time ();
+    relay_stream_init (&relay->output, relay, child_fd, slave_fd);
+    relay_stream_init (&relay->input, relay, slave_fd, child_fd);
+    return relay;
+}
+
+
+/*
+ * Sets the priority of the sources which read output from the child, and
+ * the maximum amount of bytes read each time. A budget of zero means no
+ * limit other than the size of the relay buffer.
+ */
+void
+dwt_relay_set_budget (DwtRelay *relay,
+                      gint      priority,
+                      gsize     budget)
+{
+    g_return_if_fail (relay);
+
+    relay->budget = budget;
+    if (relay->priority == priority)
+        return;
+
+    relay->priority = priority;
+    if (relay->output.source_id) {
+        GSource *source = g_main_context_find_source_by_id (NULL,
+                                                            relay->output.source_id);
+        g_source_set_priority (source, priority);
+    }
+}
+
+
+/*
+ * Sets a function which gets a copy of all the output from the child, as
+ * it is read and before it is passed to the terminal.
+ */
+void
+dwt_relay_set_output_func (DwtRelay           *relay,
+                           DwtRelayOutputFunc  func,
+                           gpointer            userdata)
+{
+    g_return_if_fail (relay);
+
+    relay->output_func = func;
+    relay->output_userdata = userdata;
+}
+
+
+void
+dwt_relay_free (DwtRelay *relay)
+{
+    g_return_if_fail (relay);
+
+    relay_close (relay);
+    g_byte_array_unref (relay->output.pending);
+    g_byte_array_unref (relay->input.pending);
+    g_free (relay);
+}
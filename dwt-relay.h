@@ -0,0 +1,36 @@
+/*
+ * dwt-relay.h
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#ifndef DWT_RELAY_H
+#define DWT_RELAY_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _DwtRelay DwtRelay;
+
+typedef void (*DwtRelayOutputFunc) (const gchar *data,
+                                    gsize        length,
+                                    gpointer     userdata);
+
+DwtRelay* dwt_relay_new             (gint                terminal_fd,
+                                     gint                child_fd,
+                                     GError            **error);
+void      dwt_relay_set_budget      (DwtRelay           *relay,
+                                     gint                priority,
+                                     gsize               budget);
+void      dwt_relay_set_output_func (DwtRelay           *relay,
+                                     DwtRelayOutputFunc  func,
+                                     gpointer            userdata);
+void      dwt_relay_free            (DwtRelay           *relay);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (DwtRelay, dwt_relay_free)
+
+G_END_DECLS
+
+#endif /* !DWT_RELAY_H */
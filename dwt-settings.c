@@ -6,6 +6,7 @@
  */
 
 #include "dg-settings.h"
+#include "dwt-settings.h"
 
 #ifndef DWT_DEFAULT_FONT
 #define DWT_DEFAULT_FONT "monospace 11"
@@ -60,6 +61,91 @@ DG_SETTINGS_UINT_RANGE ("scrollback",
                         "Number of lines saved as scrollback buffer.",
                         0, 0, 10000);
 
+DG_SETTINGS_UINT       ("hibernate-timeout",
+                        "Hibernation timeout",
+                        "Number of seconds after which terminals in the"
+                        " background which have not produced output are"
+                        " hibernated: their contents are saved to disk"
+                        " and the scrollback buffer released until they"
+                        " are brought to the foreground. Zero disables"
+                        " hibernation.",
+                        0);
+
+DG_SETTINGS_BOOLEAN    ("restore-session",
+                        "Restore session",
+                        "Save the open windows and the scrollback of their"
+                        " terminals on exit, and restore them the next time"
+                        " the program is started.",
+                        FALSE);
+
+DG_SETTINGS_UINT       ("command-notify-time",
+                        "Long command notification time",
+                        "Number of seconds after which commands reported"
+                        " by the shell call for attention when they finish"
+                        " in a window or tab which is not focused. Zero"
+                        " disables the notification.",
+                        0);
+
+DG_SETTINGS_BOOLEAN    ("copy-html",
+                        "Copy as HTML",
+                        "Whether copied text is also offered as HTML,"
+                        " keeping its colors and attributes.",
+                        FALSE);
+
+DG_SETTINGS_UINT       ("log-max-size",
+                        "Log rotation size",
+                        "Size in MiB after which terminal session logs are"
+                        " rotated. Zero disables rotation.",
+                        0);
+
+DG_SETTINGS_BOOLEAN    ("log-compress",
+                        "Compress logs",
+                        "Whether to gzip-compress terminal session logs.",
+                        FALSE);
+
+DG_SETTINGS_UINT_RANGE ("unfocused-frame-rate",
+                        "Unfocused window frame rate",
+                        "Maximum number of times per second that windows"
+                        " without focus are repainted. Zero disables the"
+                        " limit.",
+                        0, 0, 1000);
+
+DG_SETTINGS_BOOLEAN    ("throttle-hidden",
+                        "Do not paint hidden windows",
+                        "Whether to defer painting minimized or fully"
+                        " obscured windows until they are shown again.",
+                        TRUE);
+
+DG_SETTINGS_UINT       ("background-input-budget",
+                        "Background input budget",
+                        "Amount of output from child processes, in KiB,"
+                        " that terminals which are not focused may process"
+                        " on each main loop iteration. Zero disables the"
+                        " limit.",
+                        0);
+
+DG_SETTINGS_BOOLEAN    ("spawn-helper",
+                        "Use a spawn helper",
+                        "Whether to start the processes run in terminals"
+                        " from a small helper process, so starting them"
+                        " does not get slower as memory usage grows.",
+                        FALSE);
+
+DG_SETTINGS_BOOLEAN    ("match-urls",
+                        "Detect URLs",
+                        "Whether to look for URLs and file paths in the"
+                        " text of terminals to make them clickable. Links"
+                        " marked up with the OSC 8 escape sequence work"
+                        " regardless.",
+                        TRUE);
+
+DG_SETTINGS_BOOLEAN    ("show-resources",
+                        "Show resource usage",
+                        "Whether to show the CPU usage and resident memory"
+                        " of the processes running in the current terminal"
+                        " in the header bar of windows.",
+                        FALSE);
+
 DG_SETTINGS_STRING     ("font",
                         "Font name",
                         "Name of the terminal font.",
@@ -110,6 +196,13 @@ DG_SETTINGS_STRING     ("theme",
                         " colors.",
                         NULL);
 
+DG_SETTINGS_STRING     ("log-directory",
+                        "Log directory",
+                        "Directory where the output of each terminal is"
+                        " logged to a separate file. Logging is disabled"
+                        " if not set.",
+                        NULL);
+
 DG_SETTINGS_CLASS_END
 
 
@@ -132,3 +225,11 @@ dwt_settings_get_instance (void)
     static GOnce instance_once = G_ONCE_INIT;
     return g_once (&instance_once, dwt_settings_create, NULL);
 }
+
+
+/* Returns a new reference to the current snapshot of the settings. */
+DgSettingsSnapshot*
+dwt_settings_get_snapshot (void)
+{
+    return dg_settings_get_snapshot (DG_SETTINGS (dwt_settings_get_instance ()));
+}
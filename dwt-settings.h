@@ -8,14 +8,25 @@
 #ifndef DWT_SETTINGS_H
 #define DWT_SETTINGS_H
 
-#include <glib.h>
+#include "dg-settings.h"
 
 G_BEGIN_DECLS
 
 typedef struct _DwtSettings DwtSettings;
 
-DwtSettings* dwt_settings_get_instance (void);
+DwtSettings*        dwt_settings_get_instance (void);
+DgSettingsSnapshot* dwt_settings_get_snapshot (void);
 
 G_END_DECLS
 
+/*
+ * Typed accessors, e.g. dwt_settings_get_scrollback(), generated from the
+ * definitions in dwt-settings.c by tools/generate-settings. They read a
+ * snapshot obtained with dwt_settings_get_snapshot(), which never changes
+ * and may be used from any thread. Take one per batch of reads and unref
+ * it afterwards: strings returned by the accessors belong to the snapshot,
+ * and are valid only as long as the caller keeps its reference.
+ */
+#include "dwt-settings-values.h"
+
 #endif /* !DWT_SETTINGS_H */
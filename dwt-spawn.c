@@ -0,0 +1,548 @@
+/*
+ * dwt-spawn.c
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#define _GNU_SOURCE
+
+#include "dwt-spawn.h"
+#include <gio/gio.h>
+#include <gio/gunixfdmessage.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+/*
+ * Forking gets slower as the process grows: page tables are copied, and
+ * after hours of use the main process holds the scrollback of every
+ * terminal, plus GTK, fonts, and so on. The spawn helper is a separate,
+ * small process (the same executable, run with DWT_SPAWN_HELPER_ARG)
+ * which does the fork and exec on behalf of the main process.
+ *
+ * Requests are sent over a SOCK_SEQPACKET socket, one per message, with
+ * the master side of the PTY for the child attached as SCM_RIGHTS. Each
+ * request consists of a RequestHeader followed by the NUL-terminated
+ * working directory, arguments, and environment variables. The helper
+ * replies with a Reply for each request once the child has been started,
+ * and sends another one when a child exits: children are reaped by the
+ * helper, not by the main process. The helper exits when the socket is
+ * closed.
+ */
+
+#define HELPER_SOCKET_FD 3
+#define MAX_REQUEST_SIZE (256 * 1024)
+
+typedef struct {
+    guint32 id;
+    guint32 argc;
+    guint32 envc;
+} RequestHeader;
+
+enum {
+    REPLY_SPAWNED = 1,
+    REPLY_EXITED  = 2,
+};
+
+typedef struct {
+    guint32 type;
+    guint32 id;
+    gint32  pid;
+    gint32  value;  /* errno for REPLY_SPAWNED, wait status for REPLY_EXITED. */
+} Reply;
+
+
+typedef struct {
+    DwtSpawnCallback callback;
+    gpointer         userdata;
+    GDestroyNotify   destroy;
+} Request;
+
+struct _DwtSpawnHelper {
+    GSubprocess    *process;
+    GSocket        *socket;
+    GSource        *source;
+    GHashTable     *requests;
+    guint32         next_id;
+    DwtExitCallback exited;
+    gpointer        exited_userdata;
+};
+
+
+static void
+request_free (gpointer userdata)
+{
+    Request *request = userdata;
+    if (request->destroy)
+        request->destroy (request->userdata);
+    g_free (request);
+}
+
+
+static void
+helper_stop (DwtSpawnHelper *helper)
+{
+    if (helper->source) {
+        g_source_destroy (helper->source);
+        g_clear_pointer (&helper->source, g_source_unref);
+    }
+    if (helper->socket) {
+        g_socket_close (helper->socket, NULL);
+        g_clear_object (&helper->socket);
+    }
+}
+
+
+static void
+helper_fail_requests (DwtSpawnHelper *helper)
+{
+    g_autoptr(GError) error = g_error_new_literal (G_IO_ERROR,
+                                                   G_IO_ERROR_BROKEN_PIPE,
+                                                   "Spawn helper exited");
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init (&iter, helper->requests);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        Request *request = value;
+        request->callback (-1, error, request->userdata);
+        g_hash_table_iter_remove (&iter);
+    }
+}
+
+
+static gboolean
+helper_socket_readable (GSocket        *socket,
+                        GIOCondition    condition,
+                        DwtSpawnHelper *helper)
+{
+    for (;;) {
+        g_autoptr(GError) error = NULL;
+        Reply reply;
+        gssize size = g_socket_receive (socket, (gchar*) &reply, sizeof (Reply),
+                                        NULL, &error);
+        if (size < 0 && g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+            return G_SOURCE_CONTINUE;
+
+        if (size <= 0) {
+            g_warning ("Spawn helper connection closed%s%s",
+                       error ? ": " : "", error ? error->message : "");
+            helper_stop (helper);
+            helper_fail_requests (helper);
+            return G_SOURCE_REMOVE;
+        }
+        if (size != sizeof (Reply))
+            continue;
+
+        if (reply.type == REPLY_SPAWNED) {
+            Request *request = g_hash_table_lookup (helper->requests,
+                                                    GUINT_TO_POINTER (reply.id));
+            if (!request)
+                continue;
+
+            g_autoptr(GError) spawn_error = NULL;
+            if (reply.pid < 0) {
+                spawn_error = g_error_new (G_IO_ERROR,
+                                           g_io_error_from_errno (reply.value),
+                                           "Cannot run child process: %s",
+                                           g_strerror (reply.value));
+            }
+            request->callback (reply.pid, spawn_error, request->userdata);
+            g_hash_table_remove (helper->requests, GUINT_TO_POINTER (reply.id));
+        } else if (reply.type == REPLY_EXITED) {
+            if (helper->exited)
+                helper->exited (reply.pid, reply.value, helper->exited_userdata);
+        }
+    }
+}
+
+
+DwtSpawnHelper*
+dwt_spawn_helper_new (const gchar    *program,
+                      DwtExitCallback exited,
+                      gpointer        userdata,
+                      GError        **error)
+{
+    g_return_val_if_fail (program, NULL);
+
+    gint fds[2];
+    if (socketpair (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0) {
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                     "Cannot create socket: %s", g_strerror (errno));
+        return NULL;
+    }
+
+    g_autoptr(GSubprocessLauncher) launcher =
+        g_subprocess_launcher_new (G_SUBPROCESS_FLAGS_NONE);
+    g_subprocess_launcher_take_fd (launcher, fds[1], HELPER_SOCKET_FD);
+
+    g_autoptr(GSubprocess) process =
+        g_subprocess_launcher_spawn (launcher, error, program, DWT_SPAWN_HELPER_ARG, NULL);
+    if (!process) {
+        close (fds[0]);
+        return NULL;
+    }
+
+    g_autoptr(GSocket) socket = g_socket_new_from_fd (fds[0], error);
+    if (!socket) {
+        close (fds[0]);
+        g_subprocess_force_exit (process);
+        return NULL;
+    }
+    g_socket_set_blocking (socket, FALSE);
+
+    DwtSpawnHelper *helper = g_new0 (DwtSpawnHelper, 1);
+    helper->process = g_steal_pointer (&process);
+    helper->socket = g_steal_pointer (&socket);
+    helper->requests = g_hash_table_new_full (NULL, NULL, NULL, request_free);
+    helper->exited = exited;
+    helper->exited_userdata = userdata;
+
+    helper->source = g_socket_create_source (helper->socket,
+                                             G_IO_IN | G_IO_ERR | G_IO_HUP,
+                                             NULL);
+    g_source_set_callback (helper->source,
+                           (GSourceFunc) helper_socket_readable,
+                           helper,
+                           NULL);
+    g_source_attach (helper->source, NULL);
+    return helper;
+}
+
+
+gboolean
+dwt_spawn_helper_is_running (DwtSpawnHelper *helper)
+{
+    g_return_val_if_fail (helper, FALSE);
+    return helper->socket != NULL;
+}
+
+
+/*
+ * On success, the callback is called once the child has been started (or
+ * has failed to start), followed by the destroy function. On failure, the
+ * request is not sent and neither of them is called.
+ */
+gboolean
+dwt_spawn_helper_spawn (DwtSpawnHelper  *helper,
+                        gint             pty_fd,
+                        const gchar     *workdir,
+                        gchar          **argv,
+                        gchar          **envv,
+                        DwtSpawnCallback callback,
+                        gpointer         userdata,
+                        GDestroyNotify   destroy,
+                        GError         **error)
+{
+    g_return_val_if_fail (helper, FALSE);
+    g_return_val_if_fail (pty_fd >= 0, FALSE);
+    g_return_val_if_fail (argv && argv[0], FALSE);
+    g_return_val_if_fail (callback, FALSE);
+
+    if (!helper->socket) {
+        g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_CLOSED,
+                             "Spawn helper is not running");
+        return FALSE;
+    }
+
+    RequestHeader header = {
+        .id = ++helper->next_id,
+        .argc = g_strv_length (argv),
+        .envc = envv ? g_strv_length (envv) : 0,
+    };
+
+    g_autoptr(GByteArray) data = g_byte_array_new ();
+    g_byte_array_append (data, (const guint8*) &header, sizeof (RequestHeader));
+    workdir = workdir ? workdir : "";
+    g_byte_array_append (data, (const guint8*) workdir, strlen (workdir) + 1);
+    for (guint i = 0; i < header.argc; i++)
+        g_byte_array_append (data, (const guint8*) argv[i], strlen (argv[i]) + 1);
+    for (guint i = 0; i < header.envc; i++)
+        g_byte_array_append (data, (const guint8*) envv[i], strlen (envv[i]) + 1);
+
+    if (data->len > MAX_REQUEST_SIZE) {
+        g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_MESSAGE_TOO_LARGE,
+                             "Spawn request too large");
+        return FALSE;
+    }
+
+    g_autoptr(GSocketControlMessage) fd_message = g_unix_fd_message_new ();
+    if (!g_unix_fd_message_append_fd (G_UNIX_FD_MESSAGE (fd_message), pty_fd, error))
+        return FALSE;
+
+    GOutputVector vector = { data->data, data->len };
+    if (g_socket_send_message (helper->socket, NULL, &vector, 1,
+                               &fd_message, 1, 0, NULL, error) < 0)
+        return FALSE;
+
+    Request *request = g_new0 (Request, 1);
+    request->callback = callback;
+    request->userdata = userdata;
+    request->destroy = destroy;
+    g_hash_table_insert (helper->requests, GUINT_TO_POINTER (header.id), request);
+    return TRUE;
+}
+
+
+void
+dwt_spawn_helper_free (DwtSpawnHelper *helper)
+{
+    g_return_if_fail (helper);
+
+    /* Closing the socket makes the helper exit. */
+    helper_stop (helper);
+    g_hash_table_destroy (helper->requests);
+    g_clear_object (&helper->process);
+    g_free (helper);
+}
+
+
+/*
+ * Everything below runs in the helper process, which only uses plain libc
+ * calls to stay small.
+ */
+static int sigchld_pipe[2] = { -1, -1 };
+
+
+static void
+sigchld_handler (int signum)
+{
+    const int saved_errno = errno;
+    const char byte = 0;
+    (void) !write (sigchld_pipe[1], &byte, 1);
+    errno = saved_errno;
+}
+
+
+static void
+helper_send_reply (guint32 type,
+                   guint32 id,
+                   pid_t   pid,
+                   int     value)
+{
+    const Reply reply = { type, id, pid, value };
+    while (send (HELPER_SOCKET_FD, &reply, sizeof (Reply), MSG_NOSIGNAL) < 0 &&
+           errno == EINTR);
+}
+
+
+static G_GNUC_NORETURN void
+helper_exec_child (int    pty_fd,
+                   char  *workdir,
+                   char **argv,
+                   char **envv,
+                   int    error_fd)
+{
+    /*
+     * Besides the SIGCHLD handler of the helper, ignored signals and the
+     * signal mask are kept across exec, and may come from whatever started
+     * dwt. Reset all of them, as VTE does for the children it spawns.
+     */
+    struct sigaction action = { .sa_handler = SIG_DFL };
+    for (int signum = 1; signum < NSIG; signum++)
+        if (signum != SIGKILL && signum != SIGSTOP)
+            sigaction (signum, &action, NULL);
+
+    sigset_t mask;
+    sigemptyset (&mask);
+    sigprocmask (SIG_SETMASK, &mask, NULL);
+
+    if (setsid () < 0)
+        goto failed;
+
+    const char *slave_path = ptsname (pty_fd);
+    int slave_fd = slave_path ? open (slave_path, O_RDWR) : -1;
+    if (slave_fd < 0)
+        goto failed;
+
+    /* Opening the slave after setsid() already makes it the controlling
+     * terminal on Linux, but other systems need the ioctl. */
+    ioctl (slave_fd, TIOCSCTTY, 0);
+
+    if (dup2 (slave_fd, STDIN_FILENO) < 0 ||
+        dup2 (slave_fd, STDOUT_FILENO) < 0 ||
+        dup2 (slave_fd, STDERR_FILENO) < 0)
+        goto failed;
+    if (slave_fd > STDERR_FILENO)
+        close (slave_fd);
+    close (pty_fd);
+
+    if (workdir[0] && chdir (workdir) < 0)
+        goto failed;
+
+    environ = envv;
+    execvp (argv[0], argv);
+
+failed:
+    (void) !write (error_fd, &errno, sizeof (errno));
+    _exit (127);
+}
+
+
+static pid_t
+helper_spawn (int    pty_fd,
+              char  *workdir,
+              char **argv,
+              char **envv,
+              int   *error_code)
+{
+    int error_pipe[2];
+    if (pipe2 (error_pipe, O_CLOEXEC) < 0) {
+        *error_code = errno;
+        return -1;
+    }
+
+    pid_t pid = fork ();
+    if (pid == 0) {
+        close (error_pipe[0]);
+        helper_exec_child (pty_fd, workdir, argv, envv, error_pipe[1]);
+    }
+
+    close (error_pipe[1]);
+    if (pid < 0) {
+        *error_code = errno;
+        close (error_pipe[0]);
+        return -1;
+    }
+
+    /* The pipe is closed on a successful exec, without any data. */
+    ssize_t nread;
+    while ((nread = read (error_pipe[0], error_code, sizeof (int))) < 0 &&
+           errno == EINTR);
+    close (error_pipe[0]);
+
+    if (nread == sizeof (int)) {
+        while (waitpid (pid, NULL, 0) < 0 && errno == EINTR);
+        return -1;
+    }
+    return pid;
+}
+
+
+static void
+helper_handle_request (char  *data,
+                       size_t size,
+                       int    pty_fd)
+{
+    RequestHeader header;
+    if (size < sizeof (RequestHeader))
+        return;
+    memcpy (&header, data, sizeof (RequestHeader));
+
+    const size_t n_strings = 1 + (size_t) header.argc + header.envc;
+    if (pty_fd < 0 || header.argc == 0 || n_strings > size)
+        goto invalid;
+
+    /* Both lists are NULL-terminated, hence the extra two elements. */
+    char **strings = calloc (n_strings + 2, sizeof (char*));
+    if (!strings)
+        goto invalid;
+
+    char *p = data + sizeof (RequestHeader);
+    char *end = data + size;
+    for (size_t i = 0, j = 0; i < n_strings; i++, j++) {
+        char *nul = memchr (p, '\0', end - p);
+        if (!nul) {
+            free (strings);
+            goto invalid;
+        }
+        if (i == 1 + header.argc)
+            j++;  /* Skip the NULL terminating the arguments. */
+        strings[j] = p;
+        p = nul + 1;
+    }
+
+    int error_code = 0;
+    pid_t pid = helper_spawn (pty_fd,
+                              strings[0],
+                              strings + 1,
+                              strings + 2 + header.argc,
+                              &error_code);
+    helper_send_reply (REPLY_SPAWNED, header.id, pid, error_code);
+    free (strings);
+    return;
+
+invalid:
+    helper_send_reply (REPLY_SPAWNED, header.id, -1, EINVAL);
+}
+
+
+int
+dwt_spawn_helper_main (void)
+{
+    if (pipe2 (sigchld_pipe, O_CLOEXEC | O_NONBLOCK) < 0)
+        return EXIT_FAILURE;
+
+    struct sigaction action = {
+        .sa_handler = sigchld_handler,
+        .sa_flags = SA_RESTART | SA_NOCLDSTOP,
+    };
+    sigaction (SIGCHLD, &action, NULL);
+    fcntl (HELPER_SOCKET_FD, F_SETFD, FD_CLOEXEC);
+
+    char *buffer = malloc (MAX_REQUEST_SIZE);
+    if (!buffer)
+        return EXIT_FAILURE;
+
+    for (;;) {
+        struct pollfd fds[2] = {
+            { .fd = HELPER_SOCKET_FD, .events = POLLIN },
+            { .fd = sigchld_pipe[0],  .events = POLLIN },
+        };
+        if (poll (fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            char drain[64];
+            while (read (sigchld_pipe[0], drain, sizeof (drain)) > 0);
+
+            pid_t pid;
+            int status;
+            while ((pid = waitpid (-1, &status, WNOHANG)) > 0)
+                helper_send_reply (REPLY_EXITED, 0, pid, status);
+        }
+
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            union {
+                struct cmsghdr header;
+                char data[CMSG_SPACE (sizeof (int))];
+            } control;
+            struct iovec iov = { buffer, MAX_REQUEST_SIZE };
+            struct msghdr message = {
+                .msg_iov = &iov,
+                .msg_iovlen = 1,
+                .msg_control = &control,
+                .msg_controllen = sizeof (control),
+            };
+
+            ssize_t size = recvmsg (HELPER_SOCKET_FD, &message, MSG_CMSG_CLOEXEC);
+            if (size < 0 && errno == EINTR)
+                continue;
+            if (size <= 0)
+                break;
+
+            int pty_fd = -1;
+            struct cmsghdr *cmsg = CMSG_FIRSTHDR (&message);
+            if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+                memcpy (&pty_fd, CMSG_DATA (cmsg), sizeof (int));
+
+            helper_handle_request (buffer, size, pty_fd);
+            if (pty_fd >= 0)
+                close (pty_fd);
+        }
+    }
+
+    free (buffer);
+    return EXIT_SUCCESS;
+}
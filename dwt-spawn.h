@@ -0,0 +1,48 @@
+/*
+ * dwt-spawn.h
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#ifndef DWT_SPAWN_H
+#define DWT_SPAWN_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define DWT_SPAWN_HELPER_ARG "--spawn-helper"
+
+typedef struct _DwtSpawnHelper DwtSpawnHelper;
+
+typedef void (*DwtSpawnCallback) (GPid          pid,
+                                  const GError *error,
+                                  gpointer      userdata);
+typedef void (*DwtExitCallback)  (GPid          pid,
+                                  gint          status,
+                                  gpointer      userdata);
+
+DwtSpawnHelper* dwt_spawn_helper_new        (const gchar      *program,
+                                             DwtExitCallback   exited,
+                                             gpointer          userdata,
+                                             GError          **error);
+gboolean        dwt_spawn_helper_is_running (DwtSpawnHelper   *helper);
+gboolean        dwt_spawn_helper_spawn      (DwtSpawnHelper   *helper,
+                                             gint              pty_fd,
+                                             const gchar      *workdir,
+                                             gchar           **argv,
+                                             gchar           **envv,
+                                             DwtSpawnCallback  callback,
+                                             gpointer          userdata,
+                                             GDestroyNotify    destroy,
+                                             GError          **error);
+void            dwt_spawn_helper_free       (DwtSpawnHelper   *helper);
+
+int             dwt_spawn_helper_main       (void);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (DwtSpawnHelper, dwt_spawn_helper_free)
+
+G_END_DECLS
+
+#endif /* !DWT_SPAWN_H */
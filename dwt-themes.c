@@ -0,0 +1,456 @@
+/*
+ * dwt-themes.c
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include "dwt-themes.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef DWT_DEFAULT_THEME
+#define DWT_DEFAULT_THEME "jellybeans"
+#endif /* !DWT_DEFAULT_THEME */
+
+
+/*
+ * Generated at build time by tools/generate-themes from themes/*.xrdb,
+ * with the entries sorted by name.
+ */
+#include "dwt-themes-builtin.h"
+
+
+/*
+ * User themes are read from $XDG_CONFIG_HOME/dwt/themes, either in the
+ * XRDB format used for the built-in themes (*.xrdb files), or
+ * as key files (*.theme files) with a [Theme] group containing the
+ * Foreground, Background, and Color0…Color15 keys. Parsed themes are saved
+ * into a single binary cache file, which is used as long as the number of
+ * source files, their total size, and their most recent modification time
+ * (in microseconds) do not change. Colors are saved as they were parsed,
+ * including their alpha.
+ */
+
+#define THEME_CACHE_MAGIC "DWTTHM02"
+
+enum {
+    THEME_CACHE_FG,
+    THEME_CACHE_BG,
+    THEME_CACHE_COLOR0,
+    THEME_CACHE_N_COLORS = THEME_CACHE_COLOR0 + 16,
+};
+
+typedef struct {
+    guint64 size;
+    gint64  mtime;
+    guint32 n_sources;
+} ThemeSourcesStamp;
+
+typedef struct {
+    gchar   magic[8];
+    guint32 n_themes;
+    guint32 n_sources;
+    guint64 size;
+    gint64  mtime;
+} ThemeCacheHeader;
+
+typedef struct {
+    guint32 name_offset;
+    guint32 padding;
+    gdouble rgba[THEME_CACHE_N_COLORS][4];
+} ThemeCacheEntry;
+
+typedef struct {
+    GHashTable   *by_name;
+    GArray       *user_themes;
+    GStringChunk *user_names;
+} ThemeRegistry;
+
+
+static GdkRGBA*
+theme_color (Theme *theme, guint index)
+{
+    switch (index) {
+        case THEME_CACHE_FG: return &theme->fg;
+        case THEME_CACHE_BG: return &theme->bg;
+        default: return &theme->colors[index - THEME_CACHE_COLOR0];
+    }
+}
+
+
+static gchar*
+theme_name_from_path (const gchar *path)
+{
+    gchar *name = g_path_get_basename (path);
+    gchar *dot = strrchr (name, '.');
+    if (dot) *dot = '\0';
+
+    for (gchar *p = name; *p; p++) {
+        *p = g_ascii_tolower (*p);
+        if (!g_ascii_isalnum (*p) && *p != '_')
+            *p = '-';
+    }
+    return name;
+}
+
+
+static gboolean
+parse_xrdb_theme (const gchar *path,
+                  Theme       *theme)
+{
+    g_autofree gchar *contents = NULL;
+    if (!g_file_get_contents (path, &contents, NULL, NULL))
+        return FALSE;
+
+    guint32 found = 0;
+    g_auto(GStrv) lines = g_strsplit (contents, "\n", -1);
+    for (guint i = 0; lines[i]; i++) {
+        gchar name[64], hex[8];
+        if (sscanf (lines[i], "#define %63s #%7[0-9a-fA-F]", name, hex) != 2 ||
+            strlen (hex) != 6)
+            continue;
+
+        guint index, ansi;
+        if (g_str_equal (name, "Foreground_Color"))
+            index = THEME_CACHE_FG;
+        else if (g_str_equal (name, "Background_Color"))
+            index = THEME_CACHE_BG;
+        else if (sscanf (name, "Ansi_%u_Color", &ansi) == 1 && ansi < 16)
+            index = THEME_CACHE_COLOR0 + ansi;
+        else
+            continue;
+
+        g_autofree gchar *spec = g_strconcat ("#", hex, NULL);
+        if (gdk_rgba_parse (theme_color (theme, index), spec))
+            found |= 1 << index;
+    }
+
+    return found == (1 << THEME_CACHE_N_COLORS) - 1;
+}
+
+
+static gboolean
+parse_keyfile_theme (const gchar *path,
+                     Theme       *theme)
+{
+    g_autoptr(GKeyFile) keyfile = g_key_file_new ();
+    if (!g_key_file_load_from_file (keyfile, path, G_KEY_FILE_NONE, NULL))
+        return FALSE;
+
+    for (guint index = 0; index < THEME_CACHE_N_COLORS; index++) {
+        g_autofree gchar *key = NULL;
+        switch (index) {
+            case THEME_CACHE_FG: key = g_strdup ("Foreground"); break;
+            case THEME_CACHE_BG: key = g_strdup ("Background"); break;
+            default: key = g_strdup_printf ("Color%u", index - THEME_CACHE_COLOR0);
+        }
+
+        g_autofree gchar *spec = g_key_file_get_string (keyfile, "Theme", key, NULL);
+        if (!spec || !gdk_rgba_parse (theme_color (theme, index), spec))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+
+static gint
+compare_names (gconstpointer a, gconstpointer b)
+{
+    return g_strcmp0 (*(const gchar**) a, *(const gchar**) b);
+}
+
+
+/* Modification time in µs, which struct stat does not portably have. */
+static gboolean
+query_file_stamp (const gchar *path,
+                  guint64     *size,
+                  gint64      *mtime)
+{
+    g_autoptr(GFile) file = g_file_new_for_path (path);
+    g_autoptr(GFileInfo) info =
+        g_file_query_info (file,
+                           G_FILE_ATTRIBUTE_STANDARD_SIZE ","
+                           G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+                           G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+                           G_FILE_QUERY_INFO_NONE,
+                           NULL,
+                           NULL);
+    if (!info)
+        return FALSE;
+
+    *size = g_file_info_get_size (info);
+    *mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED)
+        * G_USEC_PER_SEC
+        + g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+    return TRUE;
+}
+
+
+static GPtrArray*
+scan_theme_sources (const gchar       *dir_path,
+                    ThemeSourcesStamp *stamp)
+{
+    GDir *dir = g_dir_open (dir_path, 0, NULL);
+    if (!dir)
+        return NULL;
+
+    GPtrArray *sources = g_ptr_array_new_with_free_func (g_free);
+    guint64 size;
+    gint64 mtime;
+
+    /* The directory changes when files are removed or renamed. */
+    *stamp = (ThemeSourcesStamp) { 0, };
+    if (query_file_stamp (dir_path, &size, &mtime))
+        stamp->mtime = mtime;
+
+    const gchar *name;
+    while ((name = g_dir_read_name (dir))) {
+        if (!g_str_has_suffix (name, ".xrdb") && !g_str_has_suffix (name, ".theme"))
+            continue;
+
+        gchar *path = g_build_filename (dir_path, name, NULL);
+        if (!query_file_stamp (path, &size, &mtime)) {
+            g_free (path);
+            continue;
+        }
+        stamp->size += size;
+        stamp->mtime = MAX (stamp->mtime, mtime);
+        g_ptr_array_add (sources, path);
+    }
+    g_dir_close (dir);
+    stamp->n_sources = sources->len;
+
+    /* Sort, so the last of files with the same theme name always wins. */
+    g_ptr_array_sort (sources, compare_names);
+    return sources;
+}
+
+
+static void
+parse_theme_sources (ThemeRegistry *registry,
+                     GPtrArray     *sources)
+{
+    for (guint i = 0; i < sources->len; i++) {
+        const gchar *path = g_ptr_array_index (sources, i);
+
+        Theme theme = { NULL, };
+        gboolean parsed = g_str_has_suffix (path, ".xrdb")
+            ? parse_xrdb_theme (path, &theme)
+            : parse_keyfile_theme (path, &theme);
+        if (!parsed) {
+            g_printerr ("Could not load theme from '%s', ignored\n", path);
+            continue;
+        }
+
+        g_autofree gchar *name = theme_name_from_path (path);
+        theme.name = g_string_chunk_insert_const (registry->user_names, name);
+        g_array_append_val (registry->user_themes, theme);
+    }
+}
+
+
+static gboolean
+load_theme_cache (ThemeRegistry           *registry,
+                  const gchar             *cache_path,
+                  const ThemeSourcesStamp *stamp)
+{
+    g_autofree gchar *contents = NULL;
+    gsize length = 0;
+    if (!g_file_get_contents (cache_path, &contents, &length, NULL))
+        return FALSE;
+
+    const ThemeCacheHeader *header = (const ThemeCacheHeader*) contents;
+    if (length < sizeof (ThemeCacheHeader) ||
+        memcmp (header->magic, THEME_CACHE_MAGIC, sizeof (header->magic)) ||
+        header->n_sources != stamp->n_sources ||
+        header->size != stamp->size ||
+        header->mtime != stamp->mtime ||
+        header->n_themes > (length - sizeof (ThemeCacheHeader)) / sizeof (ThemeCacheEntry))
+        return FALSE;
+
+    const ThemeCacheEntry *entries =
+        (const ThemeCacheEntry*) (contents + sizeof (ThemeCacheHeader));
+    for (guint32 i = 0; i < header->n_themes; i++) {
+        const guint32 offset = entries[i].name_offset;
+        if (offset >= length || !memchr (contents + offset, '\0', length - offset)) {
+            g_array_set_size (registry->user_themes, 0);
+            return FALSE;
+        }
+
+        Theme theme = {
+            .name = g_string_chunk_insert_const (registry->user_names,
+                                                 contents + offset),
+        };
+        for (guint index = 0; index < THEME_CACHE_N_COLORS; index++) {
+            GdkRGBA *color = theme_color (&theme, index);
+            color->red   = entries[i].rgba[index][0];
+            color->green = entries[i].rgba[index][1];
+            color->blue  = entries[i].rgba[index][2];
+            color->alpha = entries[i].rgba[index][3];
+        }
+        g_array_append_val (registry->user_themes, theme);
+    }
+    return TRUE;
+}
+
+
+static void
+save_theme_cache (ThemeRegistry           *registry,
+                  const gchar             *cache_path,
+                  const ThemeSourcesStamp *stamp)
+{
+    const guint n_themes = registry->user_themes->len;
+    GByteArray *data = g_byte_array_new ();
+
+    ThemeCacheHeader header = {
+        .n_themes = n_themes,
+        .n_sources = stamp->n_sources,
+        .size = stamp->size,
+        .mtime = stamp->mtime,
+    };
+    memcpy (header.magic, THEME_CACHE_MAGIC, sizeof (header.magic));
+    g_byte_array_append (data, (const guint8*) &header, sizeof (header));
+
+    guint32 name_offset = sizeof (ThemeCacheHeader) + n_themes * sizeof (ThemeCacheEntry);
+    for (guint i = 0; i < n_themes; i++) {
+        Theme *theme = &g_array_index (registry->user_themes, Theme, i);
+        ThemeCacheEntry entry = { .name_offset = name_offset };
+        for (guint index = 0; index < THEME_CACHE_N_COLORS; index++) {
+            const GdkRGBA *color = theme_color (theme, index);
+            entry.rgba[index][0] = color->red;
+            entry.rgba[index][1] = color->green;
+            entry.rgba[index][2] = color->blue;
+            entry.rgba[index][3] = color->alpha;
+        }
+        g_byte_array_append (data, (const guint8*) &entry, sizeof (entry));
+        name_offset += strlen (theme->name) + 1;
+    }
+
+    for (guint i = 0; i < n_themes; i++) {
+        const gchar *name = g_array_index (registry->user_themes, Theme, i).name;
+        g_byte_array_append (data, (const guint8*) name, strlen (name) + 1);
+    }
+
+    g_autoptr(GError) error = NULL;
+    g_autofree gchar *cache_dir = g_path_get_dirname (cache_path);
+    if (g_mkdir_with_parents (cache_dir, 0700) != 0 ||
+        !g_file_set_contents (cache_path, (const gchar*) data->data, data->len, &error))
+        g_printerr ("Could not write theme cache '%s': %s\n", cache_path,
+                    error ? error->message : g_strerror (errno));
+
+    g_byte_array_unref (data);
+}
+
+
+static void
+load_user_themes (ThemeRegistry *registry)
+{
+    g_autofree gchar *dir_path = g_build_filename (g_get_user_config_dir (),
+                                                   g_get_prgname (),
+                                                   "themes",
+                                                   NULL);
+    ThemeSourcesStamp stamp;
+    g_autoptr(GPtrArray) sources = scan_theme_sources (dir_path, &stamp);
+    if (!sources || sources->len == 0)
+        return;
+
+    g_autofree gchar *cache_path = g_build_filename (g_get_user_cache_dir (),
+                                                     g_get_prgname (),
+                                                     "themes.cache",
+                                                     NULL);
+    if (!load_theme_cache (registry, cache_path, &stamp)) {
+        parse_theme_sources (registry, sources);
+        save_theme_cache (registry, cache_path, &stamp);
+    }
+}
+
+
+static gpointer
+theme_registry_create (gpointer dummy)
+{
+    ThemeRegistry *registry = g_new0 (ThemeRegistry, 1);
+    registry->by_name = g_hash_table_new (g_str_hash, g_str_equal);
+    registry->user_themes = g_array_new (FALSE, TRUE, sizeof (Theme));
+    registry->user_names = g_string_chunk_new (256);
+
+    /*
+     * The array is not modified after loading, so it is safe to keep
+     * pointers to its elements.
+     */
+    load_user_themes (registry);
+    for (guint i = 0; i < registry->user_themes->len; i++) {
+        Theme *theme = &g_array_index (registry->user_themes, Theme, i);
+        g_hash_table_insert (registry->by_name, (gpointer) theme->name, theme);
+    }
+
+    return registry;
+}
+
+
+static ThemeRegistry*
+theme_registry_get (void)
+{
+    static GOnce registry_once = G_ONCE_INIT;
+    return g_once (&registry_once, theme_registry_create, NULL);
+}
+
+
+static gint
+compare_theme_name (gconstpointer key, gconstpointer element)
+{
+    return strcmp (key, ((const Theme*) element)->name);
+}
+
+
+const Theme*
+dwt_themes_lookup (const gchar *name)
+{
+    g_return_val_if_fail (name != NULL, NULL);
+
+    /* User themes override built-in ones. */
+    const Theme *theme = g_hash_table_lookup (theme_registry_get ()->by_name, name);
+    if (theme)
+        return theme;
+
+    return bsearch (name,
+                    builtin_themes,
+                    G_N_ELEMENTS (builtin_themes),
+                    sizeof (Theme),
+                    compare_theme_name);
+}
+
+
+const Theme*
+dwt_themes_get_default (void)
+{
+    const Theme *theme = dwt_themes_lookup (DWT_DEFAULT_THEME);
+    g_assert (theme);
+    return theme;
+}
+
+
+const gchar**
+dwt_themes_list_names (void)
+{
+    GHashTable *user_themes = theme_registry_get ()->by_name;
+    GPtrArray *names = g_ptr_array_sized_new (G_N_ELEMENTS (builtin_themes) +
+                                              g_hash_table_size (user_themes) + 1);
+
+    for (guint i = 0; i < G_N_ELEMENTS (builtin_themes); i++) {
+        if (!g_hash_table_contains (user_themes, builtin_themes[i].name))
+            g_ptr_array_add (names, (gpointer) builtin_themes[i].name);
+    }
+
+    GHashTableIter iter;
+    gpointer name;
+    g_hash_table_iter_init (&iter, user_themes);
+    while (g_hash_table_iter_next (&iter, &name, NULL))
+        g_ptr_array_add (names, name);
+
+    g_ptr_array_sort (names, compare_names);
+    g_ptr_array_add (names, NULL);
+    return (const gchar**) g_ptr_array_free (names, FALSE);
+}
@@ -0,0 +1,27 @@
+/*
+ * dwt-themes.h
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#ifndef DWT_THEMES_H
+#define DWT_THEMES_H
+
+#include <gdk/gdk.h>
+
+G_BEGIN_DECLS
+
+typedef struct {
+    const gchar *name;
+    GdkRGBA fg, bg;
+    GdkRGBA colors[16];
+} Theme;
+
+const Theme*  dwt_themes_lookup      (const gchar *name);
+const Theme*  dwt_themes_get_default (void);
+const gchar** dwt_themes_list_names  (void);
+
+G_END_DECLS
+
+#endif /* !DWT_THEMES_H */
@@ -9,14 +9,24 @@
 
 #define DWT_GRESOURCE(name)  ("/org/perezdecastro/dwt/" name)
 
+#include "dwt-cast.h"
+#include "dwt-log.h"
+#include "dwt-procstat.h"
+#include "dwt-relay.h"
 #include "dwt-settings.h"
+#include "dwt-spawn.h"
+#include "dwt-themes.h"
 #include <gtk/gtk.h>
 #include <gio/gvfs.h>
+#include <glib-unix.h>
+#include <glib/gstdio.h>
+#include <errno.h>
 #include <pcre2.h>
 #include <pwd.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#include <unistd.h>
 #include <vte/vte.h>
 
 #ifdef GDK_WINDOWING_X11
@@ -32,12 +42,46 @@ static gchar *last_match_text = NULL;
 /* Default font size */
 static gint default_font_size = 0;
 
+/* Monotonic time at startup, used to report the time to the first frame. */
+static gint64 startup_time = 0;
+
+/* Font given with --font to the first instance, to warm it up as well. */
+static const gchar *startup_font = NULL;
+
+/* Whether running with --headless, and the exit code to use then. */
+static gboolean headless_mode = FALSE;
+static gint headless_exit_code = EXIT_SUCCESS;
+
+/* Menu models, parsed once from the resources at startup. */
+static GMenuModel *app_menu_model = NULL;
+static GMenuModel *popover_menu_model = NULL;
+
 
 /* Forward declarations. */
 static GtkWidget*
 create_new_window (GtkApplication *application,
                    GVariantDict   *options);
 
+static VteTerminal*
+window_add_terminal (GtkWindow    *window,
+                     GVariantDict *options);
+
+static gboolean
+window_first_drawn (GtkWidget *widget,
+                    cairo_t   *cr,
+                    gpointer   userdata);
+
+static void
+term_spawn_pending (VteTerminal *vtterm);
+
+static gint64
+term_get_output_bytes (VteTerminal *vtterm);
+
+#if VTE_CHECK_VERSION (0, 68, 0)
+static gint
+term_get_bracketed_paste (VteTerminal *vtterm);
+#endif /* VTE_CHECK_VERSION (0, 68, 0) */
+
 
 static const GOptionEntry option_entries[] =
 {
@@ -111,31 +155,81 @@ static const GOptionEntry option_entries[] =
         NULL,
         "Disable header bars in terminal windows (use window manager decorations)",
         NULL,
+    }, {
+        "log-directory", 'L',
+        G_OPTION_FLAG_IN_MAIN,
+        G_OPTION_ARG_STRING,
+        NULL,
+        "Log the output of the terminals in the window to files in a directory",
+        "PATH",
+    }, {
+        "latency-probe", 0,
+        G_OPTION_FLAG_IN_MAIN,
+        G_OPTION_ARG_NONE,
+        NULL,
+        "Measure the latency from key presses to frames, print it on close",
+        NULL,
+    }, {
+        "latency-probe-keys", 0,
+        G_OPTION_FLAG_IN_MAIN,
+        G_OPTION_ARG_INT,
+        NULL,
+        "Measure latency for COUNT synthesized key presses, then close",
+        "COUNT",
+    }, {
+        "headless", 0,
+        G_OPTION_FLAG_IN_MAIN,
+        G_OPTION_ARG_NONE,
+        NULL,
+        "Run the command in an offscreen terminal, print its text on exit",
+        NULL,
+    }, {
+        "headless-input", 0,
+        G_OPTION_FLAG_IN_MAIN,
+        G_OPTION_ARG_STRING,
+        NULL,
+        "Send the contents of a file as input in headless mode",
+        "PATH",
+    }, {
+        "headless-output", 0,
+        G_OPTION_FLAG_IN_MAIN,
+        G_OPTION_ARG_STRING,
+        NULL,
+        "Write the terminal text to a file instead in headless mode",
+        "PATH",
+    }, {
+        "headless-png", 0,
+        G_OPTION_FLAG_IN_MAIN,
+        G_OPTION_ARG_STRING,
+        NULL,
+        "Save an image of the terminal in headless mode",
+        "PATH",
+    }, {
+        "record", 0,
+        G_OPTION_FLAG_IN_MAIN,
+        G_OPTION_ARG_STRING,
+        NULL,
+        "Record the output of the command to a file, in asciicast format",
+        "PATH",
+    }, {
+        "replay", 0,
+        G_OPTION_FLAG_IN_MAIN,
+        G_OPTION_ARG_STRING,
+        NULL,
+        "Replay a recording instead of running a command",
+        "PATH",
+    }, {
+        "replay-speed", 0,
+        G_OPTION_FLAG_IN_MAIN,
+        G_OPTION_ARG_DOUBLE,
+        NULL,
+        "Speed factor for replaying, zero replays as fast as possible",
+        "FACTOR",
     },
     { NULL }
 };
 
 
-typedef struct {
-    const gchar *name;
-    GdkRGBA fg, bg;
-    GdkRGBA colors[16];
-} Theme;
-
-
-/* The first element is the "default" theme. */
-static const Theme themes[] = {
-#include "themes/linux.h"
-#include "themes/jellybeans.h"
-#include "themes/monokai.h"
-#include "themes/molokai.h"
-#include "themes/solarized.h"
-#include "themes/thayer.h"
-#include "themes/wombat.h"
-#include "themes/zenburn.h"
-};
-
-
 static GdkRGBA cursor_active   = {   0, 0.75,   0, 1 };
 static GdkRGBA cursor_inactive = { 0.6,  0.6, 0.6, 1 };
 
@@ -146,17 +240,17 @@ static const gchar image_regex_string[] = "/[^/]+\\.(png|jpg|jpeg|gif|webp)$";
 
 static GRegex *image_regex = NULL;
 
-
-static const Theme* const
-find_theme (const gchar *name)
-{
-    for (size_t i = 0; i < G_N_ELEMENTS (themes); i++) {
-        if (g_str_equal (name, themes[i].name)) {
-            return &themes[i];
-        }
-    }
-    return NULL;
-}
+/*
+ * Regexp used to match file paths (e.g. "src/foo.c:123" in compiler output)
+ * which are absolute, relative to the home directory, contain a directory,
+ * or are followed by a line number. They are clickable only if they exist.
+ */
+static const gchar path_regexp[] =
+    "(?<![\\w/.~-])"
+    "(?:(?:~|\\.{1,2})?/[\\w.+-]+(?:/[\\w.+-]+)*"
+    "|[\\w.+-]+(?:/[\\w.+-]+)+"
+    "|[\\w+-][\\w.+-]*\\.\\w+(?=:\\d))"
+    "(?::\\d+(?::\\d+)?)?";
 
 
 #define SWAP(t, a, b)             \
@@ -166,6 +260,350 @@ find_theme (const gchar *name)
         (b) = tmp_ ## __LINE__;   \
     } while (0)
 
+static PangoFontDescription*
+font_description_from_string (const gchar *font)
+{
+    PangoFontDescription *fontd = pango_font_description_from_string (font);
+    if (fontd) {
+      if (!pango_font_description_get_family (fontd))
+        pango_font_description_set_family_static (fontd, "monospace");
+      if (!pango_font_description_get_size (fontd))
+        pango_font_description_set_size (fontd, 12 * PANGO_SCALE);
+    }
+    return fontd;
+}
+
+
+static void
+term_hyperlink_hovered (VteTerminal  *vtterm,
+                        const gchar  *uri,
+                        GdkRectangle *bbox,
+                        gpointer      userdata)
+{
+    /* The text of a hyperlink may not match its target, show the latter. */
+    gtk_widget_set_tooltip_text (GTK_WIDGET (vtterm), uri);
+}
+
+
+/*
+ * Whether matched file paths exist is checked with g_file_query_info_async()
+ * as the pointer moves over them, so the main thread never waits for the file
+ * system (which may be slow, e.g. over NFS). Results are cached for a few
+ * seconds, and shared by all terminals. Paths get the hand cursor and can be
+ * opened only once they are known to exist; as VTE only picks the cursor of a
+ * match when the pointer moves, it is updated on the next motion after the
+ * check completes.
+ *
+ * VTE does not tell which match is hovered, so the path under the pointer is
+ * found with vte_terminal_match_check_event(), which runs all the match regexes
+ * over the line again. This is done at most once per PATH_CHECK_INTERVAL_MS
+ * while the pointer moves, for its last position. The cursor type belongs to
+ * the path match tag as a whole, so it is set back to the text cursor as soon
+ * as the pointer is not over an existing path; meanwhile other paths show the
+ * hand cursor as well.
+ */
+#define PATH_CACHE_TTL         (5 * G_TIME_SPAN_SECOND)
+#define PATH_CACHE_SIZE        256
+#define PATH_CHECK_INTERVAL_MS 50
+
+typedef enum {
+    PATH_UNKNOWN = 0,
+    PATH_PENDING,
+    PATH_EXISTS,
+    PATH_MISSING,
+} PathStatus;
+
+typedef struct {
+    PathStatus status;
+    gint64     expires;
+} PathCacheEntry;
+
+typedef struct {
+    int       tag;
+    gboolean  hand_cursor;
+    glong     col, row;
+    gchar    *workdir;
+    gchar    *hovered;
+    GdkEvent *pending_event;
+    guint     check_id;
+} TermPathState;
+
+typedef struct {
+    GWeakRef  vtterm;
+    gchar    *path;
+} PathQuery;
+
+
+static GHashTable *path_cache = NULL;
+
+
+static gboolean
+path_cache_entry_expired (gpointer key,
+                          gpointer value,
+                          gpointer userdata)
+{
+    const PathCacheEntry *entry = value;
+    const gint64 *now = userdata;
+    return entry->status != PATH_PENDING && entry->expires <= *now;
+}
+
+
+static PathStatus
+path_cache_lookup (const gchar *path)
+{
+    const PathCacheEntry *entry = path_cache ? g_hash_table_lookup (path_cache, path) : NULL;
+    if (!entry)
+        return PATH_UNKNOWN;
+
+    const gint64 now = g_get_monotonic_time ();
+    return path_cache_entry_expired (NULL, (gpointer) entry, (gpointer) &now)
+        ? PATH_UNKNOWN : entry->status;
+}
+
+
+static void
+path_cache_store (const gchar *path,
+                  PathStatus   status)
+{
+    if (!path_cache)
+        path_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+    const gint64 now = g_get_monotonic_time ();
+    if (g_hash_table_size (path_cache) >= PATH_CACHE_SIZE) {
+        g_hash_table_foreach_remove (path_cache, path_cache_entry_expired, (gpointer) &now);
+        if (g_hash_table_size (path_cache) >= PATH_CACHE_SIZE)
+            g_hash_table_remove_all (path_cache);
+    }
+
+    PathCacheEntry *entry = g_new (PathCacheEntry, 1);
+    entry->status = status;
+    entry->expires = now + PATH_CACHE_TTL;
+    g_hash_table_replace (path_cache, g_strdup (path), entry);
+}
+
+
+static void
+term_path_state_free (gpointer userdata)
+{
+    TermPathState *state = userdata;
+    if (state->check_id)
+        g_source_remove (state->check_id);
+    g_clear_pointer (&state->pending_event, gdk_event_free);
+    g_free (state->workdir);
+    g_free (state->hovered);
+    g_free (state);
+}
+
+
+static TermPathState*
+term_get_path_state (VteTerminal *vtterm)
+{
+    return g_object_get_data (G_OBJECT (vtterm), "dwt-path-state");
+}
+
+
+static void
+term_set_path_cursor (VteTerminal   *vtterm,
+                      TermPathState *state,
+                      gboolean       hand_cursor)
+{
+    if (state->hand_cursor == hand_cursor)
+        return;
+
+    /* This also makes VTE look up the cursor for the hovered match again. */
+    state->hand_cursor = hand_cursor;
+    vte_terminal_match_set_cursor_type (vtterm, state->tag,
+                                        hand_cursor ? GDK_HAND2 : GDK_XTERM);
+}
+
+
+/*
+ * Turns matched text into an absolute path, without the trailing line and
+ * column numbers. Relative paths are resolved against the directory last
+ * reported by the shell (OSC 7), or the one where the terminal started.
+ */
+static gchar*
+term_resolve_path (VteTerminal   *vtterm,
+                   TermPathState *state,
+                   const gchar   *match)
+{
+    g_autofree gchar *path = g_strndup (match, strcspn (match, ":"));
+
+    /* Most likely a full stop at the end of a sentence. */
+    const gsize length = strlen (path);
+    if (length > 1 && path[length - 1] == '.' && !strchr ("./", path[length - 2]))
+        path[length - 1] = '\0';
+
+    if (path[0] == '~')
+        return g_build_filename (g_get_home_dir (), path + 1, NULL);
+
+    g_autoptr(GFile) base = NULL;
+    const char *cwd_uri = vte_terminal_get_current_directory_uri (vtterm);
+    if (cwd_uri)
+        base = g_file_new_for_uri (cwd_uri);
+    else
+        base = g_file_new_for_path (state->workdir);
+
+    g_autoptr(GFile) file = g_file_resolve_relative_path (base, path);
+    return g_file_get_path (file);
+}
+
+
+static void
+path_query_done (GObject      *source,
+                 GAsyncResult *result,
+                 gpointer      userdata)
+{
+    PathQuery *query = userdata;
+    g_autoptr(GFileInfo) info = g_file_query_info_finish (G_FILE (source), result, NULL);
+    path_cache_store (query->path, info ? PATH_EXISTS : PATH_MISSING);
+
+    VteTerminal *vtterm = g_weak_ref_get (&query->vtterm);
+    if (vtterm) {
+        TermPathState *state = term_get_path_state (vtterm);
+        if (g_strcmp0 (state->hovered, query->path) == 0)
+            term_set_path_cursor (vtterm, state, info != NULL);
+        g_object_unref (vtterm);
+    }
+
+    g_weak_ref_clear (&query->vtterm);
+    g_free (query->path);
+    g_free (query);
+}
+
+
+/*
+ * Returns whether the file path in the matched text exists, as far as it is
+ * known. When it is not, a check is started and PATH_PENDING returned.
+ */
+static PathStatus
+term_check_path (VteTerminal   *vtterm,
+                 TermPathState *state,
+                 const gchar   *match,
+                 gchar        **path_out)
+{
+    g_autofree gchar *path = term_resolve_path (vtterm, state, match);
+    PathStatus status = path ? path_cache_lookup (path) : PATH_MISSING;
+
+    if (status == PATH_UNKNOWN) {
+        path_cache_store (path, PATH_PENDING);
+
+        PathQuery *query = g_new0 (PathQuery, 1);
+        g_weak_ref_init (&query->vtterm, vtterm);
+        query->path = g_strdup (path);
+
+        g_autoptr(GFile) file = g_file_new_for_path (path);
+        g_file_query_info_async (file,
+                                 G_FILE_ATTRIBUTE_STANDARD_TYPE,
+                                 G_FILE_QUERY_INFO_NONE,
+                                 G_PRIORITY_DEFAULT,
+                                 NULL,
+                                 path_query_done,
+                                 query);
+        status = PATH_PENDING;
+    }
+
+    if (path_out)
+        *path_out = g_steal_pointer (&path);
+    return status;
+}
+
+
+static void
+term_path_check_event (VteTerminal   *vtterm,
+                       TermPathState *state,
+                       GdkEvent      *event)
+{
+    int tag;
+    g_autofree char *match = vte_terminal_match_check_event (vtterm, event, &tag);
+    g_clear_pointer (&state->hovered, g_free);
+
+    PathStatus status = PATH_MISSING;
+    if (match && tag == state->tag)
+        status = term_check_path (vtterm, state, match, &state->hovered);
+    term_set_path_cursor (vtterm, state, status == PATH_EXISTS);
+}
+
+
+static gboolean
+term_path_check_timeout (gpointer userdata)
+{
+    VteTerminal *vtterm = userdata;
+    TermPathState *state = term_get_path_state (vtterm);
+    if (!state->pending_event) {
+        state->check_id = 0;
+        return G_SOURCE_REMOVE;
+    }
+
+    term_path_check_event (vtterm, state, state->pending_event);
+    g_clear_pointer (&state->pending_event, gdk_event_free);
+    return G_SOURCE_CONTINUE;
+}
+
+
+static gboolean
+term_path_pointer_moved (VteTerminal    *vtterm,
+                         GdkEventMotion *event,
+                         TermPathState  *state)
+{
+    /* Matching is only needed when the pointer moves to another cell. */
+    const glong col = event->x / vte_terminal_get_char_width (vtterm);
+    const glong row = event->y / vte_terminal_get_char_height (vtterm);
+    if (col == state->col && row == state->row)
+        return FALSE;
+    state->col = col;
+    state->row = row;
+
+    /* Checked right away, then at most once per interval while moving. */
+    if (state->check_id) {
+        g_clear_pointer (&state->pending_event, gdk_event_free);
+        state->pending_event = gdk_event_copy ((GdkEvent*) event);
+    } else {
+        term_path_check_event (vtterm, state, (GdkEvent*) event);
+        state->check_id = g_timeout_add (PATH_CHECK_INTERVAL_MS,
+                                         term_path_check_timeout,
+                                         vtterm);
+    }
+    return FALSE;
+}
+
+
+static gboolean
+term_path_pointer_left (VteTerminal      *vtterm,
+                        GdkEventCrossing *event,
+                        TermPathState    *state)
+{
+    state->col = state->row = -1;
+    g_clear_pointer (&state->pending_event, gdk_event_free);
+    g_clear_pointer (&state->hovered, g_free);
+    term_set_path_cursor (vtterm, state, FALSE);
+    return FALSE;
+}
+
+
+static int
+term_add_match_regex (VteTerminal   *vtterm,
+                      const gchar   *pattern,
+                      GdkCursorType  cursor_type)
+{
+    g_autoptr(GError) error = NULL;
+    g_autoptr(VteRegex) regex =
+        vte_regex_new_for_match (pattern, -1,
+                                 PCRE2_CASELESS | PCRE2_MULTILINE,
+                                 &error);
+    if (!regex) {
+        g_critical ("Could not compile regex '%s': %s", pattern, error->message);
+        return -1;
+    }
+
+    if (!vte_regex_jit (regex, PCRE2_JIT_COMPLETE, &error))
+        g_warning ("Could not JIT-compile regex '%s': %s", pattern, error->message);
+    int tag = vte_terminal_match_add_regex (vtterm, regex, PCRE2_NOTEMPTY);
+    vte_terminal_match_set_cursor_type (vtterm, tag, cursor_type);
+    return tag;
+}
+
+
 static void
 configure_term_widget (VteTerminal  *vtterm,
                        GVariantDict *options)
@@ -225,25 +663,24 @@ configure_term_widget (VteTerminal  *vtterm,
         g_variant_dict_lookup (options, "scrollback", "u", &opt_scroll);
     }
 
-    PangoFontDescription *fontd = pango_font_description_from_string (opt_font);
+    PangoFontDescription *fontd = font_description_from_string (opt_font);
     if (fontd) {
-      if (!pango_font_description_get_family (fontd))
-        pango_font_description_set_family_static (fontd, "monospace");
-      if (!pango_font_description_get_size (fontd))
-        pango_font_description_set_size (fontd, 12 * PANGO_SCALE);
       vte_terminal_set_font (vtterm, fontd);
       pango_font_description_free (fontd);
       fontd = NULL;
     }
 
-    const Theme *theme = &themes[1];
+    const Theme *theme = dwt_themes_get_default ();
     if (opt_theme) {
-        theme = find_theme (opt_theme);
+        theme = dwt_themes_lookup (opt_theme);
         if (!theme) {
-            g_printerr ("No such theme '%s', using default (linux)\n", opt_theme);
-            theme = &themes[1];
+            theme = dwt_themes_get_default ();
+            g_printerr ("No such theme '%s', using default (%s)\n",
+                        opt_theme, theme->name);
         }
     }
+    g_object_set_data_full (G_OBJECT (vtterm), "dwt-theme",
+                            g_strdup (theme->name), g_free);
 
     GdkRGBA fgcolor, bgcolor;
     if (!(opt_fgcolor && gdk_rgba_parse (&fgcolor, opt_fgcolor)))
@@ -265,397 +702,4107 @@ configure_term_widget (VteTerminal  *vtterm,
                                           theme->colors,
                                           G_N_ELEMENTS (theme->colors));
 
-    g_autoptr(GError) error = NULL;
-    g_autoptr(VteRegex) regex =
-        vte_regex_new_for_match (uri_regexp, -1,
-                                 PCRE2_CASELESS | PCRE2_MULTILINE,
-                                 &error);
-    if (regex) {
-        if (!vte_regex_jit (regex, PCRE2_JIT_COMPLETE, &error))
-            g_warning ("Could not JIT-compile URI regex: %s", error->message);
-        int tag = vte_terminal_match_add_regex (vtterm, regex, PCRE2_NOTEMPTY);
-        vte_terminal_match_set_cursor_type (vtterm, tag, GDK_HAND2);
-    } else {
-        g_critical ("Could not compile URI regex: %s", error->message);
+    /* Links marked up by applications with OSC 8 escape sequences. */
+    vte_terminal_set_allow_hyperlink (vtterm, TRUE);
+    g_signal_connect (G_OBJECT (vtterm), "hyperlink-hover-uri-changed",
+                      G_CALLBACK (term_hyperlink_hovered), NULL);
+
+    /* URLs and paths detected in the text, may be disabled to save cycles. */
+    g_autoptr(DgSettingsSnapshot) snapshot = dwt_settings_get_snapshot ();
+    if (!dwt_settings_get_match_urls (snapshot))
+        return;
+
+    term_add_match_regex (vtterm, uri_regexp, GDK_HAND2);
+
+    TermPathState *path_state = g_new0 (TermPathState, 1);
+    path_state->tag = term_add_match_regex (vtterm, path_regexp, GDK_XTERM);
+    path_state->col = path_state->row = -1;
+    const gchar *opt_workdir = NULL;
+    if (options)
+        g_variant_dict_lookup (options, "workdir", "&s", &opt_workdir);
+    path_state->workdir = g_strdup (opt_workdir ? opt_workdir : g_get_home_dir ());
+    g_object_set_data_full (G_OBJECT (vtterm), "dwt-path-state",
+                            path_state, term_path_state_free);
+    if (path_state->tag >= 0) {
+        g_signal_connect (G_OBJECT (vtterm), "motion-notify-event",
+                          G_CALLBACK (term_path_pointer_moved), path_state);
+        g_signal_connect (G_OBJECT (vtterm), "leave-notify-event",
+                          G_CALLBACK (term_path_pointer_left), path_state);
     }
 }
 
 
+/*
+ * Chunked paste in progress in a terminal, see term_paste_start().
+ */
+typedef struct {
+    gchar       *text;
+    gsize        length;
+    gsize        offset;
+    guint        source_id;
+    gint64       start_time;
+    gboolean     feed_child;
+    gboolean     bracketed;
+} PasteState;
+
+
 static void
-term_beeped (VteTerminal *vtterm, gpointer userdata)
+paste_state_free (gpointer userdata)
 {
-    /*
-     * Only set the _URGENT hint when the window is not focused. If the
-     * window is focused, the user is likely to notice what is happening
-     * without the need to call for attention.
-     */
-    if (!gtk_window_has_toplevel_focus (GTK_WINDOW (userdata)))
-        gtk_window_set_urgency_hint (GTK_WINDOW (userdata), TRUE);
+    PasteState *paste = userdata;
+    if (paste->source_id)
+        g_source_remove (paste->source_id);
+    g_free (paste->text);
+    g_free (paste);
 }
 
 
-static void
-term_char_size_changed (VteTerminal *vtterm,
-                        guint        width,
-                        guint        height,
-                        gpointer     userdata)
+static inline PasteState*
+term_get_paste_state (VteTerminal *vtterm)
 {
-    GdkGeometry geometry;
-    geometry.height_inc = height;
-    geometry.width_inc = width;
+    return g_object_get_data (G_OBJECT (vtterm), "dwt-paste");
+}
 
-    GtkBorder padding;
-    gtk_style_context_get_padding (gtk_widget_get_style_context (GTK_WIDGET (vtterm)),
-                                   gtk_widget_get_state_flags (GTK_WIDGET (vtterm)),
-                                   &padding);
-    geometry.base_height = padding.top + padding.bottom;
-    geometry.base_width = padding.left + padding.right;
 
-    geometry.min_height = geometry.base_height + 3 * geometry.height_inc;
-    geometry.min_width = geometry.base_width + 10 * geometry.width_inc;
+/*
+ * Commands run in the terminals of a window, see term_shell_preexec().
+ */
+#define COMMAND_HISTORY_SIZE 64
 
-    gtk_window_set_geometry_hints (GTK_WINDOW (userdata),
-                                   GTK_WIDGET (vtterm),
-                                   &geometry,
-                                   GDK_HINT_MIN_SIZE |
-                                   GDK_HINT_BASE_SIZE |
-                                   GDK_HINT_RESIZE_INC);
-    gtk_widget_queue_resize (GTK_WIDGET (vtterm));
+typedef struct {
+    gint64  start_time;
+    gint64  duration;
+    guint64 exit_status;
+    gint64  output_bytes;  /* Negative if unknown. */
+    gchar  *cwd;
+} CommandRecord;
+
+
+static void
+command_record_clear (CommandRecord *record)
+{
+    g_free (record->cwd);
+    memset (record, 0x00, sizeof (CommandRecord));
 }
 
 
-static char*
-guess_shell (void)
+/*
+ * Each window hosts one or more terminals as pages of a GtkNotebook, and
+ * they all share the header bar, the window actions, and the context
+ * popover. Actions always apply to the terminal in the current page.
+ */
+typedef struct {
+    GtkWindow      *window;
+    GtkNotebook    *notebook;
+    GtkLabel       *title_label;
+    GtkLabel       *resources_label;
+    GtkRevealer    *bell_revealer;
+    GtkRevealer    *paste_revealer;
+    GtkProgressBar *paste_progress;
+    GtkWidget      *popover;
+    GtkSearchBar   *search_bar;
+    GtkEntry       *search_entry;
+    VteRegex       *search_regex;
+    GRegex         *search_row_regex;
+    VteTerminal    *search_term;
+    glong           search_row;
+    gint            search_index;
+    gulong          search_selection_id;
+    gboolean        search_selecting;
+    GdkFrameClock  *frame_clock;
+    gulong          after_paint_id;
+    guint           throttle_id;
+    guint           throttle_rate;
+    gboolean        updates_frozen;
+    gboolean        iconified;
+    gboolean        obscured;
+    gboolean        search_wrap_around;
+    gboolean        update_title;
+    gboolean        headless;
+    guint           bell_timeout_id;
+    gchar          *log_directory;
+    CommandRecord   commands[COMMAND_HISTORY_SIZE];
+    guint           commands_next;
+    guint           commands_length;
+    GPid            resources_pid;
+    DwtProcTree    *resources_tree;
+    guint64         resources_cpu_time;
+    gint64          resources_time;
+} WindowState;
+
+
+static WindowState*
+window_get_state (GtkWindow *window)
 {
-    char *shell = getenv ("SHELL");
-    if (!shell) {
-        struct passwd *pw = getpwuid (getuid ());
-        shell = (pw) ? pw->pw_shell : "/bin/sh";
-    }
-    /* Return a copy */
-    return g_strdup (shell);
+    return g_object_get_data (G_OBJECT (window), "dwt-window-state");
 }
 
 
+/* Offscreen windows never get focus, but behave as if they had. */
 static gboolean
-popover_idle_closed_tick (gpointer userdata)
+window_state_is_focused (WindowState *state)
 {
-    gtk_widget_grab_focus (GTK_WIDGET (userdata));
-    return FALSE; /* Do no re-arm (run once) */
+    return state->headless || gtk_window_has_toplevel_focus (state->window);
 }
 
+
 static void
-popover_closed (GtkPopover  *popover,
-                VteTerminal *vtterm)
+window_state_free (gpointer userdata)
 {
-    /* XXX: Grabbing the focus right away does not work, must do later. */
-    g_idle_add (popover_idle_closed_tick, vtterm);
+    WindowState *state = userdata;
+    if (state->bell_timeout_id)
+        g_source_remove (state->bell_timeout_id);
+    if (state->throttle_id)
+        g_source_remove (state->throttle_id);
+    if (state->search_term) {
+        g_signal_handler_disconnect (state->search_term, state->search_selection_id);
+        g_object_remove_weak_pointer (G_OBJECT (state->search_term),
+                                      (gpointer*) &state->search_term);
+    }
+    g_clear_pointer (&state->search_regex, vte_regex_unref);
+    g_clear_pointer (&state->search_row_regex, g_regex_unref);
+    g_clear_pointer (&state->resources_tree, dwt_proc_tree_free);
+    g_free (state->log_directory);
+    for (guint i = 0; i < COMMAND_HISTORY_SIZE; i++)
+        command_record_clear (&state->commands[i]);
+    g_free (state);
 }
 
-static GtkWidget*
-setup_popover (VteTerminal *vtterm)
+
+static VteTerminal*
+window_get_term_widget (GtkWindow *window)
 {
-    GtkWidget *popover = gtk_popover_new (GTK_WIDGET (vtterm));
-    g_signal_connect (G_OBJECT (popover), "closed",
-                      G_CALLBACK (popover_closed), vtterm);
+    WindowState *state = window_get_state (window);
+    if (!state)
+        return NULL;
 
-    g_autoptr(GtkBuilder) builder = gtk_builder_new_from_resource (DWT_GRESOURCE ("menus.xml"));
-    gtk_popover_bind_model (GTK_POPOVER (popover),
-                            G_MENU_MODEL (gtk_builder_get_object (builder, "popover-menu")),
-                            NULL);
-    return popover;
+    gint page = gtk_notebook_get_current_page (state->notebook);
+    return (page < 0) ? NULL
+        : VTE_TERMINAL (gtk_notebook_get_nth_page (state->notebook, page));
 }
 
 
 static void
-image_popover_closed (GtkWidget *popover,
-                      gpointer   userdata)
+window_set_title (WindowState *state,
+                  const gchar *title)
 {
-	gtk_widget_destroy (popover);
+    if (state->update_title && g_strcmp0 (title, gtk_window_get_title (state->window)))
+        gtk_window_set_title (state->window, title);
+    if (state->title_label && g_strcmp0 (title, gtk_label_get_label (state->title_label)))
+        gtk_label_set_label (state->title_label, title);
 }
 
 
-static void
-image_pixbuf_loaded (GInputStream *stream,
-                     GAsyncResult *result,
-                     GtkWidget    *popover)
+static gboolean
+bell_revealer_timeout (gpointer userdata)
 {
-	g_autoptr(GError) error = NULL;
-    g_autoptr(GdkPixbuf) pixbuf = gdk_pixbuf_new_from_stream_finish (result,
-                                                                     &error);
-	if (!pixbuf || error) {
-		g_printerr ("Could not decode image from pixbuf: %s", error->message);
-		return;
-	}
+    WindowState *state = userdata;
+    state->bell_timeout_id = 0;
 
-    gtk_container_add (GTK_CONTAINER (popover),
-                       gtk_image_new_from_pixbuf (pixbuf));
-	g_signal_connect (popover, "closed",
-                      G_CALLBACK (image_popover_closed), NULL);
-	gtk_widget_show_all (popover);
+    /*
+     * Keep the indicator while the window is not focused, it will be
+     * hidden a while after the window gets the focus back.
+     */
+    if (gtk_window_has_toplevel_focus (state->window))
+        gtk_revealer_set_reveal_child (state->bell_revealer, FALSE);
+    return FALSE;  /* Do not re-arm timer, run only once */
 }
 
 
 static void
-image_file_opened (GFile        *file,
-                   GAsyncResult *result,
-                   GtkWidget    *popover)
+window_notify_bell (WindowState *state)
 {
-	g_autoptr(GError) error = NULL;
-    g_autoptr(GFileInputStream) stream = g_file_read_finish (file, result, &error);
-	if (!stream || error) {
-		g_autofree char *uri = g_file_get_uri (file);
-		g_printerr ("Could not open URL '%s': %s", uri, error->message);
-		return;
-	}
+    /*
+     * Only set the _URGENT hint when the window is not focused. If the
+     * window is focused, the user is likely to notice what is happening
+     * without the need to call for attention.
+     */
+    if (!gtk_window_has_toplevel_focus (state->window))
+        gtk_window_set_urgency_hint (state->window, TRUE);
 
-	gdk_pixbuf_new_from_stream_at_scale_async (G_INPUT_STREAM (stream),
-                                               500, 500, TRUE,
-                                               NULL,
-                                               (GAsyncReadyCallback) image_pixbuf_loaded,
-                                               popover);
+    /* If already shown, do nothing */
+    if (!state->bell_revealer || gtk_revealer_get_reveal_child (state->bell_revealer))
+        return;
+
+    gtk_revealer_set_reveal_child (state->bell_revealer, TRUE);
+    if (!state->bell_timeout_id)
+        state->bell_timeout_id = g_timeout_add_seconds (3, bell_revealer_timeout, state);
 }
 
 
-static GtkWidget*
-make_popover_for_image_url (VteTerminal *vtterm,
-							const gchar *uri)
-{
-	g_assert (vtterm);
-	g_assert (uri);
+/*
+ * Programs may change the title or ring the bell many times per second
+ * using escape sequences, and each change implies a relayout of the header
+ * bar and a round-trip to the window manager. Changes are recorded as
+ * pending and applied at most once per frame, always using the last value.
+ * The frame clock does not tick for terminals in background tabs, nor for
+ * iconified windows, so changes are applied after NOTIFY_TIMEOUT_MS at the
+ * latest if no frame comes first. The number of changes, how many times
+ * they were applied, and how long that took are logged for each terminal.
+ */
+#define NOTIFY_TIMEOUT_MS 100
 
-	GtkWidget *popover = gtk_popover_new (GTK_WIDGET (vtterm));
-	g_autoptr(GVfs) gvfs = g_vfs_get_default ();
-	g_autoptr(GFile) file = g_vfs_get_file_for_uri (gvfs, uri);
-	g_file_read_async (file,
-                       G_PRIORITY_DEFAULT,
-                       NULL,
-                       (GAsyncReadyCallback) image_file_opened,
-                       popover);
-	return popover;
-}
+typedef struct {
+    GtkWindow *window;
+    GtkLabel  *tab_label;
+    gboolean   title_pending;
+    gboolean   bell_pending;
+    guint      tick_id;
+    guint      timeout_id;
+    gint64     pending_time;
+    guint      n_changes;
+    guint      n_applied;
+    gint64     apply_total;
+    gint64     delay_total;
+    gint64     delay_max;
+} TermNotifyState;
 
 
-static gboolean
-term_mouse_button_released (VteTerminal    *vtterm,
-                            GdkEventButton *event,
-                            gpointer        userdata)
+static void
+term_notify_state_free (gpointer userdata)
 {
-    g_clear_pointer (&last_match_text, g_free);
-
-    int match_tag;
-    g_autofree char *match =
-        vte_terminal_match_check_event (vtterm, (GdkEvent*) event, &match_tag);
+    TermNotifyState *state = userdata;
+    if (state->timeout_id)
+        g_source_remove (state->timeout_id);
+    if (state->n_applied)
+        g_debug ("Title and bell: %u changes applied %u times, %.3f ms in total,"
+                 " delay average %.3f ms, max %.3f ms",
+                 state->n_changes, state->n_applied, state->apply_total / 1000.0,
+                 state->delay_total / 1000.0 / state->n_applied,
+                 state->delay_max / 1000.0);
+    g_free (state);
+}
 
-    const long col = event->x / vte_terminal_get_char_width (vtterm);
-    const long row = event->y / vte_terminal_get_char_height (vtterm);
 
-    GtkWindow *window = GTK_WINDOW (gtk_widget_get_ancestor (GTK_WIDGET (vtterm),
-                                                             GTK_TYPE_WINDOW));
+static TermNotifyState*
+term_get_notify_state (VteTerminal *vtterm)
+{
+    return g_object_get_data (G_OBJECT (vtterm), "dwt-notify-state");
+}
 
-    if (match && event->button == 1) {
-		if (CHECK_FLAGS (event->state, GDK_CONTROL_MASK)) {
-			g_autoptr(GError) error = NULL;
-			if (!gtk_show_uri_on_window (window, match, event->time, &error))
-				g_printerr ("Could not open URL: %s\n", error->message);
-			return FALSE;
-		} else if (g_regex_match (image_regex, match, 0, NULL)) {
-			/* Show picture in a popover */
-			GdkRectangle rect;
-			rect.height = vte_terminal_get_char_height (vtterm);
-			rect.width = vte_terminal_get_char_width (vtterm);
-			rect.y = rect.height * row;
-			rect.x = rect.width * col;
 
-			GtkWidget* popover = make_popover_for_image_url (vtterm, match);
-			gtk_popover_set_pointing_to (GTK_POPOVER (popover), &rect);
-			return FALSE;
-		}
-    }
+static void
+term_notify_title (VteTerminal     *vtterm,
+                   TermNotifyState *state)
+{
+    const gchar *title = vte_terminal_get_window_title (vtterm);
+    if (!title)
+        return;
 
+    if (g_strcmp0 (title, gtk_label_get_label (state->tab_label)))
+        gtk_label_set_label (state->tab_label, title);
 
-    if (event->button == 3 && userdata != NULL) {
-        GdkRectangle rect;
-        rect.height = vte_terminal_get_char_height (vtterm);
-        rect.width = vte_terminal_get_char_width (vtterm);
-        rect.y = rect.height * row;
-        rect.x = rect.width * col;
-        gtk_popover_set_pointing_to (GTK_POPOVER (userdata), &rect);
+    /* Terminals in background tabs do not change the window title. */
+    if (vtterm == window_get_term_widget (state->window))
+        window_set_title (window_get_state (state->window), title);
+}
 
-        GActionMap *actions = G_ACTION_MAP (window);
-        g_simple_action_set_enabled (G_SIMPLE_ACTION (g_action_map_lookup_action (actions,
-                                                                                  "copy")),
-                                    vte_terminal_get_has_selection (vtterm));
-        g_simple_action_set_enabled (G_SIMPLE_ACTION (g_action_map_lookup_action (actions,
-                                                                                  "open-url")),
-                                     match != NULL);
-        g_simple_action_set_enabled (G_SIMPLE_ACTION (g_action_map_lookup_action (actions,
-                                                                                  "copy-url")),
-                                     match != NULL);
-        if (match) {
-            last_match_text = match;
-            match = NULL;
-        }
 
-        gtk_widget_show_all (GTK_WIDGET (userdata));
+static void
+term_notify_apply (VteTerminal     *vtterm,
+                   TermNotifyState *state)
+{
+    const gint64 start = g_get_monotonic_time ();
 
-        return TRUE;
+    if (state->title_pending) {
+        term_notify_title (vtterm, state);
+        state->title_pending = FALSE;
+    }
+    if (state->bell_pending) {
+        window_notify_bell (window_get_state (state->window));
+        state->bell_pending = FALSE;
     }
 
-    return FALSE;
+    const gint64 delay = start - state->pending_time;
+    state->apply_total += g_get_monotonic_time () - start;
+    state->delay_total += delay;
+    state->delay_max = MAX (state->delay_max, delay);
+    state->n_applied++;
+
+    if (state->tick_id) {
+        gtk_widget_remove_tick_callback (GTK_WIDGET (vtterm), state->tick_id);
+        state->tick_id = 0;
+    }
+    if (state->timeout_id) {
+        g_source_remove (state->timeout_id);
+        state->timeout_id = 0;
+    }
 }
 
+
 static gboolean
-beeped_revealer_timeout (gpointer userdata)
+term_notify_tick (GtkWidget     *widget,
+                  GdkFrameClock *frame_clock,
+                  gpointer       userdata)
 {
-    GtkWindow *window =
-            GTK_WINDOW (gtk_widget_get_ancestor (GTK_WIDGET (userdata),
-                                                 GTK_TYPE_WINDOW));
-    if (!gtk_window_has_toplevel_focus (window))
-        return TRUE;
+    TermNotifyState *state = userdata;
+    state->tick_id = 0;
+    term_notify_apply (VTE_TERMINAL (widget), state);
+    return G_SOURCE_REMOVE;
+}
 
-    gtk_revealer_set_reveal_child (GTK_REVEALER (userdata), FALSE);
-    return FALSE;  /* Do not re-arm timer, run only once */
+
+static gboolean
+term_notify_timeout (gpointer userdata)
+{
+    VteTerminal *vtterm = userdata;
+    TermNotifyState *state = term_get_notify_state (vtterm);
+    state->timeout_id = 0;
+    term_notify_apply (vtterm, state);
+    return G_SOURCE_REMOVE;
 }
 
+
 static void
-header_bar_term_beeped (VteTerminal *vtterm,
-                        GtkRevealer *revealer)
+term_notify_schedule (VteTerminal     *vtterm,
+                      TermNotifyState *state)
 {
-    /* If already shown, do nothing */
-    if (gtk_revealer_get_reveal_child (revealer))
+    state->n_changes++;
+    if (state->timeout_id)
         return;
 
-    gtk_revealer_set_reveal_child (revealer, TRUE);
-    g_timeout_add_seconds (3, beeped_revealer_timeout, revealer);
+    state->pending_time = g_get_monotonic_time ();
+    state->timeout_id = g_timeout_add (NOTIFY_TIMEOUT_MS, term_notify_timeout, vtterm);
+    if (gtk_widget_get_mapped (GTK_WIDGET (vtterm)))
+        state->tick_id = gtk_widget_add_tick_callback (GTK_WIDGET (vtterm),
+                                                       term_notify_tick,
+                                                       state,
+                                                       NULL);
 }
 
+
 static void
-setup_header_bar (GtkWidget   *window,
-                  VteTerminal *vtterm,
-                  gboolean     show_maximized_title)
+term_beeped (VteTerminal     *vtterm,
+             TermNotifyState *state)
 {
-    /*
-     * Using the default GtkHeaderBar title/subtitle widget makes the bar
-     * too thick to look nice for a terminal, so set a custom widget.
-     */
-    const gchar *title = gtk_window_get_title (GTK_WINDOW (window));
-    GtkWidget *label = gtk_label_new (title ? title : "dwt");
-    g_object_bind_property (G_OBJECT (vtterm), "window-title",
-                            G_OBJECT (label), "label",
-                            G_BINDING_DEFAULT);
+    state->bell_pending = TRUE;
+    term_notify_schedule (vtterm, state);
+}
 
-    GtkWidget *header = gtk_header_bar_new ();
-    gtk_header_bar_set_show_close_button (GTK_HEADER_BAR (header), TRUE);
-    gtk_header_bar_set_has_subtitle (GTK_HEADER_BAR (header), FALSE);
-    gtk_header_bar_set_custom_title (GTK_HEADER_BAR (header), label);
 
-    GtkWidget *button = gtk_button_new_from_icon_name ("tab-new-symbolic",
-                                                       GTK_ICON_SIZE_BUTTON);
-    gtk_button_set_relief (GTK_BUTTON (button), GTK_RELIEF_NONE);
-    gtk_actionable_set_action_name (GTK_ACTIONABLE (button), "app.new-terminal");
-    gtk_header_bar_pack_start (GTK_HEADER_BAR (header), button);
+static void
+term_title_changed (VteTerminal     *vtterm,
+                    GParamSpec      *pspec,
+                    TermNotifyState *state)
+{
+    state->title_pending = TRUE;
+    term_notify_schedule (vtterm, state);
+}
 
-    GtkWidget *revealer = gtk_revealer_new ();
-    gtk_container_add (GTK_CONTAINER (revealer),
-                       gtk_image_new_from_icon_name ("software-update-urgent-symbolic",
-                                                     GTK_ICON_SIZE_BUTTON));
-    gtk_revealer_set_transition_duration (GTK_REVEALER (revealer), 500);
-    gtk_revealer_set_transition_type (GTK_REVEALER (revealer),
-                                      GTK_REVEALER_TRANSITION_TYPE_CROSSFADE);
-    gtk_header_bar_pack_end (GTK_HEADER_BAR (header), revealer);
 
-    g_signal_connect (G_OBJECT (vtterm), "bell",
-                      G_CALLBACK (header_bar_term_beeped), revealer);
-    g_object_bind_property (G_OBJECT (window), "urgency-hint",
-                            G_OBJECT (revealer), "reveal-child",
-                            G_BINDING_DEFAULT);
+/*
+ * Shells which emit the OSC 133 marks around commands (for example using
+ * the vte.sh script) let VTE report when each command starts and ends.
+ * For each command the start time, duration, exit status, bytes of output
+ * and working directory (from OSC 7) are kept in a ring buffer per window,
+ * which is shown by the win.command-history action. Output is counted as
+ * it comes from the child, which needs the terminal output to be relayed
+ * (see term_spawn_relayed()); otherwise it is not known. The command line
+ * itself is not recorded: the marks do not carry it, and the text on the
+ * screen includes the prompt. Commands which run for longer than the
+ * "command-notify-time" setting call for attention when they end, like
+ * the terminal bell does. VTE reports the marks since version 0.78.
+ */
+typedef struct {
+    GtkWindow     *window;
+    CommandRecord  record;
+    gint64         start_monotonic;
+    gint64         start_bytes;
+    gboolean       running;
+} TermCommandState;
 
-    gtk_window_set_titlebar (GTK_WINDOW (window), header);
 
-    /* Hide the header bar when the window is maximized. */
-    if (!show_maximized_title) {
-        g_object_bind_property (G_OBJECT (window), "is-maximized",
-                                G_OBJECT (header), "visible",
-                                G_BINDING_INVERT_BOOLEAN);
-    }
+static void
+term_command_state_free (gpointer userdata)
+{
+    TermCommandState *state = userdata;
+    command_record_clear (&state->record);
+    g_free (state);
 }
 
 
 static void
-window_has_toplevel_focus_notified (GObject    *object,
-                                    GParamSpec *pspec,
-                                    gpointer    userdata)
+window_add_command (WindowState   *state,
+                    CommandRecord *record)
 {
-    if (gtk_window_has_toplevel_focus (GTK_WINDOW (object))) {
-        vte_terminal_set_color_cursor (VTE_TERMINAL (userdata),
-                                       &cursor_active);
-        /* Clear the _URGENT hint when the window gets activated. */
-        gtk_window_set_urgency_hint (GTK_WINDOW (object), FALSE);
-    } else {
-        vte_terminal_set_color_cursor (VTE_TERMINAL (userdata),
-                                       &cursor_inactive);
-    }
+    CommandRecord *slot = &state->commands[state->commands_next];
+    command_record_clear (slot);
+    *slot = *record;
+    memset (record, 0x00, sizeof (CommandRecord));
+
+    state->commands_next = (state->commands_next + 1) % COMMAND_HISTORY_SIZE;
+    if (state->commands_length < COMMAND_HISTORY_SIZE)
+        state->commands_length++;
 }
 
 
+#if VTE_CHECK_VERSION (0, 78, 0)
 static void
-term_child_exited (VteTerminal *vtterm,
-                   gint         status,
-                   gpointer     userdata)
+term_shell_preexec (VteTerminal      *vtterm,
+                    const char       *name,
+                    TermCommandState *state)
 {
-    /*
-     * Destroy the window when the terminal child is exited. Note that this
-     * will fire the "delete-event" signal, and its handler already takes
-     * care of deregistering the window in the GtkApplication.
-     */
-    gtk_window_close (GTK_WINDOW (userdata));
+    command_record_clear (&state->record);
+    state->record.start_time = g_get_real_time ();
+    state->start_monotonic = g_get_monotonic_time ();
+    state->start_bytes = term_get_output_bytes (vtterm);
+    state->running = TRUE;
+
+    const char *cwd_uri = vte_terminal_get_current_directory_uri (vtterm);
+    if (cwd_uri)
+        state->record.cwd = g_filename_from_uri (cwd_uri, NULL, NULL);
 }
 
 
-static VteTerminal*
-window_get_term_widget (GtkWindow *window)
+static void
+term_shell_postexec (VteTerminal      *vtterm,
+                     const char       *name,
+                     TermCommandState *state)
 {
-    GtkWidget *widget = gtk_bin_get_child (GTK_BIN (window));
-    if (GTK_IS_BIN (widget))
-        widget = gtk_bin_get_child (GTK_BIN (widget));
-    return VTE_TERMINAL (widget);
+    if (!state->running)
+        return;
+    state->running = FALSE;
+
+    vte_terminal_get_termprop_uint (vtterm, VTE_TERMPROP_SHELL_POSTEXEC,
+                                    &state->record.exit_status);
+    state->record.duration = g_get_monotonic_time () - state->start_monotonic;
+    state->record.output_bytes = (state->start_bytes >= 0)
+        ? term_get_output_bytes (vtterm) - state->start_bytes : -1;
+
+    const gint64 duration = state->record.duration;
+    WindowState *window_state = window_get_state (state->window);
+    window_add_command (window_state, &state->record);
+
+    g_autoptr(DgSettingsSnapshot) settings = dwt_settings_get_snapshot ();
+    const guint notify_time = dwt_settings_get_command_notify_time (settings);
+    if (notify_time && duration >= notify_time * G_TIME_SPAN_SECOND &&
+        (!gtk_window_has_toplevel_focus (state->window) ||
+         vtterm != window_get_term_widget (state->window)))
+        window_notify_bell (window_state);
 }
+#endif /* VTE_CHECK_VERSION (0, 78, 0) */
 
 
-static void
-font_size_action_ativated (GSimpleAction *action,
-                           GVariant      *parameter,
-                           gpointer       userdata)
+static gchar*
+window_format_commands (WindowState *state)
 {
-    VteTerminal *vtterm = window_get_term_widget (GTK_WINDOW (userdata));
-    const gint modifier = g_variant_get_int32 (parameter);
+    GString *text = g_string_new ("Started    Duration  Status     Output  Directory\n");
+
+    /* Oldest first. */
+    const guint first = (state->commands_next + COMMAND_HISTORY_SIZE -
+                         state->commands_length) % COMMAND_HISTORY_SIZE;
+    for (guint i = 0; i < state->commands_length; i++) {
+        const CommandRecord *record =
+            &state->commands[(first + i) % COMMAND_HISTORY_SIZE];
+
+        g_autoptr(GDateTime) start =
+            g_date_time_new_from_unix_local (record->start_time / G_USEC_PER_SEC);
+        g_autofree gchar *start_text = g_date_time_format (start, "%H:%M:%S");
+        g_autofree gchar *output_text = (record->output_bytes >= 0)
+            ? g_format_size_full (record->output_bytes, G_FORMAT_SIZE_IEC_UNITS)
+            : g_strdup ("-");
+        g_string_append_printf (text, "%s  %8.1fs  %6" G_GUINT64_FORMAT "  %9s  %s\n",
+                                start_text,
+                                record->duration / (gdouble) G_TIME_SPAN_SECOND,
+                                record->exit_status,
+                                output_text,
+                                record->cwd ? record->cwd : "-");
+    }
 
-    const PangoFontDescription *fontd = vte_terminal_get_font (vtterm);
-    gint old_size = pango_font_description_get_size (fontd);
-    if (default_font_size == 0)
-      default_font_size = old_size;
-    PangoFontDescription *new_fontd;
-    gint new_size;
+    if (!state->commands_length)
+        g_string_append (text, "\nNo commands recorded. Commands are recorded when the\n"
+                         "shell reports them using OSC 133 escape sequences.\n");
 
-    switch (modifier) {
-      case 0:
-        old_size = default_font_size;
-        /* fall-through */
-      case 1:
-      case -1:
-        new_size = old_size + modifier * PANGO_SCALE;
-        new_fontd = pango_font_description_copy_static (fontd);
-        pango_font_description_set_size (new_fontd, new_size);
-        vte_terminal_set_font (vtterm, new_fontd);
-        break;
+    return g_string_free (text, FALSE);
+}
 
-      default:
-        g_printerr ("%s: invalid modifier '%i'", __func__, modifier);
-        return;
+
+/*
+ * Latency probe: when enabled for a window, the time at which each key
+ * press reaches a terminal is recorded. Once the terminal contents change
+ * (which is assumed to be the echo from the child process), the key is
+ * waiting for a frame, and its latency is taken when the frame clock has
+ * painted the next frame, using the presentation time predicted by the
+ * frame clock. Percentiles and a histogram are printed when the window
+ * is closed.
+ *
+ * In scripted mode, key presses are synthesized at a fixed interval and
+ * the window is closed after the given number of them, which allows
+ * comparing builds without human input, e.g.:
+ *
+ *   dwt --latency-probe-keys=500 -e cat
+ */
+#define LATENCY_MAX_PENDING     64
+#define LATENCY_MAX_SAMPLES     8192
+#define LATENCY_HISTOGRAM_MS    32
+#define LATENCY_SCRIPT_INTERVAL 50    /* milliseconds */
+#define LATENCY_SCRIPT_DELAY    20    /* intervals */
+
+typedef struct {
+    GtkWindow     *window;
+    GdkFrameClock *frame_clock;
+    gulong         after_paint_id;
+    gint64         pending[LATENCY_MAX_PENDING];
+    guint          n_pending;
+    guint          n_echoed;
+    gint64         samples[LATENCY_MAX_SAMPLES];
+    guint          n_samples;
+    guint          script_keys;
+    guint          script_delay;
+    guint          script_source_id;
+} LatencyProbe;
+
+
+static void
+latency_probe_free (gpointer userdata)
+{
+    LatencyProbe *probe = userdata;
+    if (probe->script_source_id)
+        g_source_remove (probe->script_source_id);
+    if (probe->frame_clock) {
+        g_signal_handler_disconnect (probe->frame_clock, probe->after_paint_id);
+        g_object_unref (probe->frame_clock);
     }
+    g_free (probe);
+}
 
-    pango_font_description_free (new_fontd);
+
+static LatencyProbe*
+window_get_latency_probe (GtkWindow *window)
+{
+    return g_object_get_data (G_OBJECT (window), "dwt-latency-probe");
+}
+
+
+static void
+latency_probe_after_paint (GdkFrameClock *frame_clock,
+                           LatencyProbe  *probe)
+{
+    if (!probe->n_echoed)
+        return;
+
+    GdkFrameTimings *timings = gdk_frame_clock_get_current_timings (frame_clock);
+    gint64 presentation_time = timings
+        ? gdk_frame_timings_get_predicted_presentation_time (timings) : 0;
+    if (!presentation_time)
+        presentation_time = g_get_monotonic_time ();
+
+    for (guint i = 0; i < probe->n_echoed; i++) {
+        if (probe->n_samples < LATENCY_MAX_SAMPLES)
+            probe->samples[probe->n_samples++] = presentation_time - probe->pending[i];
+    }
+
+    /* Keys which were not echoed yet remain pending. */
+    probe->n_pending -= probe->n_echoed;
+    memmove (probe->pending, probe->pending + probe->n_echoed,
+             probe->n_pending * sizeof (gint64));
+    probe->n_echoed = 0;
+}
+
+
+static gboolean
+term_latency_key_pressed (GtkWidget    *widget,
+                          GdkEventKey  *event,
+                          LatencyProbe *probe)
+{
+    if (!probe->frame_clock) {
+        probe->frame_clock = gtk_widget_get_frame_clock (GTK_WIDGET (probe->window));
+        if (probe->frame_clock) {
+            g_object_ref (probe->frame_clock);
+            probe->after_paint_id =
+                g_signal_connect (G_OBJECT (probe->frame_clock), "after-paint",
+                                  G_CALLBACK (latency_probe_after_paint), probe);
+        }
+    }
+
+    if (probe->n_pending < LATENCY_MAX_PENDING)
+        probe->pending[probe->n_pending++] = g_get_monotonic_time ();
+    return FALSE;
+}
+
+
+static void
+term_latency_contents_changed (VteTerminal  *vtterm,
+                               LatencyProbe *probe)
+{
+    probe->n_echoed = probe->n_pending;
+}
+
+
+static gint
+compare_gint64 (gconstpointer a,
+                gconstpointer b)
+{
+    const gint64 va = *((const gint64*) a);
+    const gint64 vb = *((const gint64*) b);
+    return (va > vb) - (va < vb);
+}
+
+
+static void
+latency_probe_report (LatencyProbe *probe)
+{
+    if (!probe->n_samples) {
+        g_print ("Latency probe: no samples\n");
+        return;
+    }
+
+    gint64 *samples = g_new (gint64, probe->n_samples);
+    memcpy (samples, probe->samples, probe->n_samples * sizeof (gint64));
+    qsort (samples, probe->n_samples, sizeof (gint64), compare_gint64);
+
+    guint histogram[LATENCY_HISTOGRAM_MS + 1] = { 0, };
+    guint max_count = 0;
+    for (guint i = 0; i < probe->n_samples; i++) {
+        const guint bucket = MIN (MAX (samples[i], 0) / 1000, LATENCY_HISTOGRAM_MS);
+        max_count = MAX (max_count, ++histogram[bucket]);
+    }
+
+#define PERCENTILE(p) (samples[(probe->n_samples - 1) * (p) / 100] / 1000.0)
+    g_print ("Key press to frame latency, %u samples:\n"
+             "  p50 %7.2f ms\n"
+             "  p95 %7.2f ms\n"
+             "  p99 %7.2f ms\n"
+             "  max %7.2f ms\n",
+             probe->n_samples,
+             PERCENTILE (50), PERCENTILE (95), PERCENTILE (99), PERCENTILE (100));
+#undef PERCENTILE
+
+    for (guint i = 0; i <= LATENCY_HISTOGRAM_MS; i++) {
+        if (!histogram[i])
+            continue;
+        g_autofree gchar *bar = g_strnfill (histogram[i] * 40 / max_count, '#');
+        if (i < LATENCY_HISTOGRAM_MS)
+            g_print ("  %2u-%2u ms %6u %s\n", i, i + 1, histogram[i], bar);
+        else
+            g_print ("  >=%2u ms %6u %s\n", i, histogram[i], bar);
+    }
+    g_free (samples);
+}
+
+
+static void
+latency_probe_window_destroyed (GtkWidget    *widget,
+                                LatencyProbe *probe)
+{
+    if (probe->script_source_id) {
+        g_source_remove (probe->script_source_id);
+        probe->script_source_id = 0;
+    }
+    latency_probe_report (probe);
+}
+
+
+static void
+synthesize_key_press (GtkWidget *widget,
+                      guint      keyval)
+{
+    GdkWindow *gdk_window = gtk_widget_get_window (widget);
+    if (!gdk_window)
+        return;
+
+    GdkDisplay *display = gdk_window_get_display (gdk_window);
+    GdkEvent *event = gdk_event_new (GDK_KEY_PRESS);
+    event->key.window = g_object_ref (gdk_window);
+    event->key.send_event = TRUE;
+    event->key.time = GDK_CURRENT_TIME;
+    event->key.keyval = keyval;
+    event->key.string = g_strdup ("");
+    gdk_event_set_device (event,
+                          gdk_seat_get_keyboard (gdk_display_get_default_seat (display)));
+
+    GdkKeymapKey *keys = NULL;
+    gint n_keys = 0;
+    if (gdk_keymap_get_entries_for_keyval (gdk_keymap_get_for_display (display),
+                                           keyval, &keys, &n_keys)) {
+        event->key.hardware_keycode = keys[0].keycode;
+        event->key.group = keys[0].group;
+        g_free (keys);
+    }
+
+    gtk_main_do_event (event);
+    event->type = GDK_KEY_RELEASE;
+    gtk_main_do_event (event);
+    gdk_event_free (event);
+}
+
+
+static gboolean
+latency_probe_script_tick (gpointer userdata)
+{
+    LatencyProbe *probe = userdata;
+
+    /* Give the child some time to start. */
+    if (probe->script_delay) {
+        probe->script_delay--;
+        return G_SOURCE_CONTINUE;
+    }
+
+    if (!probe->script_keys) {
+        probe->script_source_id = 0;
+        gtk_window_close (probe->window);
+        return G_SOURCE_REMOVE;
+    }
+
+    VteTerminal *vtterm = window_get_term_widget (probe->window);
+    if (vtterm) {
+        /* Start a new line now and then, to keep lines short. */
+        synthesize_key_press (GTK_WIDGET (vtterm),
+                              (probe->script_keys % 64) ? GDK_KEY_a : GDK_KEY_Return);
+    }
+    probe->script_keys--;
+    return G_SOURCE_CONTINUE;
+}
+
+
+static void
+window_start_latency_probe (GtkWindow *window,
+                            guint      script_keys)
+{
+    LatencyProbe *probe = g_new0 (LatencyProbe, 1);
+    probe->window = window;
+    g_object_set_data_full (G_OBJECT (window), "dwt-latency-probe",
+                            probe, latency_probe_free);
+    g_signal_connect (G_OBJECT (window), "destroy",
+                      G_CALLBACK (latency_probe_window_destroyed), probe);
+
+    if (script_keys) {
+        probe->script_keys = script_keys;
+        probe->script_delay = LATENCY_SCRIPT_DELAY;
+        probe->script_source_id = g_timeout_add (LATENCY_SCRIPT_INTERVAL,
+                                                 latency_probe_script_tick,
+                                                 probe);
+    }
+}
+
+
+static void
+term_update_geometry_hints (VteTerminal *vtterm,
+                            GtkWindow   *window)
+{
+    GdkGeometry geometry;
+    geometry.height_inc = vte_terminal_get_char_height (vtterm);
+    geometry.width_inc = vte_terminal_get_char_width (vtterm);
+
+    GtkBorder padding;
+    gtk_style_context_get_padding (gtk_widget_get_style_context (GTK_WIDGET (vtterm)),
+                                   gtk_widget_get_state_flags (GTK_WIDGET (vtterm)),
+                                   &padding);
+    geometry.base_height = padding.top + padding.bottom;
+    geometry.base_width = padding.left + padding.right;
+
+    geometry.min_height = geometry.base_height + 3 * geometry.height_inc;
+    geometry.min_width = geometry.base_width + 10 * geometry.width_inc;
+
+    gtk_window_set_geometry_hints (window,
+                                   GTK_WIDGET (vtterm),
+                                   &geometry,
+                                   GDK_HINT_MIN_SIZE |
+                                   GDK_HINT_BASE_SIZE |
+                                   GDK_HINT_RESIZE_INC);
+    gtk_widget_queue_resize (GTK_WIDGET (vtterm));
+}
+
+
+/*
+ * Time without changes in the terminal size after which a resize (or a
+ * burst of font size changes) is considered to be finished, in µs.
+ */
+#define RESIZE_SETTLE_TIME (150 * G_TIME_SPAN_MILLISECOND)
+
+/*
+ * Size changes arrive in bursts when zooming the font repeatedly or when
+ * dragging a window border, and with rewrapping enabled each of them
+ * rewraps the whole scrollback. Geometry hint updates are deferred to the
+ * frame clock so there is at most one per frame, and rewrapping is
+ * suspended while a burst is in progress and done once it settles.
+ */
+typedef struct {
+    GtkWindow *window;
+    guint      tick_id;
+    gboolean   hints_pending;
+    gboolean   rewrap_suspended;
+    gint64     last_resize;
+    glong      columns;
+    glong      rows;
+    glong      wrap_columns;  /* Width of the last rewrap. */
+} TermResizeState;
+
+
+static void
+term_resume_rewrap (VteTerminal     *vtterm,
+                    TermResizeState *state)
+{
+    state->rewrap_suspended = FALSE;
+
+    /* Nothing to do if the burst ended at the width it started with. */
+    const glong columns = vte_terminal_get_column_count (vtterm);
+    if (columns == state->wrap_columns) {
+        vte_terminal_set_rewrap_on_resize (vtterm, TRUE);
+        return;
+    }
+
+    /*
+     * Rewrapping only happens when the column count changes, so the final
+     * width is reached again from the width before the burst, with
+     * rewrapping disabled for the first step: the scrollback is rewrapped
+     * once. Both steps happen before the child gets to run, so it sees
+     * one SIGWINCH with the final size. Line continuations are kept in
+     * the ring, so lines are joined again no matter which width they were
+     * wrapped at while rewrapping was suspended.
+     */
+    const glong rows = vte_terminal_get_row_count (vtterm);
+    vte_terminal_set_size (vtterm, state->wrap_columns, rows);
+    vte_terminal_set_rewrap_on_resize (vtterm, TRUE);
+    vte_terminal_set_size (vtterm, columns, rows);
+    state->wrap_columns = columns;
+}
+
+
+static gboolean
+term_resize_tick (GtkWidget     *widget,
+                  GdkFrameClock *frame_clock,
+                  gpointer       userdata)
+{
+    TermResizeState *state = userdata;
+    VteTerminal *vtterm = VTE_TERMINAL (widget);
+
+    if (state->hints_pending) {
+        /* Hints for other tabs are updated when switching to them. */
+        if (vtterm == window_get_term_widget (state->window))
+            term_update_geometry_hints (vtterm, state->window);
+        state->hints_pending = FALSE;
+    }
+
+    if (state->rewrap_suspended) {
+        gint64 now = gdk_frame_clock_get_frame_time (frame_clock);
+        if (now - state->last_resize < RESIZE_SETTLE_TIME)
+            return G_SOURCE_CONTINUE;
+        term_resume_rewrap (vtterm, state);
+    }
+
+    state->tick_id = 0;
+    return G_SOURCE_REMOVE;
+}
+
+
+static void
+term_resize_schedule (VteTerminal     *vtterm,
+                      TermResizeState *state)
+{
+    if (!state->tick_id)
+        state->tick_id = gtk_widget_add_tick_callback (GTK_WIDGET (vtterm),
+                                                       term_resize_tick,
+                                                       state,
+                                                       NULL);
+}
+
+
+static void
+term_char_size_changed (VteTerminal     *vtterm,
+                        guint            width,
+                        guint            height,
+                        TermResizeState *state)
+{
+    state->hints_pending = TRUE;
+    term_resize_schedule (vtterm, state);
+}
+
+
+static void
+term_size_allocated (VteTerminal     *vtterm,
+                     GdkRectangle    *allocation,
+                     TermResizeState *state)
+{
+    glong columns = vte_terminal_get_column_count (vtterm);
+    glong rows = vte_terminal_get_row_count (vtterm);
+    if (columns == state->columns && rows == state->rows)
+        return;
+
+    state->columns = columns;
+    state->rows = rows;
+
+    /*
+     * The terminal has already been resized (and rewrapped) by the time
+     * this handler runs, so a single resize is handled as usual. Further
+     * changes arriving shortly after make it a burst.
+     */
+    gint64 now = g_get_monotonic_time ();
+    if (!state->rewrap_suspended) {
+        state->wrap_columns = columns;
+        if (now - state->last_resize < RESIZE_SETTLE_TIME) {
+            vte_terminal_set_rewrap_on_resize (vtterm, FALSE);
+            state->rewrap_suspended = TRUE;
+            term_resize_schedule (vtterm, state);
+        }
+    }
+    state->last_resize = now;
+}
+
+
+/*
+ * Session logs. The raw output of the child process is logged, escape
+ * sequences included, so terminals with a log directory always have their
+ * output relayed (see term_spawn_relayed()). Writing to disk is done by
+ * a DwtLog, from a writer thread shared by all the logs.
+ */
+static DwtLog*
+term_open_log (const gchar *directory)
+{
+    static guint log_count = 0;
+    g_autoptr(DgSettingsSnapshot) settings = dwt_settings_get_snapshot ();
+    const guint max_size = dwt_settings_get_log_max_size (settings);
+    const gboolean compress = dwt_settings_get_log_compress (settings);
+
+    if (g_mkdir_with_parents (directory, 0700) == -1) {
+        g_warning ("Cannot create directory '%s': %s",
+                   directory, g_strerror (errno));
+        return NULL;
+    }
+
+    g_autoptr(GDateTime) now = g_date_time_new_now_local ();
+    g_autofree gchar *timestamp = g_date_time_format (now, "%Y%m%d-%H%M%S");
+    g_autofree gchar *name = g_strdup_printf ("dwt-%s-%d-%u.log",
+                                              timestamp, getpid (), log_count++);
+    g_autofree gchar *path = g_build_filename (directory, name, NULL);
+
+    g_autoptr(GError) error = NULL;
+    DwtLog *log = dwt_log_new (path, (guint64) max_size * 1024 * 1024,
+                               compress, &error);
+    if (!log)
+        g_warning ("Cannot open log: %s", error->message);
+    return log;
+}
+
+
+/*
+ * Terminals which have been in the background without producing output
+ * for a while may be hibernated: their scrollback is saved compressed to
+ * a file, and dropped from memory. The child process keeps running, and
+ * the scrollback is fed back into the terminal when it is brought to the
+ * foreground again. Only the text is saved, so colors and attributes of
+ * the restored contents are lost.
+ */
+#define HIBERNATE_CHECK_INTERVAL 10  /* seconds */
+
+typedef struct {
+    gint64  last_activity;
+    gchar  *path;
+    guint   scrollback_lines;
+} TermHibernateState;
+
+
+static guint hibernate_timer_id = 0;
+
+
+static void
+term_hibernate_state_free (gpointer userdata)
+{
+    TermHibernateState *state = userdata;
+    if (state->path) {
+        g_unlink (state->path);
+        g_free (state->path);
+    }
+    g_free (state);
+}
+
+
+static TermHibernateState*
+term_get_hibernate_state (VteTerminal *vtterm)
+{
+    return g_object_get_data (G_OBJECT (vtterm), "dwt-hibernate-state");
+}
+
+
+static void
+term_contents_changed (VteTerminal        *vtterm,
+                       TermHibernateState *state)
+{
+    state->last_activity = g_get_monotonic_time ();
+}
+
+
+static glong
+term_get_screen_top (VteTerminal *vtterm)
+{
+    GtkAdjustment *vadjustment =
+        gtk_scrollable_get_vadjustment (GTK_SCROLLABLE (vtterm));
+    return gtk_adjustment_get_upper (vadjustment) - vte_terminal_get_row_count (vtterm);
+}
+
+
+static gboolean
+term_has_history (VteTerminal *vtterm)
+{
+    GtkAdjustment *vadjustment =
+        gtk_scrollable_get_vadjustment (GTK_SCROLLABLE (vtterm));
+    return term_get_screen_top (vtterm) > gtk_adjustment_get_lower (vadjustment);
+}
+
+
+/*
+ * Text of the scrollback, and optionally that of the screen. Text from
+ * VTE uses bare newlines between lines.
+ */
+static gchar*
+term_get_history (VteTerminal *vtterm,
+                  gboolean     with_screen)
+{
+    GtkAdjustment *vadjustment =
+        gtk_scrollable_get_vadjustment (GTK_SCROLLABLE (vtterm));
+    const glong first_row = gtk_adjustment_get_lower (vadjustment);
+    const glong end_row = with_screen
+        ? gtk_adjustment_get_upper (vadjustment)
+        : term_get_screen_top (vtterm);
+
+    return (end_row > first_row)
+        ? vte_terminal_get_text_range (vtterm,
+                                       first_row, 0,
+                                       end_row - 1,
+                                       vte_terminal_get_column_count (vtterm) - 1,
+                                       NULL, NULL, NULL)
+        : NULL;
+}
+
+
+/* Saves history text compressed with gzip. May be used from any thread. */
+static gboolean
+save_history (GFile        *file,
+              const gchar  *history,
+              GCancellable *cancellable,
+              GError      **error)
+{
+    g_autoptr(GFileOutputStream) file_stream =
+        g_file_replace (file, NULL, FALSE, G_FILE_CREATE_PRIVATE, cancellable, error);
+    if (!file_stream)
+        return FALSE;
+
+    g_autoptr(GZlibCompressor) compressor =
+        g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1);
+    g_autoptr(GOutputStream) stream =
+        g_converter_output_stream_new (G_OUTPUT_STREAM (file_stream),
+                                       G_CONVERTER (compressor));
+
+    return (!history ||
+            g_output_stream_write_all (stream, history, strlen (history),
+                                       NULL, cancellable, error)) &&
+        g_output_stream_close (stream, cancellable, error);
+}
+
+
+static gboolean
+term_write_history (VteTerminal *vtterm,
+                    GFile       *file,
+                    gboolean     with_screen,
+                    GError     **error)
+{
+    g_autofree gchar *history = term_get_history (vtterm, with_screen);
+    return save_history (file, history, NULL, error);
+}
+
+
+/* Loads text saved by save_history(). May be used from any thread. */
+static GBytes*
+load_history (GFile        *file,
+              GCancellable *cancellable,
+              GError      **error)
+{
+    g_autoptr(GFileInputStream) file_stream = g_file_read (file, cancellable, error);
+    if (!file_stream)
+        return NULL;
+
+    g_autoptr(GZlibDecompressor) decompressor =
+        g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP);
+    g_autoptr(GInputStream) stream =
+        g_converter_input_stream_new (G_INPUT_STREAM (file_stream),
+                                      G_CONVERTER (decompressor));
+    return g_input_stream_read_bytes (stream, G_MAXSSIZE, cancellable, error);
+}
+
+
+/*
+ * Text from VTE uses bare newlines, which only move the cursor down, so
+ * they are fed as CR+LF. Feeding a newline after the last line of the
+ * screen would scroll it, so it can be skipped.
+ */
+static void
+term_feed_text (VteTerminal *vtterm,
+                const gchar *data,
+                gsize        length,
+                gboolean     skip_last_newline)
+{
+    const gchar *end = data + length;
+    while (data < end) {
+        const gchar *newline = memchr (data, '\n', end - data);
+        if (!newline) {
+            vte_terminal_feed (vtterm, data, end - data);
+            break;
+        }
+        vte_terminal_feed (vtterm, data, newline - data);
+        if (newline + 1 < end || !skip_last_newline)
+            vte_terminal_feed (vtterm, "\r\n", 2);
+        data = newline + 1;
+    }
+}
+
+
+/*
+ * Puts saved history text back into the scrollback. The child may have
+ * written to the terminal in the meantime, so its current contents and
+ * the cursor position are kept below the saved history.
+ *
+ * The child is still running, and the modes it has set (cursor keys,
+ * mouse reporting, bracketed paste, ...) must be kept, so the terminal
+ * is not reset. The cursor, attributes and character sets are saved with
+ * DECSC and put back with DECRC; in between, the screen and scrollback
+ * are erased and filled again with plain text. Text only reaches the
+ * scrollback by scrolling the whole screen, so a scroll region has to
+ * be cleared: hibernation skips the alternate screen, where programs
+ * which set them usually run.
+ */
+static const gchar feed_history_start[] =
+    "\0337"            /* DECSC: save cursor, attributes, charsets. */
+    "\033[r"           /* DECSTBM: whole screen as scroll region.   */
+    "\033[0m\033(B\017" /* Plain attributes, ASCII in G0, SI.       */
+    "\033[H\033[2J"     /* Erase screen, which VTE moves to history, */
+    "\033[3J";         /* ...then the history itself.               */
+static const gchar feed_history_end[] =
+    "\0338";           /* DECRC: restore cursor, attributes, etc.   */
+
+static void
+term_feed_history (VteTerminal *vtterm,
+                   GBytes      *history)
+{
+    GtkAdjustment *vadjustment =
+        gtk_scrollable_get_vadjustment (GTK_SCROLLABLE (vtterm));
+    g_autofree gchar *contents =
+        vte_terminal_get_text_range (vtterm,
+                                     gtk_adjustment_get_lower (vadjustment), 0,
+                                     gtk_adjustment_get_upper (vadjustment) - 1,
+                                     vte_terminal_get_column_count (vtterm) - 1,
+                                     NULL, NULL, NULL);
+
+    vte_terminal_feed (vtterm, feed_history_start, -1);
+
+    gsize length = 0;
+    const gchar *data = g_bytes_get_data (history, &length);
+    term_feed_text (vtterm, data, length, FALSE);
+    if (contents)
+        term_feed_text (vtterm, contents, strlen (contents), TRUE);
+
+    vte_terminal_feed (vtterm, feed_history_end, -1);
+}
+
+
+static gboolean
+term_hibernate (VteTerminal        *vtterm,
+                TermHibernateState *state)
+{
+    /*
+     * Only terminals with scrollback are worth hibernating. This also
+     * skips those showing the alternate screen (e.g. full screen
+     * programs), which do not have scrollback.
+     */
+    if (!term_has_history (vtterm))
+        return FALSE;
+
+    g_autofree gchar *path = g_build_filename (g_get_user_runtime_dir (),
+                                               "dwt-hibernate-XXXXXX",
+                                               NULL);
+    gint fd = g_mkstemp (path);
+    if (fd == -1) {
+        g_warning ("Cannot create hibernation file: %s", g_strerror (errno));
+        return FALSE;
+    }
+    g_close (fd, NULL);
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GFile) file = g_file_new_for_path (path);
+    if (!term_write_history (vtterm, file, FALSE, &error)) {
+        g_warning ("Cannot hibernate terminal: %s", error->message);
+        g_unlink (path);
+        return FALSE;
+    }
+
+    g_object_get (vtterm, "scrollback-lines", &state->scrollback_lines, NULL);
+    vte_terminal_set_scrollback_lines (vtterm, 0);
+
+    state->path = g_steal_pointer (&path);
+    return TRUE;
+}
+
+
+static void
+term_restore (VteTerminal        *vtterm,
+              TermHibernateState *state)
+{
+    if (!state->path)
+        return;
+
+    g_autofree gchar *path = g_steal_pointer (&state->path);
+    state->last_activity = g_get_monotonic_time ();
+
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GFile) file = g_file_new_for_path (path);
+    g_autoptr(GBytes) history = load_history (file, NULL, &error);
+    g_unlink (path);
+
+    vte_terminal_set_scrollback_lines (vtterm, state->scrollback_lines);
+    if (history)
+        term_feed_history (vtterm, history);
+    else
+        g_warning ("Cannot restore hibernated terminal: %s", error->message);
+}
+
+
+static void
+window_restore_current_term (GtkWindow *window)
+{
+    VteTerminal *vtterm = window_get_term_widget (window);
+    if (vtterm)
+        term_restore (vtterm, term_get_hibernate_state (vtterm));
+}
+
+
+static void
+hibernate_idle_terms (GtkWindow *window,
+                      gint64     idle_since)
+{
+    WindowState *window_state = window_get_state (window);
+    if (!window_state)
+        return;
+
+    const gboolean focused = gtk_window_has_toplevel_focus (window);
+    VteTerminal *current = window_get_term_widget (window);
+    const gint n_pages = gtk_notebook_get_n_pages (window_state->notebook);
+
+    for (gint i = 0; i < n_pages; i++) {
+        VteTerminal *vtterm =
+            VTE_TERMINAL (gtk_notebook_get_nth_page (window_state->notebook, i));
+        TermHibernateState *state = term_get_hibernate_state (vtterm);
+
+        if (!state->path && state->last_activity < idle_since &&
+            !(focused && vtterm == current))
+            term_hibernate (vtterm, state);
+    }
+}
+
+
+static gboolean
+hibernate_timer_tick (gpointer userdata)
+{
+    g_autoptr(DgSettingsSnapshot) settings = dwt_settings_get_snapshot ();
+    const guint timeout = dwt_settings_get_hibernate_timeout (settings);
+    const gint64 idle_since = g_get_monotonic_time () - timeout * G_TIME_SPAN_SECOND;
+    for (GList *item = gtk_application_get_windows (GTK_APPLICATION (userdata));
+         item; item = g_list_next (item))
+        hibernate_idle_terms (GTK_WINDOW (item->data), idle_since);
+
+    return TRUE;
+}
+
+
+/* The timer only runs while hibernation is enabled. */
+static void
+hibernate_timer_update (GtkApplication *application,
+                        guint           timeout)
+{
+    if (timeout && !hibernate_timer_id) {
+        hibernate_timer_id = g_timeout_add_seconds (HIBERNATE_CHECK_INTERVAL,
+                                                    hibernate_timer_tick,
+                                                    application);
+    } else if (!timeout && hibernate_timer_id) {
+        g_source_remove (hibernate_timer_id);
+        hibernate_timer_id = 0;
+    }
+}
+
+
+static void
+hibernate_timeout_notified (GObject    *settings,
+                            GParamSpec *pspec,
+                            gpointer    userdata)
+{
+    guint timeout = 0;
+    g_object_get (settings, "hibernate-timeout", &timeout, NULL);
+    hibernate_timer_update (GTK_APPLICATION (userdata), timeout);
+}
+
+
+/*
+ * When the "show-resources" setting is enabled, the header bar of each
+ * window shows the CPU usage and resident memory of the process tree
+ * running in its current terminal (see dwt-procstat.c). A single timer
+ * samples all windows, skipping those which are hidden, minimized, or
+ * fully obscured, and those whose header bar is not shown. The interval
+ * starts at one second, and doubles up to eight seconds while no label
+ * changes; switching tabs or spawning a child resets it. The timer only
+ * runs while the setting is enabled. Trees are sampled incrementally, and
+ * re-sampling a known process costs in the order of 2 µs (the first
+ * sample of a process, which opens its files, about 15 µs). The time
+ * taken by each round is logged as a debug message, along with the
+ * running total relative to the elapsed time.
+ */
+#define RESOURCE_INTERVAL_MIN 1  /* seconds */
+#define RESOURCE_INTERVAL_MAX 8  /* seconds */
+
+static GtkApplication *resource_application = NULL;
+static guint resource_timer_id = 0;
+static guint resource_interval = RESOURCE_INTERVAL_MIN;
+static gint64 resource_start_time = 0;
+static gint64 resource_sampling_time = 0;
+
+
+static gboolean resource_timer_tick (gpointer userdata);
+
+
+static void
+resource_timer_schedule (guint interval)
+{
+    if (resource_timer_id)
+        g_source_remove (resource_timer_id);
+    resource_interval = interval;
+    resource_timer_id = g_timeout_add_seconds (interval, resource_timer_tick, NULL);
+}
+
+
+/* Usage is recalculated from scratch on the next sample. */
+static void
+window_reset_resources (WindowState *state)
+{
+    state->resources_pid = 0;
+    g_clear_pointer (&state->resources_tree, dwt_proc_tree_free);
+}
+
+
+static void
+resource_timer_update (gboolean enabled)
+{
+    if (enabled) {
+        if (!resource_timer_id)
+            resource_timer_schedule (RESOURCE_INTERVAL_MIN);
+        return;
+    }
+
+    if (resource_timer_id) {
+        g_source_remove (resource_timer_id);
+        resource_timer_id = 0;
+    }
+
+    for (GList *item = resource_application
+            ? gtk_application_get_windows (resource_application) : NULL;
+         item; item = g_list_next (item))
+    {
+        WindowState *state = window_get_state (GTK_WINDOW (item->data));
+        if (state && state->resources_label) {
+            gtk_widget_hide (GTK_WIDGET (state->resources_label));
+            window_reset_resources (state);
+        }
+    }
+}
+
+
+static void
+show_resources_notified (GObject    *settings,
+                         GParamSpec *pspec,
+                         gpointer    userdata)
+{
+    gboolean enabled = FALSE;
+    g_object_get (settings, "show-resources", &enabled, NULL);
+    resource_timer_update (enabled);
+}
+
+
+static void
+resource_timer_start (GtkApplication *application)
+{
+    resource_application = application;
+    resource_start_time = g_get_monotonic_time ();
+    g_autoptr(DgSettingsSnapshot) settings = dwt_settings_get_snapshot ();
+    resource_timer_update (dwt_settings_get_show_resources (settings));
+    g_signal_connect (dwt_settings_get_instance (), "notify::show-resources",
+                      G_CALLBACK (show_resources_notified), NULL);
+}
+
+
+static void
+resource_timer_stop (void)
+{
+    if (!resource_application)
+        return;
+
+    g_signal_handlers_disconnect_by_func (dwt_settings_get_instance (),
+                                          show_resources_notified, NULL);
+    resource_timer_update (FALSE);
+    resource_application = NULL;
+}
+
+
+/* Something changed, sample again soon. */
+static void
+resource_timer_wake (void)
+{
+    if (resource_timer_id && resource_interval > RESOURCE_INTERVAL_MIN)
+        resource_timer_schedule (RESOURCE_INTERVAL_MIN);
+}
+
+
+static gboolean
+window_resources_visible (WindowState *state)
+{
+    return state->resources_label && !state->iconified && !state->obscured &&
+        gtk_widget_get_mapped (GTK_WIDGET (state->window)) &&
+        gtk_widget_is_visible (gtk_widget_get_parent (GTK_WIDGET (state->resources_label)));
+}
+
+
+/* Returns whether the text of the label changed. */
+static gboolean
+window_update_resources (WindowState *state,
+                         gint64       now,
+                         guint       *n_processes)
+{
+    VteTerminal *vtterm = window_get_term_widget (state->window);
+    const GPid pid = vtterm
+        ? GPOINTER_TO_INT (g_object_get_data (G_OBJECT (vtterm), "dwt-child-pid"))
+        : 0;
+
+    if (pid != state->resources_pid)
+        window_reset_resources (state);
+    if (pid > 0 && !state->resources_tree)
+        state->resources_tree = dwt_proc_tree_new (pid);
+
+    DwtProcStat stat;
+    if (!state->resources_tree || !dwt_proc_tree_sample (state->resources_tree, &stat)) {
+        window_reset_resources (state);
+        const gboolean changed = gtk_widget_get_visible (GTK_WIDGET (state->resources_label));
+        gtk_widget_hide (GTK_WIDGET (state->resources_label));
+        return changed;
+    }
+    *n_processes += stat.n_processes;
+
+    /* Usage can only be calculated from the second sample on. */
+    g_autofree gchar *rss = g_format_size_full (stat.rss, G_FORMAT_SIZE_IEC_UNITS);
+    g_autofree gchar *text = NULL;
+    if (pid == state->resources_pid && now > state->resources_time) {
+        const guint64 cpu_time = (stat.cpu_time > state->resources_cpu_time)
+            ? stat.cpu_time - state->resources_cpu_time : 0;
+        text = g_strdup_printf ("%.0f%% · %s",
+                                100.0 * cpu_time / (now - state->resources_time),
+                                rss);
+    } else {
+        text = g_strdup_printf ("– · %s", rss);
+    }
+    state->resources_pid = pid;
+    state->resources_cpu_time = stat.cpu_time;
+    state->resources_time = now;
+
+    GtkWidget *label = GTK_WIDGET (state->resources_label);
+    gboolean changed = !gtk_widget_get_visible (label);
+    gtk_widget_show (label);
+
+    if (g_strcmp0 (gtk_label_get_label (state->resources_label), text)) {
+        gtk_label_set_label (state->resources_label, text);
+        g_autofree gchar *tooltip =
+            g_strdup_printf ("CPU usage and resident memory of %u process%s",
+                             stat.n_processes, stat.n_processes == 1 ? "" : "es");
+        gtk_widget_set_tooltip_text (label, tooltip);
+        changed = TRUE;
+    }
+    return changed;
+}
+
+
+static gboolean
+resource_timer_tick (gpointer userdata)
+{
+    const gint64 now = g_get_monotonic_time ();
+    gboolean changed = FALSE;
+    guint n_processes = 0, n_windows = 0;
+
+    for (GList *item = gtk_application_get_windows (resource_application);
+         item; item = g_list_next (item))
+    {
+        WindowState *state = window_get_state (GTK_WINDOW (item->data));
+        if (!state || !state->resources_label)
+            continue;
+
+        if (window_resources_visible (state)) {
+            changed |= window_update_resources (state, now, &n_processes);
+            n_windows++;
+        } else {
+            /* Hidden windows keep no files open. */
+            window_reset_resources (state);
+        }
+    }
+
+    if (n_windows) {
+        const gint64 elapsed = g_get_monotonic_time () - now;
+        resource_sampling_time += elapsed;
+        g_debug ("Resource sampling took %.3f ms for %u processes in %u windows"
+                 " (%.4f%% of the time so far)",
+                 elapsed / 1000.0, n_processes, n_windows,
+                 100.0 * resource_sampling_time / MAX (now - resource_start_time, 1));
+    }
+
+    const guint interval = changed
+        ? RESOURCE_INTERVAL_MIN
+        : MIN (resource_interval * 2, RESOURCE_INTERVAL_MAX);
+    if (interval == resource_interval)
+        return G_SOURCE_CONTINUE;
+
+    resource_timer_id = 0;
+    resource_timer_schedule (interval);
+    return G_SOURCE_REMOVE;
+}
+
+
+static char*
+guess_shell (void)
+{
+    char *shell = getenv ("SHELL");
+    if (!shell) {
+        struct passwd *pw = getpwuid (getuid ());
+        shell = (pw) ? pw->pw_shell : "/bin/sh";
+    }
+    /* Return a copy */
+    return g_strdup (shell);
+}
+
+
+static gboolean
+popover_idle_closed_tick (gpointer userdata)
+{
+    VteTerminal *vtterm = window_get_term_widget (GTK_WINDOW (userdata));
+    if (vtterm)
+        gtk_widget_grab_focus (GTK_WIDGET (vtterm));
+    return FALSE; /* Do no re-arm (run once) */
+}
+
+static void
+popover_closed (GtkPopover *popover,
+                GtkWindow  *window)
+{
+    /* XXX: Grabbing the focus right away does not work, must do later. */
+    g_idle_add_full (G_PRIORITY_DEFAULT_IDLE,
+                     popover_idle_closed_tick,
+                     g_object_ref (window),
+                     g_object_unref);
+}
+
+static GtkWidget*
+setup_popover (GtkWindow   *window,
+               VteTerminal *vtterm)
+{
+    GtkWidget *popover = gtk_popover_new (GTK_WIDGET (vtterm));
+    g_signal_connect (G_OBJECT (popover), "closed",
+                      G_CALLBACK (popover_closed), window);
+    gtk_popover_bind_model (GTK_POPOVER (popover), popover_menu_model, NULL);
+    return popover;
+}
+
+
+/*
+ * Most windows never get a right-click, so the context popover is only
+ * created the first time it is needed. It is shared by all the terminals
+ * in the window, and moved to the one where it is shown.
+ */
+static GtkWidget*
+window_get_popover (GtkWindow   *window,
+                    VteTerminal *vtterm)
+{
+    WindowState *state = window_get_state (window);
+    if (!state->popover)
+        state->popover = setup_popover (window, vtterm);
+    else
+        gtk_popover_set_relative_to (GTK_POPOVER (state->popover),
+                                     GTK_WIDGET (vtterm));
+    return state->popover;
+}
+
+
+static void
+image_popover_closed (GtkWidget *popover,
+                      gpointer   userdata)
+{
+	gtk_widget_destroy (popover);
+}
+
+
+static void
+image_pixbuf_loaded (GInputStream *stream,
+                     GAsyncResult *result,
+                     GtkWidget    *popover)
+{
+	g_autoptr(GError) error = NULL;
+    g_autoptr(GdkPixbuf) pixbuf = gdk_pixbuf_new_from_stream_finish (result,
+                                                                     &error);
+	if (!pixbuf || error) {
+		g_printerr ("Could not decode image from pixbuf: %s", error->message);
+		return;
+	}
+
+    gtk_container_add (GTK_CONTAINER (popover),
+                       gtk_image_new_from_pixbuf (pixbuf));
+	g_signal_connect (popover, "closed",
+                      G_CALLBACK (image_popover_closed), NULL);
+	gtk_widget_show_all (popover);
+}
+
+
+static void
+image_file_opened (GFile        *file,
+                   GAsyncResult *result,
+                   GtkWidget    *popover)
+{
+	g_autoptr(GError) error = NULL;
+    g_autoptr(GFileInputStream) stream = g_file_read_finish (file, result, &error);
+	if (!stream || error) {
+		g_autofree char *uri = g_file_get_uri (file);
+		g_printerr ("Could not open URL '%s': %s", uri, error->message);
+		return;
+	}
+
+	gdk_pixbuf_new_from_stream_at_scale_async (G_INPUT_STREAM (stream),
+                                               500, 500, TRUE,
+                                               NULL,
+                                               (GAsyncReadyCallback) image_pixbuf_loaded,
+                                               popover);
+}
+
+
+static GtkWidget*
+make_popover_for_image_url (VteTerminal *vtterm,
+							const gchar *uri)
+{
+	g_assert (vtterm);
+	g_assert (uri);
+
+	GtkWidget *popover = gtk_popover_new (GTK_WIDGET (vtterm));
+	g_autoptr(GVfs) gvfs = g_vfs_get_default ();
+	g_autoptr(GFile) file = g_vfs_get_file_for_uri (gvfs, uri);
+	g_file_read_async (file,
+                       G_PRIORITY_DEFAULT,
+                       NULL,
+                       (GAsyncReadyCallback) image_file_opened,
+                       popover);
+	return popover;
+}
+
+
+static gboolean
+term_mouse_button_released (VteTerminal    *vtterm,
+                            GdkEventButton *event,
+                            gpointer        userdata)
+{
+    g_clear_pointer (&last_match_text, g_free);
+
+    /* Hyperlinks come first, looking them up is cheaper than matching. */
+    const gint64 start = g_get_monotonic_time ();
+    g_autofree char *match = vte_terminal_hyperlink_check_event (vtterm, (GdkEvent*) event);
+    const gboolean is_hyperlink = (match != NULL);
+    g_autoptr(DgSettingsSnapshot) settings = dwt_settings_get_snapshot ();
+    if (!match && dwt_settings_get_match_urls (settings)) {
+        int match_tag;
+        match = vte_terminal_match_check_event (vtterm, (GdkEvent*) event, &match_tag);
+
+        /* File paths are links only if they are already known to exist. */
+        TermPathState *path_state = term_get_path_state (vtterm);
+        if (match && path_state && match_tag == path_state->tag) {
+            g_autofree gchar *path = NULL;
+            const gboolean exists =
+                term_check_path (vtterm, path_state, match, &path) == PATH_EXISTS;
+            g_free (match);
+            match = exists ? g_filename_to_uri (path, NULL, NULL) : NULL;
+        }
+    }
+    g_debug ("Link lookup took %.3f ms (%s)",
+             (g_get_monotonic_time () - start) / 1000.0,
+             is_hyperlink ? "hyperlink" : match ? "regex match" : "none");
+
+    const long col = event->x / vte_terminal_get_char_width (vtterm);
+    const long row = event->y / vte_terminal_get_char_height (vtterm);
+
+    GtkWindow *window = GTK_WINDOW (gtk_widget_get_ancestor (GTK_WIDGET (vtterm),
+                                                             GTK_TYPE_WINDOW));
+
+    if (match && event->button == 1) {
+		if (CHECK_FLAGS (event->state, GDK_CONTROL_MASK)) {
+			g_autoptr(GError) error = NULL;
+			if (!gtk_show_uri_on_window (window, match, event->time, &error))
+				g_printerr ("Could not open URL: %s\n", error->message);
+			return FALSE;
+		} else if (g_regex_match (image_regex, match, 0, NULL)) {
+			/* Show picture in a popover */
+			GdkRectangle rect;
+			rect.height = vte_terminal_get_char_height (vtterm);
+			rect.width = vte_terminal_get_char_width (vtterm);
+			rect.y = rect.height * row;
+			rect.x = rect.width * col;
+
+			GtkWidget* popover = make_popover_for_image_url (vtterm, match);
+			gtk_popover_set_pointing_to (GTK_POPOVER (popover), &rect);
+			return FALSE;
+		}
+    }
+
+
+    if (event->button == 3) {
+        GtkWidget *popover = window_get_popover (window, vtterm);
+
+        GdkRectangle rect;
+        rect.height = vte_terminal_get_char_height (vtterm);
+        rect.width = vte_terminal_get_char_width (vtterm);
+        rect.y = rect.height * row;
+        rect.x = rect.width * col;
+        gtk_popover_set_pointing_to (GTK_POPOVER (popover), &rect);
+
+        GActionMap *actions = G_ACTION_MAP (window);
+        g_simple_action_set_enabled (G_SIMPLE_ACTION (g_action_map_lookup_action (actions,
+                                                                                  "copy")),
+                                    vte_terminal_get_has_selection (vtterm));
+        g_simple_action_set_enabled (G_SIMPLE_ACTION (g_action_map_lookup_action (actions,
+                                                                                  "open-url")),
+                                     match != NULL);
+        g_simple_action_set_enabled (G_SIMPLE_ACTION (g_action_map_lookup_action (actions,
+                                                                                  "copy-url")),
+                                     match != NULL);
+        if (match) {
+            last_match_text = match;
+            match = NULL;
+        }
+
+        gtk_widget_show_all (popover);
+
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void
+setup_header_bar (WindowState *state,
+                  gboolean     show_maximized_title)
+{
+    GtkWidget *window = GTK_WIDGET (state->window);
+
+    /*
+     * Using the default GtkHeaderBar title/subtitle widget makes the bar
+     * too thick to look nice for a terminal, so set a custom widget.
+     */
+    const gchar *title = gtk_window_get_title (GTK_WINDOW (window));
+    GtkWidget *label = gtk_label_new (title ? title : "dwt");
+    state->title_label = GTK_LABEL (label);
+
+    GtkWidget *header = gtk_header_bar_new ();
+    gtk_header_bar_set_show_close_button (GTK_HEADER_BAR (header), TRUE);
+    gtk_header_bar_set_has_subtitle (GTK_HEADER_BAR (header), FALSE);
+    gtk_header_bar_set_custom_title (GTK_HEADER_BAR (header), label);
+
+    GtkWidget *button = gtk_button_new_from_icon_name ("tab-new-symbolic",
+                                                       GTK_ICON_SIZE_BUTTON);
+    gtk_button_set_relief (GTK_BUTTON (button), GTK_RELIEF_NONE);
+    gtk_actionable_set_action_name (GTK_ACTIONABLE (button), "app.new-terminal");
+    gtk_header_bar_pack_start (GTK_HEADER_BAR (header), button);
+
+    GtkWidget *revealer = gtk_revealer_new ();
+    gtk_container_add (GTK_CONTAINER (revealer),
+                       gtk_image_new_from_icon_name ("software-update-urgent-symbolic",
+                                                     GTK_ICON_SIZE_BUTTON));
+    gtk_revealer_set_transition_duration (GTK_REVEALER (revealer), 500);
+    gtk_revealer_set_transition_type (GTK_REVEALER (revealer),
+                                      GTK_REVEALER_TRANSITION_TYPE_CROSSFADE);
+    gtk_header_bar_pack_end (GTK_HEADER_BAR (header), revealer);
+    state->bell_revealer = GTK_REVEALER (revealer);
+
+    g_object_bind_property (G_OBJECT (window), "urgency-hint",
+                            G_OBJECT (revealer), "reveal-child",
+                            G_BINDING_DEFAULT);
+
+    /* Progress of chunked pastes, with a button to cancel them. */
+    GtkWidget *progress = gtk_progress_bar_new ();
+    gtk_widget_set_valign (progress, GTK_ALIGN_CENTER);
+    state->paste_progress = GTK_PROGRESS_BAR (progress);
+
+    button = gtk_button_new_from_icon_name ("process-stop-symbolic",
+                                            GTK_ICON_SIZE_BUTTON);
+    gtk_button_set_relief (GTK_BUTTON (button), GTK_RELIEF_NONE);
+    gtk_widget_set_tooltip_text (button, "Cancel paste");
+    gtk_actionable_set_action_name (GTK_ACTIONABLE (button), "win.paste-cancel");
+
+    GtkWidget *box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 6);
+    gtk_container_add (GTK_CONTAINER (box), progress);
+    gtk_container_add (GTK_CONTAINER (box), button);
+
+    revealer = gtk_revealer_new ();
+    gtk_container_add (GTK_CONTAINER (revealer), box);
+    gtk_revealer_set_transition_type (GTK_REVEALER (revealer),
+                                      GTK_REVEALER_TRANSITION_TYPE_CROSSFADE);
+    gtk_header_bar_pack_end (GTK_HEADER_BAR (header), revealer);
+    state->paste_revealer = GTK_REVEALER (revealer);
+
+    /* Resource usage of the current terminal, see resource_timer_tick(). */
+    label = gtk_label_new (NULL);
+    gtk_style_context_add_class (gtk_widget_get_style_context (label), "dim-label");
+    gtk_widget_set_no_show_all (label, TRUE);
+    gtk_header_bar_pack_end (GTK_HEADER_BAR (header), label);
+    state->resources_label = GTK_LABEL (label);
+
+    gtk_window_set_titlebar (GTK_WINDOW (window), header);
+
+    /* Hide the header bar when the window is maximized. */
+    if (!show_maximized_title) {
+        g_object_bind_property (G_OBJECT (window), "is-maximized",
+                                G_OBJECT (header), "visible",
+                                G_BINDING_INVERT_BOOLEAN);
+    }
+}
+
+
+/*
+ * Each window has a search bar, which applies to the terminal in the
+ * current page. GtkSearchEntry emits "search-changed" only once typing
+ * pauses, so patterns are compiled (and JIT-compiled) and searched for
+ * at most once per pause instead of on every key press. Patterns without
+ * uppercase letters match case-insensitively.
+ *
+ * VTE searches synchronously, scanning row after row until it finds a
+ * match, which blocks the main loop for as long as it takes to go over
+ * a long scrollback without matches. Instead, rows are scanned here one
+ * at a time with the same pattern from an idle source, in slices of at
+ * most SEARCH_SLICE_USEC, until a row with a match is found. Only then
+ * VTE is asked to find it, starting as close to that row as possible:
+ * next to the previous match when it is near, otherwise from the top or
+ * bottom of the visible part of the screen (which is where VTE starts
+ * when there is no selection) after scrolling to the row. Either way,
+ * all the rows VTE goes over before reaching the match are known to have
+ * none. Rows are scanned separately, so matches which span soft-wrapped
+ * rows are only found by VTE when it goes over them on its own.
+ */
+#define SEARCH_SLICE_USEC 4000
+
+typedef struct {
+    GtkWindow   *window;
+    VteTerminal *vtterm;
+    GRegex      *regex;
+    gboolean     backwards;
+    gboolean     wrap_around;
+    gboolean     wrapped;
+    gboolean     from_match;
+    glong        origin;
+    glong        row;
+    glong        n_rows;
+    guint        idle_id;
+    guint        n_slices;
+    gint64       start_time;
+    gint64       slice_max;
+} SearchRun;
+
+
+static void
+search_run_free (gpointer userdata)
+{
+    SearchRun *run = userdata;
+    if (run->idle_id)
+        g_source_remove (run->idle_id);
+    if (run->vtterm)
+        g_object_remove_weak_pointer (G_OBJECT (run->vtterm),
+                                      (gpointer*) &run->vtterm);
+    g_regex_unref (run->regex);
+    g_free (run);
+}
+
+
+static void
+window_search_cancel (WindowState *state)
+{
+    g_object_set_data (G_OBJECT (state->window), "dwt-search-run", NULL);
+}
+
+
+static void
+search_selection_changed (VteTerminal *vtterm,
+                          WindowState *state)
+{
+    /* The selection is no longer the tracked match. */
+    if (!state->search_selecting)
+        state->search_row = -1;
+}
+
+
+static void
+window_search_track (WindowState *state,
+                     VteTerminal *vtterm,
+                     glong        row,
+                     gint         index)
+{
+    if (state->search_term != vtterm) {
+        if (state->search_term) {
+            g_signal_handler_disconnect (state->search_term, state->search_selection_id);
+            g_object_remove_weak_pointer (G_OBJECT (state->search_term),
+                                          (gpointer*) &state->search_term);
+        }
+        state->search_term = vtterm;
+        g_object_add_weak_pointer (G_OBJECT (vtterm), (gpointer*) &state->search_term);
+        state->search_selection_id =
+            g_signal_connect (G_OBJECT (vtterm), "selection-changed",
+                              G_CALLBACK (search_selection_changed), state);
+    }
+    state->search_row = row;
+    state->search_index = index;
+}
+
+
+/* Returns the number of matches in a row, or -1 if it does not exist. */
+static gint
+term_count_row_matches (VteTerminal *vtterm,
+                        GRegex      *regex,
+                        glong        row)
+{
+    g_autofree gchar *text =
+        vte_terminal_get_text_range (vtterm, row, 0, row,
+                                     vte_terminal_get_column_count (vtterm) - 1,
+                                     NULL, NULL, NULL);
+    if (!text)
+        return -1;
+
+    g_autoptr(GMatchInfo) match_info = NULL;
+    gint n_matches = 0;
+    for (g_regex_match (regex, text, 0, &match_info);
+         g_match_info_matches (match_info);
+         g_match_info_next (match_info, NULL))
+        n_matches++;
+    return n_matches;
+}
+
+
+static gboolean
+window_search_select (WindowState *state,
+                      VteTerminal *vtterm,
+                      gboolean     backwards)
+{
+    state->search_selecting = TRUE;
+    const gboolean found = backwards
+        ? vte_terminal_search_find_previous (vtterm)
+        : vte_terminal_search_find_next (vtterm);
+    state->search_selecting = FALSE;
+    return found;
+}
+
+
+static void
+window_search_done (WindowState *state,
+                    gboolean     found)
+{
+    GtkStyleContext *style =
+        gtk_widget_get_style_context (GTK_WIDGET (state->search_entry));
+    if (found)
+        gtk_style_context_remove_class (style, GTK_STYLE_CLASS_ERROR);
+    else
+        gtk_style_context_add_class (style, GTK_STYLE_CLASS_ERROR);
+}
+
+
+/* Makes VTE select the first or last match, depending on the direction. */
+static gboolean
+search_run_select_row (SearchRun *run,
+                       glong      row,
+                       gint       n_matches)
+{
+    WindowState *state = window_get_state (run->window);
+    GtkAdjustment *vadjustment =
+        gtk_scrollable_get_vadjustment (GTK_SCROLLABLE (run->vtterm));
+    const glong n_rows = vte_terminal_get_row_count (run->vtterm);
+    const glong lower = gtk_adjustment_get_lower (vadjustment);
+
+    /*
+     * Without a selection, VTE searches forward from the top of the screen
+     * and backward from its bottom. When the row cannot be placed there,
+     * the rows in between must have been scanned already; otherwise the
+     * previous match is near, and VTE goes from it to the row instead.
+     */
+    gboolean from_screen = TRUE;
+    if (run->from_match && !run->wrapped) {
+        const glong start = run->backwards
+            ? MAX (row + 1, lower + n_rows)
+            : MIN (row, (glong) gtk_adjustment_get_upper (vadjustment) - n_rows);
+        from_screen = run->backwards ? (start <= run->origin) : (start > run->origin);
+    }
+    if (from_screen) {
+        state->search_selecting = TRUE;
+        vte_terminal_unselect_all (run->vtterm);
+        state->search_selecting = FALSE;
+        gtk_adjustment_set_value (vadjustment,
+                                  run->backwards ? row + 1 - n_rows : row);
+    }
+
+    const gboolean found = window_search_select (state, run->vtterm, run->backwards);
+    if (found)
+        window_search_track (state, run->vtterm, row,
+                             run->backwards ? n_matches - 1 : 0);
+    return found;
+}
+
+
+static void
+search_run_finish (SearchRun *run,
+                   glong      row,
+                   gint       n_matches)
+{
+    const gboolean found = n_matches > 0 && search_run_select_row (run, row, n_matches);
+    g_debug ("Search %s after %.3f ms, %ld rows in %u slices (longest %.3f ms)",
+             found ? "matched" : "failed",
+             (g_get_monotonic_time () - run->start_time) / 1000.0,
+             run->n_rows, run->n_slices, run->slice_max / 1000.0);
+
+    WindowState *state = window_get_state (run->window);
+    run->idle_id = 0;
+    window_search_cancel (state);
+    window_search_done (state, found);
+}
+
+
+static gboolean
+search_run_slice (gpointer userdata)
+{
+    SearchRun *run = userdata;
+    WindowState *state = window_get_state (run->window);
+    if (!run->vtterm || run->vtterm != window_get_term_widget (run->window)) {
+        run->idle_id = 0;
+        window_search_cancel (state);
+        return G_SOURCE_REMOVE;
+    }
+
+    GtkAdjustment *vadjustment =
+        gtk_scrollable_get_vadjustment (GTK_SCROLLABLE (run->vtterm));
+    const glong lower = gtk_adjustment_get_lower (vadjustment);
+    const glong upper = gtk_adjustment_get_upper (vadjustment);
+
+    const gint64 slice_start = g_get_monotonic_time ();
+    gint64 now = slice_start;
+    run->n_slices++;
+
+    while (now - slice_start < SEARCH_SLICE_USEC) {
+        /* Every row, including the one of the previous match, once. */
+        if (run->n_rows > upper - lower) {
+            search_run_finish (run, -1, 0);
+            return G_SOURCE_REMOVE;
+        }
+        if (run->row < lower || run->row >= upper) {
+            if (run->backwards ? run->row >= upper : run->row < lower) {
+                run->row = run->backwards ? upper - 1 : lower;
+            } else if (run->wrap_around && !run->wrapped) {
+                run->wrapped = TRUE;
+                run->row = run->backwards ? upper - 1 : lower;
+            } else {
+                search_run_finish (run, -1, 0);
+                return G_SOURCE_REMOVE;
+            }
+        }
+
+        const gint n_matches = term_count_row_matches (run->vtterm, run->regex, run->row);
+        run->n_rows++;
+        if (n_matches > 0) {
+            run->slice_max = MAX (run->slice_max, g_get_monotonic_time () - slice_start);
+            search_run_finish (run, run->row, n_matches);
+            return G_SOURCE_REMOVE;
+        }
+        run->row += run->backwards ? -1 : 1;
+        now = g_get_monotonic_time ();
+    }
+
+    run->slice_max = MAX (run->slice_max, now - slice_start);
+    return G_SOURCE_CONTINUE;
+}
+
+
+static void
+window_search_find (WindowState *state,
+                    gboolean     backwards)
+{
+    window_search_cancel (state);
+
+    VteTerminal *vtterm = window_get_term_widget (state->window);
+    if (!vtterm || !state->search_regex)
+        return;
+
+    vte_terminal_search_set_regex (vtterm, state->search_regex, 0);
+    vte_terminal_search_set_wrap_around (vtterm, state->search_wrap_around);
+
+    GtkAdjustment *vadjustment =
+        gtk_scrollable_get_vadjustment (GTK_SCROLLABLE (vtterm));
+    const gboolean from_match = state->search_term == vtterm
+        && state->search_row >= gtk_adjustment_get_lower (vadjustment)
+        && state->search_row < gtk_adjustment_get_upper (vadjustment);
+
+    /* Further matches in the same row are found right away. */
+    if (from_match) {
+        const gint n_matches =
+            term_count_row_matches (vtterm, state->search_row_regex, state->search_row);
+        const gint index = state->search_index + (backwards ? -1 : 1);
+        if (index >= 0 && index < n_matches) {
+            const gboolean found = window_search_select (state, vtterm, backwards);
+            if (found)
+                state->search_index = index;
+            window_search_done (state, found);
+            return;
+        }
+    }
+
+    SearchRun *run = g_new0 (SearchRun, 1);
+    run->window = state->window;
+    run->vtterm = vtterm;
+    g_object_add_weak_pointer (G_OBJECT (vtterm), (gpointer*) &run->vtterm);
+    run->regex = g_regex_ref (state->search_row_regex);
+    run->backwards = backwards;
+    run->wrap_around = state->search_wrap_around;
+    run->from_match = from_match;
+    run->start_time = g_get_monotonic_time ();
+
+    if (from_match) {
+        run->origin = state->search_row;
+        run->row = state->search_row + (backwards ? -1 : 1);
+    } else {
+        const glong top = gtk_adjustment_get_value (vadjustment);
+        run->origin = run->row = backwards
+            ? top + vte_terminal_get_row_count (vtterm) - 1
+            : top;
+    }
+
+    g_object_set_data_full (G_OBJECT (state->window), "dwt-search-run",
+                            run, search_run_free);
+    run->idle_id = g_idle_add (search_run_slice, run);
+}
+
+
+static gboolean
+str_has_upper (const gchar *text)
+{
+    for (; *text; text = g_utf8_next_char (text))
+        if (g_unichar_isupper (g_utf8_get_char (text)))
+            return TRUE;
+    return FALSE;
+}
+
+
+static void
+search_entry_changed (GtkSearchEntry *entry,
+                      WindowState    *state)
+{
+    window_search_cancel (state);
+    state->search_row = -1;
+    g_clear_pointer (&state->search_regex, vte_regex_unref);
+    g_clear_pointer (&state->search_row_regex, g_regex_unref);
+    gtk_widget_set_tooltip_text (GTK_WIDGET (entry), NULL);
+    gtk_style_context_remove_class (gtk_widget_get_style_context (GTK_WIDGET (entry)),
+                                    GTK_STYLE_CLASS_ERROR);
+
+    VteTerminal *vtterm = window_get_term_widget (state->window);
+    const gchar *text = gtk_entry_get_text (GTK_ENTRY (entry));
+    if (!*text) {
+        if (vtterm) {
+            vte_terminal_search_set_regex (vtterm, NULL, 0);
+            vte_terminal_unselect_all (vtterm);
+        }
+        return;
+    }
+
+    guint32 flags = PCRE2_MULTILINE;
+    if (!str_has_upper (text))
+        flags |= PCRE2_CASELESS;
+
+    g_autoptr(GError) error = NULL;
+    state->search_regex = vte_regex_new_for_search (text, -1, flags, &error);
+    if (state->search_regex) {
+        /* The same pattern, to scan rows without involving VTE. */
+        const GRegexCompileFlags row_flags = G_REGEX_MULTILINE | G_REGEX_OPTIMIZE
+            | ((flags & PCRE2_CASELESS) ? G_REGEX_CASELESS : 0);
+        state->search_row_regex = g_regex_new (text, row_flags, 0, &error);
+        if (!state->search_row_regex)
+            g_clear_pointer (&state->search_regex, vte_regex_unref);
+    }
+    if (!state->search_regex) {
+        gtk_widget_set_tooltip_text (GTK_WIDGET (entry), error->message);
+        gtk_style_context_add_class (gtk_widget_get_style_context (GTK_WIDGET (entry)),
+                                     GTK_STYLE_CLASS_ERROR);
+        return;
+    }
+    if (!vte_regex_jit (state->search_regex, PCRE2_JIT_COMPLETE, &error))
+        g_warning ("Could not JIT-compile search regex: %s", error->message);
+
+    /*
+     * Searching starts from the selection, which is the previous match.
+     * Clearing it makes each new pattern match first the most recent
+     * output, at the bottom of the scrollback.
+     */
+    if (vtterm)
+        vte_terminal_unselect_all (vtterm);
+    window_search_find (state, TRUE);
+}
+
+
+static void
+search_entry_previous_match (GtkWidget   *entry,
+                             WindowState *state)
+{
+    window_search_find (state, TRUE);
+}
+
+
+static void
+search_entry_next_match (GtkWidget   *entry,
+                         WindowState *state)
+{
+    window_search_find (state, FALSE);
+}
+
+
+static void
+search_mode_notified (GObject     *object,
+                      GParamSpec  *pspec,
+                      WindowState *state)
+{
+    if (gtk_search_bar_get_search_mode (state->search_bar))
+        return;
+
+    window_search_cancel (state);
+    state->search_row = -1;
+
+    const gint n_pages = gtk_notebook_get_n_pages (state->notebook);
+    for (gint i = 0; i < n_pages; i++) {
+        VteTerminal *vtterm =
+            VTE_TERMINAL (gtk_notebook_get_nth_page (state->notebook, i));
+        vte_terminal_search_set_regex (vtterm, NULL, 0);
+    }
+
+    VteTerminal *vtterm = window_get_term_widget (state->window);
+    if (vtterm)
+        gtk_widget_grab_focus (GTK_WIDGET (vtterm));
+}
+
+
+static GtkWidget*
+setup_search_bar (WindowState *state)
+{
+    GtkWidget *entry = gtk_search_entry_new ();
+    gtk_entry_set_width_chars (GTK_ENTRY (entry), 40);
+    gtk_entry_set_placeholder_text (GTK_ENTRY (entry), "Search (regular expression)");
+    state->search_entry = GTK_ENTRY (entry);
+
+    g_signal_connect (G_OBJECT (entry), "search-changed",
+                      G_CALLBACK (search_entry_changed), state);
+    g_signal_connect (G_OBJECT (entry), "activate",
+                      G_CALLBACK (search_entry_previous_match), state);
+    g_signal_connect (G_OBJECT (entry), "previous-match",
+                      G_CALLBACK (search_entry_previous_match), state);
+    g_signal_connect (G_OBJECT (entry), "next-match",
+                      G_CALLBACK (search_entry_next_match), state);
+
+    GtkWidget *wrap_around = gtk_check_button_new_with_mnemonic ("_Wrap Around");
+    gtk_actionable_set_action_name (GTK_ACTIONABLE (wrap_around), "win.find-wrap-around");
+
+    GtkWidget *box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 6);
+    gtk_container_add (GTK_CONTAINER (box), entry);
+    gtk_container_add (GTK_CONTAINER (box), wrap_around);
+
+    GtkWidget *search_bar = gtk_search_bar_new ();
+    gtk_search_bar_set_show_close_button (GTK_SEARCH_BAR (search_bar), TRUE);
+    gtk_search_bar_connect_entry (GTK_SEARCH_BAR (search_bar), GTK_ENTRY (entry));
+    gtk_container_add (GTK_CONTAINER (search_bar), box);
+    state->search_bar = GTK_SEARCH_BAR (search_bar);
+    state->search_wrap_around = TRUE;
+    state->search_row = -1;
+
+    g_signal_connect (G_OBJECT (search_bar), "notify::search-mode-enabled",
+                      G_CALLBACK (search_mode_notified), state);
+    return search_bar;
+}
+
+
+/*
+ * Large pastes are sent to the child in chunks, each one written when the
+ * PTY can take more input and the main loop is otherwise idle, instead of
+ * all at once. This keeps the window responsive, lets slow readers keep
+ * up, and allows cancelling the paste. Each terminal may have a paste of
+ * its own in progress, and the window shows the progress of the one in
+ * the current tab.
+ *
+ * There is no API to query whether the child enabled bracketed paste.
+ * For relayed terminals it is tracked from the output of the child (see
+ * term_relay_scan_modes()), the whole paste is wrapped in a single pair
+ * of bracketed paste markers if enabled, and chunks are fed to the child
+ * after the same processing vte_terminal_paste_text() does. Otherwise
+ * each chunk is passed to vte_terminal_paste_text(), which brackets them
+ * separately. The clipboard text is kept as-is while the paste is in
+ * progress, without copying it. Older versions of VTE lack
+ * vte_terminal_paste_text(), and always paste in one go.
+ */
+#define PASTE_CHUNK_SIZE       (4 * 1024)
+#define PASTE_STREAM_THRESHOLD (64 * 1024)
+
+#define PASTE_BRACKET_START "\033[200~"
+#define PASTE_BRACKET_END   "\033[201~"
+
+static void
+window_update_paste_progress (WindowState *state)
+{
+    if (!state->paste_revealer)
+        return;
+
+    VteTerminal *vtterm = window_get_term_widget (state->window);
+    PasteState *paste = vtterm ? term_get_paste_state (vtterm) : NULL;
+    if (paste)
+        gtk_progress_bar_set_fraction (state->paste_progress,
+                                       (gdouble) paste->offset / paste->length);
+    gtk_revealer_set_reveal_child (state->paste_revealer, paste != NULL);
+}
+
+
+static void
+term_paste_stop (VteTerminal *vtterm)
+{
+    PasteState *paste = term_get_paste_state (vtterm);
+    if (!paste)
+        return;
+
+    g_debug ("Pasted %" G_GSIZE_FORMAT " of %" G_GSIZE_FORMAT " bytes in %.3f s",
+             paste->offset, paste->length,
+             (g_get_monotonic_time () - paste->start_time) /
+                (gdouble) G_TIME_SPAN_SECOND);
+
+    /* Cancelled pastes are ended as well, to leave the child in a sane state. */
+    if (paste->bracketed && vte_terminal_get_pty (vtterm))
+        vte_terminal_feed_child (vtterm, PASTE_BRACKET_END, strlen (PASTE_BRACKET_END));
+
+    g_object_set_data (G_OBJECT (vtterm), "dwt-paste", NULL);
+
+    GtkWidget *toplevel = gtk_widget_get_toplevel (GTK_WIDGET (vtterm));
+    WindowState *state = GTK_IS_WINDOW (toplevel)
+        ? window_get_state (GTK_WINDOW (toplevel)) : NULL;
+    if (state)
+        window_update_paste_progress (state);
+}
+
+
+#if VTE_CHECK_VERSION (0, 68, 0)
+/*
+ * Newlines are sent as CR, and other C0 and C1 control characters are
+ * dropped. The latter are encoded in UTF-8 as 0xC2 followed by 0x80-0x9F.
+ */
+static void
+paste_feed_chunk (VteTerminal *vtterm,
+                  const gchar *text,
+                  gsize        length)
+{
+    g_autoptr(GString) chunk = g_string_sized_new (length);
+    for (gsize i = 0; i < length; i++) {
+        const guchar c = text[i];
+        if (c == '\r' && i + 1 < length && text[i + 1] == '\n')
+            continue;
+        if (c == 0xC2 && i + 1 < length &&
+            (guchar) text[i + 1] >= 0x80 && (guchar) text[i + 1] <= 0x9F) {
+            i++;
+            continue;
+        }
+        if (c == '\n' || c == '\r')
+            g_string_append_c (chunk, '\r');
+        else if (c == '\t' || (c >= 0x20 && c != 0x7F))
+            g_string_append_c (chunk, c);
+    }
+    vte_terminal_feed_child (vtterm, chunk->str, chunk->len);
+}
+
+
+static gboolean
+paste_pty_writable (gint         fd,
+                    GIOCondition condition,
+                    gpointer     userdata)
+{
+    VteTerminal *vtterm = userdata;
+    PasteState *paste = term_get_paste_state (vtterm);
+
+    if (!(condition & G_IO_OUT)) {
+        paste->source_id = 0;
+        term_paste_stop (vtterm);
+        return G_SOURCE_REMOVE;
+    }
+
+    /* Do not split UTF-8 sequences, nor CR+LF pairs. */
+    gsize end = MIN (paste->offset + PASTE_CHUNK_SIZE, paste->length);
+    while (end < paste->length && (paste->text[end] & 0xC0) == 0x80)
+        end++;
+    if (end < paste->length && paste->text[end] == '\n')
+        end++;
+
+    if (paste->feed_child) {
+        paste_feed_chunk (vtterm, paste->text + paste->offset, end - paste->offset);
+    } else {
+        /* The text is owned by the paste, terminate the chunk in place. */
+        const gchar saved = paste->text[end];
+        paste->text[end] = '\0';
+        vte_terminal_paste_text (vtterm, paste->text + paste->offset);
+        paste->text[end] = saved;
+    }
+    paste->offset = end;
+
+    if (paste->offset < paste->length) {
+        GtkWidget *toplevel = gtk_widget_get_toplevel (GTK_WIDGET (vtterm));
+        WindowState *state = GTK_IS_WINDOW (toplevel)
+            ? window_get_state (GTK_WINDOW (toplevel)) : NULL;
+        if (state && state->paste_progress && window_get_term_widget (state->window) == vtterm)
+            gtk_progress_bar_set_fraction (state->paste_progress,
+                                           (gdouble) paste->offset / paste->length);
+        return G_SOURCE_CONTINUE;
+    }
+
+    paste->source_id = 0;
+    term_paste_stop (vtterm);
+    return G_SOURCE_REMOVE;
+}
+
+
+/* Takes ownership of the text. */
+static void
+term_paste_start (VteTerminal *vtterm,
+                  gchar       *text,
+                  gsize        length)
+{
+    term_paste_stop (vtterm);
+
+    VtePty *pty = vte_terminal_get_pty (vtterm);
+    if (!pty) {
+        g_free (text);
+        return;
+    }
+
+    const gint bracketed = term_get_bracketed_paste (vtterm);
+
+    PasteState *paste = g_new0 (PasteState, 1);
+    paste->text = text;
+    paste->length = length;
+    paste->start_time = g_get_monotonic_time ();
+    paste->feed_child = (bracketed >= 0);
+    paste->bracketed = (bracketed > 0);
+    if (paste->bracketed)
+        vte_terminal_feed_child (vtterm, PASTE_BRACKET_START, strlen (PASTE_BRACKET_START));
+
+    paste->source_id = g_unix_fd_add_full (G_PRIORITY_DEFAULT_IDLE,
+                                           vte_pty_get_fd (pty),
+                                           G_IO_OUT | G_IO_ERR | G_IO_HUP,
+                                           paste_pty_writable,
+                                           vtterm,
+                                           NULL);
+    g_object_set_data_full (G_OBJECT (vtterm), "dwt-paste",
+                            paste, paste_state_free);
+
+    GtkWidget *toplevel = gtk_widget_get_toplevel (GTK_WIDGET (vtterm));
+    if (GTK_IS_WINDOW (toplevel))
+        window_update_paste_progress (window_get_state (GTK_WINDOW (toplevel)));
+}
+
+
+/* Takes ownership of the text. */
+static void
+term_paste_take (VteTerminal *vtterm,
+                 gchar       *text)
+{
+    /* The terminal may have been closed meanwhile. */
+    GtkWidget *toplevel = gtk_widget_get_toplevel (GTK_WIDGET (vtterm));
+    WindowState *state = GTK_IS_WINDOW (toplevel)
+        ? window_get_state (GTK_WINDOW (toplevel)) : NULL;
+    if (!state) {
+        g_free (text);
+        return;
+    }
+
+    const gsize length = strlen (text);
+    if (length < PASTE_STREAM_THRESHOLD) {
+        vte_terminal_paste_text (vtterm, text);
+        g_free (text);
+    } else {
+        term_paste_start (vtterm, text, length);
+    }
+}
+
+
+static void
+paste_text_received (GtkClipboard *clipboard,
+                     const gchar  *text,
+                     gpointer      userdata)
+{
+    VteTerminal *vtterm = VTE_TERMINAL (userdata);
+    if (text)
+        term_paste_take (vtterm, g_strdup (text));
+    g_object_unref (vtterm);
+}
+
+
+/*
+ * GTK frees the text passed to gtk_clipboard_request_text() callbacks, so
+ * UTF-8 contents are requested instead, and the text converted from them
+ * is kept. Clipboard owners which do not offer UTF-8 are handled by
+ * gtk_clipboard_request_text(), which tries other text targets.
+ */
+static void
+paste_contents_received (GtkClipboard     *clipboard,
+                         GtkSelectionData *selection_data,
+                         gpointer          userdata)
+{
+    VteTerminal *vtterm = VTE_TERMINAL (userdata);
+    gchar *text = (gchar*) gtk_selection_data_get_text (selection_data);
+    if (text) {
+        term_paste_take (vtterm, text);
+        g_object_unref (vtterm);
+    } else {
+        gtk_clipboard_request_text (clipboard, paste_text_received, vtterm);
+    }
+}
+#endif /* VTE_CHECK_VERSION (0, 68, 0) */
+
+
+/*
+ * Terminals normally read the output of their child process directly.
+ * When the "background-input-budget" setting is non-zero, children run on
+ * PTYs of their own instead, and their output is relayed to the terminals
+ * (see dwt-relay.c). The relay for the current terminal of the focused
+ * window runs with the default priority and without limits, while the
+ * rest only get to process the budget on each main loop iteration, and
+ * only when there are no pending events or redraws. This keeps a window
+ * running e.g. "yes" in the background from delaying the focused one.
+ * Changes to the setting are applied to existing relays, but terminals
+ * spawned while it was zero have none, and keep reading directly.
+ *
+ * Terminals started with --record also use a relay, which passes a copy
+ * of the output of the child to the recorder (see dwt-cast.c), and so do
+ * terminals with a session log. Relayed output is also counted, for the
+ * command history (see term_shell_postexec()), and scanned for changes of
+ * the bracketed paste mode (see term_relay_scan_modes()).
+ */
+typedef enum {
+    MODE_SCAN_GROUND,
+    MODE_SCAN_ESCAPE,
+    MODE_SCAN_CSI,
+    MODE_SCAN_PRIVATE,
+    MODE_SCAN_SOFT_RESET,
+} ModeScanState;
+
+typedef struct {
+    VtePty        *pty;
+    DwtRelay      *relay;
+    DwtCastWriter *recorder;
+    DwtLog        *log;
+    guint64        output_bytes;
+    glong          columns;
+    glong          rows;
+    ModeScanState  mode_scan;
+    guint          mode_param;
+    gboolean       mode_matched;
+    gboolean       bracketed_paste;
+    gboolean       saved_bracketed_paste;
+} TermRelayState;
+
+
+static void
+term_relay_state_free (gpointer userdata)
+{
+    TermRelayState *relay_state = userdata;
+    dwt_relay_free (relay_state->relay);
+    g_clear_pointer (&relay_state->recorder, dwt_cast_writer_free);
+    g_clear_pointer (&relay_state->log, dwt_log_free);
+    g_object_unref (relay_state->pty);
+    g_free (relay_state);
+}
+
+
+static inline TermRelayState*
+term_get_relay_state (VteTerminal *vtterm)
+{
+    return g_object_get_data (G_OBJECT (vtterm), "dwt-relay-state");
+}
+
+
+static void
+window_update_relay_budgets (WindowState *state)
+{
+    g_autoptr(DgSettingsSnapshot) settings = dwt_settings_get_snapshot ();
+    const guint budget = dwt_settings_get_background_input_budget (settings);
+    const gboolean focused = window_state_is_focused (state);
+    const gint current = gtk_notebook_get_current_page (state->notebook);
+    const gint n_pages = gtk_notebook_get_n_pages (state->notebook);
+
+    for (gint i = 0; i < n_pages; i++) {
+        VteTerminal *vtterm =
+            VTE_TERMINAL (gtk_notebook_get_nth_page (state->notebook, i));
+        TermRelayState *relay_state = term_get_relay_state (vtterm);
+        if (!relay_state)
+            continue;
+
+        if ((focused && i == current) || !budget)
+            dwt_relay_set_budget (relay_state->relay, G_PRIORITY_DEFAULT, 0);
+        else
+            dwt_relay_set_budget (relay_state->relay, G_PRIORITY_DEFAULT_IDLE,
+                                  budget * 1024);
+    }
+}
+
+
+static void
+background_input_budget_notified (GObject    *settings,
+                                  GParamSpec *pspec,
+                                  gpointer    userdata)
+{
+    for (GList *item = gtk_application_get_windows (GTK_APPLICATION (userdata));
+         item; item = g_list_next (item)) {
+        WindowState *state = window_get_state (GTK_WINDOW (item->data));
+        if (state)
+            window_update_relay_budgets (state);
+    }
+}
+
+
+static void
+term_relay_size_allocated (GtkWidget      *widget,
+                           GdkRectangle   *allocation,
+                           TermRelayState *relay_state)
+{
+    /* The terminal only resizes its own PTY, pass the size along. */
+    VteTerminal *vtterm = VTE_TERMINAL (widget);
+    const glong columns = vte_terminal_get_column_count (vtterm);
+    const glong rows = vte_terminal_get_row_count (vtterm);
+    vte_pty_set_size (relay_state->pty, rows, columns, NULL);
+
+    if (relay_state->recorder &&
+        (columns != relay_state->columns || rows != relay_state->rows))
+        dwt_cast_writer_resize (relay_state->recorder, columns, rows);
+    relay_state->columns = columns;
+    relay_state->rows = rows;
+}
+
+
+/* Bytes of output from the child so far, or -1 if not relayed. */
+static gint64
+term_get_output_bytes (VteTerminal *vtterm)
+{
+    TermRelayState *relay_state = term_get_relay_state (vtterm);
+    return relay_state ? (gint64) relay_state->output_bytes : -1;
+}
+
+
+#if VTE_CHECK_VERSION (0, 68, 0)
+/* Whether the child enabled bracketed paste, or -1 if not relayed. */
+static gint
+term_get_bracketed_paste (VteTerminal *vtterm)
+{
+    TermRelayState *relay_state = term_get_relay_state (vtterm);
+    return relay_state ? relay_state->bracketed_paste : -1;
+}
+#endif /* VTE_CHECK_VERSION (0, 68, 0) */
+
+
+/*
+ * Tracks the bracketed paste mode, which is set and reset with DECSET and
+ * DECRST 2004 (possibly among other modes, as in "ESC [ ? 1049 ; 2004 h"),
+ * saved and restored with XTSAVE and XTRESTORE, and turned off by both
+ * soft (DECSTR) and hard (RIS) resets. Sequences may be split across
+ * reads, so the state of the scanner is kept between them.
+ */
+static void
+term_relay_scan_modes (TermRelayState *relay_state,
+                       const gchar    *data,
+                       gsize           length)
+{
+    for (gsize i = 0; i < length; i++) {
+        const guchar c = data[i];
+
+        if (relay_state->mode_scan == MODE_SCAN_GROUND) {
+            const gchar *escape = memchr (data + i, '\033', length - i);
+            if (!escape)
+                return;
+            i = escape - data;
+            relay_state->mode_scan = MODE_SCAN_ESCAPE;
+            continue;
+        }
+        if (c == '\033') {
+            relay_state->mode_scan = MODE_SCAN_ESCAPE;
+            continue;
+        }
+
+        switch (relay_state->mode_scan) {
+            case MODE_SCAN_ESCAPE:
+                if (c == '[') {
+                    relay_state->mode_scan = MODE_SCAN_CSI;
+                    continue;
+                }
+                if (c == 'c')
+                    relay_state->bracketed_paste = FALSE;
+                break;
+            case MODE_SCAN_CSI:
+                if (c == '?') {
+                    relay_state->mode_param = 0;
+                    relay_state->mode_matched = FALSE;
+                    relay_state->mode_scan = MODE_SCAN_PRIVATE;
+                    continue;
+                }
+                if (c == '!') {
+                    relay_state->mode_scan = MODE_SCAN_SOFT_RESET;
+                    continue;
+                }
+                break;
+            case MODE_SCAN_PRIVATE:
+                if (g_ascii_isdigit (c)) {
+                    relay_state->mode_param =
+                        MIN (relay_state->mode_param * 10 + (c - '0'), 100000);
+                    continue;
+                }
+                if (relay_state->mode_param == 2004)
+                    relay_state->mode_matched = TRUE;
+                if (c == ';') {
+                    relay_state->mode_param = 0;
+                    continue;
+                }
+                if (relay_state->mode_matched) {
+                    switch (c) {
+                        case 'h':
+                            relay_state->bracketed_paste = TRUE;
+                            break;
+                        case 'l':
+                            relay_state->bracketed_paste = FALSE;
+                            break;
+                        case 's':
+                            relay_state->saved_bracketed_paste =
+                                relay_state->bracketed_paste;
+                            break;
+                        case 'r':
+                            relay_state->bracketed_paste =
+                                relay_state->saved_bracketed_paste;
+                            break;
+                    }
+                }
+                break;
+            case MODE_SCAN_SOFT_RESET:
+                if (c == 'p')
+                    relay_state->bracketed_paste = FALSE;
+                break;
+            case MODE_SCAN_GROUND:
+                g_assert_not_reached ();
+        }
+        relay_state->mode_scan = MODE_SCAN_GROUND;
+    }
+}
+
+
+static void
+term_relay_output (const gchar *data,
+                   gsize        length,
+                   gpointer     userdata)
+{
+    TermRelayState *relay_state = userdata;
+    relay_state->output_bytes += length;
+    term_relay_scan_modes (relay_state, data, length);
+    if (relay_state->recorder)
+        dwt_cast_writer_output (relay_state->recorder, data, length);
+    if (relay_state->log)
+        dwt_log_write (relay_state->log, data, length);
+}
+
+
+/*
+ * Render throttling: VTE repaints as fast as output arrives, and windows
+ * tailing busy logs in the background compete with the focused one for
+ * the main thread. Updates of unfocused windows are frozen, and a timer
+ * thaws them at the "unfocused-frame-rate", letting at most one frame
+ * through each time. Updates of windows which are minimized or fully
+ * obscured are frozen until they are shown again, when the accumulated
+ * changes are painted at once. Terminals keep reading from their PTYs
+ * meanwhile, only drawing is deferred.
+ */
+static void
+window_freeze_updates (WindowState *state,
+                       gboolean     freeze)
+{
+    GdkWindow *gdk_window = gtk_widget_get_window (GTK_WIDGET (state->window));
+    if (!gdk_window || state->updates_frozen == freeze)
+        return;
+
+    if (freeze)
+        gdk_window_freeze_updates (gdk_window);
+    else
+        gdk_window_thaw_updates (gdk_window);
+    state->updates_frozen = freeze;
+}
+
+
+static gboolean
+throttle_timeout (gpointer userdata)
+{
+    /* Let one frame through, after-paint freezes updates again. */
+    window_freeze_updates ((WindowState*) userdata, FALSE);
+    return G_SOURCE_CONTINUE;
+}
+
+
+static void
+throttle_after_paint (GdkFrameClock *frame_clock,
+                      WindowState   *state)
+{
+    if (state->throttle_id)
+        window_freeze_updates (state, TRUE);
+}
+
+
+static void
+window_update_throttling (WindowState *state)
+{
+    g_autoptr(DgSettingsSnapshot) settings = dwt_settings_get_snapshot ();
+    const guint frame_rate = dwt_settings_get_unfocused_frame_rate (settings);
+    const gboolean throttle_hidden = dwt_settings_get_throttle_hidden (settings);
+    const gboolean focused = window_state_is_focused (state);
+    const gboolean hidden = throttle_hidden && (state->iconified || state->obscured);
+    const gboolean limited = !focused && !hidden && frame_rate > 0;
+
+    if (state->throttle_id && (!limited || frame_rate != state->throttle_rate)) {
+        g_source_remove (state->throttle_id);
+        state->throttle_id = 0;
+    }
+    if (limited && !state->throttle_id) {
+        state->throttle_id = g_timeout_add (1000 / MIN (frame_rate, 1000),
+                                            throttle_timeout,
+                                            state);
+        state->throttle_rate = frame_rate;
+    }
+
+    window_freeze_updates (state, hidden || limited);
+}
+
+
+static gboolean
+window_state_changed (GtkWidget           *widget,
+                      GdkEventWindowState *event,
+                      WindowState         *state)
+{
+    state->iconified = (event->new_window_state &
+                     (GDK_WINDOW_STATE_ICONIFIED | GDK_WINDOW_STATE_WITHDRAWN)) != 0;
+    window_update_throttling (state);
+    return FALSE;
+}
+
+
+static gboolean
+window_visibility_changed (GtkWidget          *widget,
+                           GdkEventVisibility *event,
+                           WindowState        *state)
+{
+    state->obscured = (event->state == GDK_VISIBILITY_FULLY_OBSCURED);
+    window_update_throttling (state);
+    return FALSE;
+}
+
+
+static void
+window_throttle_realized (GtkWidget   *widget,
+                          WindowState *state)
+{
+    state->frame_clock = g_object_ref (gtk_widget_get_frame_clock (widget));
+    state->after_paint_id = g_signal_connect (G_OBJECT (state->frame_clock),
+                                              "after-paint",
+                                              G_CALLBACK (throttle_after_paint),
+                                              state);
+    window_update_throttling (state);
+}
+
+
+static void
+window_throttle_unrealized (GtkWidget   *widget,
+                            WindowState *state)
+{
+    if (state->throttle_id) {
+        g_source_remove (state->throttle_id);
+        state->throttle_id = 0;
+    }
+    window_freeze_updates (state, FALSE);
+    if (state->frame_clock) {
+        g_signal_handler_disconnect (state->frame_clock, state->after_paint_id);
+        g_clear_object (&state->frame_clock);
+    }
+}
+
+
+static void
+window_update_cursor_color (GtkWindow *window)
+{
+    VteTerminal *vtterm = window_get_term_widget (window);
+    if (vtterm)
+        vte_terminal_set_color_cursor (vtterm,
+                                       gtk_window_has_toplevel_focus (window)
+                                           ? &cursor_active
+                                           : &cursor_inactive);
+}
+
+
+static void
+window_has_toplevel_focus_notified (GObject     *object,
+                                    GParamSpec  *pspec,
+                                    WindowState *state)
+{
+    window_update_cursor_color (GTK_WINDOW (object));
+    window_update_throttling (state);
+    window_update_relay_budgets (state);
+
+    if (gtk_window_has_toplevel_focus (GTK_WINDOW (object))) {
+        window_restore_current_term (GTK_WINDOW (object));
+
+        /* Clear the _URGENT hint when the window gets activated. */
+        gtk_window_set_urgency_hint (GTK_WINDOW (object), FALSE);
+
+        if (state->bell_revealer &&
+            gtk_revealer_get_reveal_child (state->bell_revealer) &&
+            !state->bell_timeout_id)
+        {
+            state->bell_timeout_id = g_timeout_add_seconds (3, bell_revealer_timeout, state);
+        }
+    }
+}
+
+
+static void
+notebook_page_switched (GtkNotebook *notebook,
+                        GtkWidget   *page,
+                        guint        page_num,
+                        WindowState *state)
+{
+    VteTerminal *vtterm = VTE_TERMINAL (page);
+    term_restore (vtterm, term_get_hibernate_state (vtterm));
+    term_update_geometry_hints (vtterm, state->window);
+    window_update_cursor_color (state->window);
+    window_update_relay_budgets (state);
+    window_update_paste_progress (state);
+    resource_timer_wake ();
+    gtk_widget_grab_focus (page);
+
+    /* The tab label always has the last title applied to the terminal. */
+    TermNotifyState *notify_state = term_get_notify_state (vtterm);
+    window_set_title (state, gtk_label_get_label (notify_state->tab_label));
+}
+
+
+static void
+notebook_pages_changed (GtkNotebook *notebook,
+                        GtkWidget   *page,
+                        guint        page_num,
+                        gpointer     userdata)
+{
+    /* Tabs are only shown when there is more than one terminal. */
+    gtk_notebook_set_show_tabs (notebook, gtk_notebook_get_n_pages (notebook) > 1);
+}
+
+
+static void
+window_remove_terminal (GtkWindow   *window,
+                        VteTerminal *vtterm)
+{
+    WindowState *state = window_get_state (window);
+    if (!state)
+        return;
+
+    if (state->popover &&
+        gtk_popover_get_relative_to (GTK_POPOVER (state->popover)) == GTK_WIDGET (vtterm))
+    {
+        gtk_widget_destroy (state->popover);
+        state->popover = NULL;
+    }
+
+    term_paste_stop (vtterm);
+
+    gtk_widget_destroy (GTK_WIDGET (vtterm));
+
+    /*
+     * Destroy the window when its last terminal is gone. Note that this
+     * will fire the "delete-event" signal, and its handler already takes
+     * care of deregistering the window in the GtkApplication.
+     */
+    if (gtk_notebook_get_n_pages (state->notebook) == 0)
+        gtk_window_close (window);
+}
+
+
+/*
+ * Headless mode: with --headless, a single terminal is created in an
+ * offscreen window, set up with the same code as regular ones, so that
+ * measurements reflect how they behave. Input may be sent to the child
+ * once it is spawned, and when it exits the text of the scrollback and
+ * the screen is written out, optionally with an image of the window, and
+ * timing statistics are printed, e.g.:
+ *
+ *   dwt --headless --headless-png=out.png -e 'ls --color /usr/bin'
+ *
+ * Nothing is shown, but GTK still needs a display: without an X11 or
+ * Wayland server, the Broadway backend may be used instead.
+ */
+typedef struct {
+    GtkWindow     *window;
+    VteTerminal   *vtterm;
+    gchar         *input_path;
+    gchar         *output_path;
+    gchar         *png_path;
+    GdkFrameClock *frame_clock;
+    gulong         after_paint_id;
+    gint64         start_time;
+    gint64         spawn_time;
+    gint64         first_output_time;
+    gint64         exit_time;
+    gint64         draw_start;
+    gint64         draw_total;
+    gint64         draw_max;
+    guint          n_draws;
+    guint          n_changes;
+} HeadlessRun;
+
+
+static void
+headless_run_free (gpointer userdata)
+{
+    HeadlessRun *run = userdata;
+    if (run->frame_clock) {
+        g_signal_handler_disconnect (run->frame_clock, run->after_paint_id);
+        g_object_unref (run->frame_clock);
+    }
+    g_free (run->input_path);
+    g_free (run->output_path);
+    g_free (run->png_path);
+    g_free (run);
+}
+
+
+static HeadlessRun*
+window_get_headless_run (GtkWindow *window)
+{
+    return g_object_get_data (G_OBJECT (window), "dwt-headless-run");
+}
+
+
+static gboolean
+term_headless_draw_started (GtkWidget   *widget,
+                            cairo_t     *cr,
+                            HeadlessRun *run)
+{
+    run->draw_start = g_get_monotonic_time ();
+    return FALSE;
+}
+
+
+static gboolean
+term_headless_draw_finished (GtkWidget   *widget,
+                             cairo_t     *cr,
+                             HeadlessRun *run)
+{
+    const gint64 elapsed = g_get_monotonic_time () - run->draw_start;
+    run->draw_total += elapsed;
+    run->draw_max = MAX (run->draw_max, elapsed);
+    run->n_draws++;
+    return FALSE;
+}
+
+
+static void
+term_headless_contents_changed (VteTerminal *vtterm,
+                                HeadlessRun *run)
+{
+    if (!run->n_changes++)
+        run->first_output_time = g_get_monotonic_time ();
+}
+
+
+static void
+headless_child_spawned (HeadlessRun *run,
+                        VteTerminal *vtterm)
+{
+    run->spawn_time = g_get_monotonic_time ();
+    if (!run->input_path)
+        return;
+
+    g_autoptr(GError) error = NULL;
+    g_autofree gchar *input = NULL;
+    gsize input_length;
+    if (g_file_get_contents (run->input_path, &input, &input_length, &error))
+        vte_terminal_feed_child (vtterm, input, input_length);
+    else
+        g_printerr ("Cannot read input: %s\n", error->message);
+}
+
+
+static void
+headless_write_text (HeadlessRun *run)
+{
+    GtkAdjustment *vadjustment =
+        gtk_scrollable_get_vadjustment (GTK_SCROLLABLE (run->vtterm));
+    g_autofree gchar *text =
+        vte_terminal_get_text_range (run->vtterm,
+                                     gtk_adjustment_get_lower (vadjustment), 0,
+                                     gtk_adjustment_get_upper (vadjustment) - 1,
+                                     vte_terminal_get_column_count (run->vtterm) - 1,
+                                     NULL, NULL, NULL);
+    if (!text)
+        return;
+
+    g_autoptr(GError) error = NULL;
+    if (!run->output_path)
+        g_print ("%s", text);
+    else if (!g_file_set_contents (run->output_path, text, -1, &error))
+        g_printerr ("Cannot write output: %s\n", error->message);
+}
+
+
+static void
+headless_write_png (HeadlessRun *run)
+{
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GdkPixbuf) pixbuf =
+        gtk_offscreen_window_get_pixbuf (GTK_OFFSCREEN_WINDOW (run->window));
+    if (!pixbuf)
+        g_printerr ("Cannot save image: window was not painted\n");
+    else if (!gdk_pixbuf_save (pixbuf, run->png_path, "png", &error, NULL))
+        g_printerr ("Cannot save image: %s\n", error->message);
+}
+
+
+static void
+headless_report (HeadlessRun *run)
+{
+    const gint64 start = run->start_time;
+    g_printerr ("Headless run:\n"
+                "  spawn         %9.2f ms\n"
+                "  first output  %9.2f ms\n"
+                "  child exit    %9.2f ms\n"
+                "  changes       %9u\n"
+                "  frames        %9u\n"
+                "  frame average %9.2f ms\n"
+                "  frame max     %9.2f ms\n",
+                run->spawn_time ? (run->spawn_time - start) / 1000.0 : 0.0,
+                run->n_changes ? (run->first_output_time - start) / 1000.0 : 0.0,
+                (run->exit_time - start) / 1000.0,
+                run->n_changes,
+                run->n_draws,
+                run->n_draws ? run->draw_total / 1000.0 / run->n_draws : 0.0,
+                run->draw_max / 1000.0);
+
+    const TermNotifyState *notify_state = term_get_notify_state (run->vtterm);
+    g_printerr ("  title/bell    %9u\n"
+                "  applied       %9u\n"
+                "  apply total   %9.2f ms\n"
+                "  apply delay   %9.2f ms max\n",
+                notify_state->n_changes,
+                notify_state->n_applied,
+                notify_state->apply_total / 1000.0,
+                notify_state->delay_max / 1000.0);
+}
+
+
+static void
+headless_finish (HeadlessRun *run)
+{
+    headless_write_text (run);
+    if (run->png_path)
+        headless_write_png (run);
+    headless_report (run);
+    window_remove_terminal (run->window, run->vtterm);
+}
+
+
+static void
+headless_after_paint (GdkFrameClock *frame_clock,
+                      HeadlessRun   *run)
+{
+    g_signal_handler_disconnect (run->frame_clock, run->after_paint_id);
+    g_clear_object (&run->frame_clock);
+    headless_finish (run);
+}
+
+
+static void
+headless_child_exited (HeadlessRun *run,
+                       VteTerminal *vtterm,
+                       gint         status)
+{
+    run->exit_time = g_get_monotonic_time ();
+    run->vtterm = vtterm;
+    headless_exit_code = status ? EXIT_FAILURE : EXIT_SUCCESS;
+
+    /* Make sure that the image has the last output. */
+    GdkFrameClock *frame_clock = run->png_path
+        ? gtk_widget_get_frame_clock (GTK_WIDGET (run->window)) : NULL;
+    if (!frame_clock) {
+        headless_finish (run);
+        return;
+    }
+
+    run->frame_clock = g_object_ref (frame_clock);
+    run->after_paint_id =
+        g_signal_connect (G_OBJECT (frame_clock), "after-paint",
+                          G_CALLBACK (headless_after_paint), run);
+    gtk_widget_queue_draw (GTK_WIDGET (vtterm));
+}
+
+
+static void
+window_start_headless_run (GtkWindow    *window,
+                           GVariantDict *options)
+{
+    HeadlessRun *run = g_new0 (HeadlessRun, 1);
+    run->window = window;
+    run->start_time = g_get_monotonic_time ();
+    g_variant_dict_lookup (options, "headless-input", "s", &run->input_path);
+    g_variant_dict_lookup (options, "headless-output", "s", &run->output_path);
+    g_variant_dict_lookup (options, "headless-png", "s", &run->png_path);
+    g_object_set_data_full (G_OBJECT (window), "dwt-headless-run",
+                            run, headless_run_free);
+    window_get_state (window)->headless = TRUE;
+}
+
+
+/*
+ * Replay: with --replay, the terminal of the new window does not run a
+ * command. Instead, the output saved in a recording (see --record, and
+ * dwt-cast.c) is fed to it at the original speed, scaled by the factor
+ * given with --replay-speed, or as fast as possible if it is zero. Once
+ * everything has been shown, throughput and frame statistics are printed
+ * and the terminal is closed as if a child had exited. Together with
+ * --headless this allows comparing builds using the same input, e.g.:
+ *
+ *   dwt --headless --replay=build.cast --replay-speed=0
+ *
+ * Frame times go from the moment output is fed to the terminal until the
+ * predicted presentation time of the frame painted after it. Output should
+ * be shown at most two refresh intervals later (the frame in progress when
+ * it arrives, and the next one); each interval over that counts as one
+ * dropped frame.
+ */
+#define REPLAY_CHUNK_SIZE (64 * 1024)
+#define REPLAY_MAX_FRAMES 8192
+
+typedef struct {
+    VteTerminal   *vtterm;
+    DwtCast       *cast;
+    gdouble        speed;
+    guint          next;
+    guint          source_id;
+    GdkFrameClock *frame_clock;
+    gulong         after_paint_id;
+    gint64         start_time;
+    gint64         fed_time;
+    guint64        bytes;
+    gint64         frame_times[REPLAY_MAX_FRAMES];
+    guint          n_frame_times;
+    guint          n_frames;
+    guint          n_dropped;
+} TermReplay;
+
+
+static void
+term_replay_free (gpointer userdata)
+{
+    TermReplay *replay = userdata;
+    if (replay->source_id)
+        g_source_remove (replay->source_id);
+    if (replay->frame_clock) {
+        g_signal_handler_disconnect (replay->frame_clock, replay->after_paint_id);
+        g_object_unref (replay->frame_clock);
+    }
+    g_clear_pointer (&replay->cast, dwt_cast_free);
+    g_free (replay);
+}
+
+
+static void
+replay_report (TermReplay *replay)
+{
+    const gdouble elapsed =
+        (g_get_monotonic_time () - replay->start_time) / (gdouble) G_TIME_SPAN_SECOND;
+    g_printerr ("Replayed %u events, %" G_GUINT64_FORMAT " bytes in %.3f s (%.2f MiB/s)\n",
+                replay->cast->events->len, replay->bytes, elapsed,
+                elapsed > 0 ? replay->bytes / elapsed / (1024 * 1024) : 0.0);
+
+    if (!replay->n_frame_times) {
+        g_printerr ("No frames painted\n");
+        return;
+    }
+
+    gint64 *samples = g_new (gint64, replay->n_frame_times);
+    memcpy (samples, replay->frame_times, replay->n_frame_times * sizeof (gint64));
+    qsort (samples, replay->n_frame_times, sizeof (gint64), compare_gint64);
+
+#define PERCENTILE(p) (samples[(replay->n_frame_times - 1) * (p) / 100] / 1000.0)
+    g_printerr ("Output to frame time, %u frames:\n"
+                "  p50 %7.2f ms\n"
+                "  p95 %7.2f ms\n"
+                "  p99 %7.2f ms\n"
+                "  max %7.2f ms\n"
+                "  dropped frames %u\n",
+                replay->n_frames,
+                PERCENTILE (50), PERCENTILE (95), PERCENTILE (99), PERCENTILE (100),
+                replay->n_dropped);
+#undef PERCENTILE
+    g_free (samples);
+}
+
+
+/* The replay may be freed as a result, it must not be used afterwards. */
+static void
+replay_finish (TermReplay *replay)
+{
+    replay_report (replay);
+    g_signal_emit_by_name (replay->vtterm, "child-exited", 0);
+}
+
+
+static void
+replay_feed (TermReplay         *replay,
+             const DwtCastEvent *event)
+{
+    if (event->type == DWT_CAST_RESIZE) {
+        gchar *end = NULL;
+        const guint64 columns = g_ascii_strtoull (event->data, &end, 10);
+        if (end && *end == 'x') {
+            const guint64 rows = g_ascii_strtoull (end + 1, NULL, 10);
+            if (columns && rows)
+                vte_terminal_set_size (replay->vtterm, columns, rows);
+        }
+        return;
+    }
+
+    vte_terminal_feed (replay->vtterm, event->data, event->length);
+    replay->bytes += event->length;
+    if (!replay->fed_time)
+        replay->fed_time = g_get_monotonic_time ();
+}
+
+
+static gboolean
+replay_tick (gpointer userdata)
+{
+    TermReplay *replay = userdata;
+    const GArray *events = replay->cast->events;
+    const gint64 now = g_get_monotonic_time ();
+    gsize fed = 0;
+
+    while (replay->next < events->len) {
+        const DwtCastEvent *event = &g_array_index (events, DwtCastEvent, replay->next);
+        if (replay->speed > 0) {
+            const gint64 due = replay->start_time +
+                event->time * G_TIME_SPAN_SECOND / replay->speed;
+            if (due > now) {
+                replay->source_id = g_timeout_add (MAX ((due - now) / 1000, 1),
+                                                   replay_tick, replay);
+                return G_SOURCE_REMOVE;
+            }
+        } else if (fed >= REPLAY_CHUNK_SIZE) {
+            /* Let the terminal process and paint what was fed so far. */
+            return G_SOURCE_CONTINUE;
+        }
+        replay_feed (replay, event);
+        fed += event->length;
+        replay->next++;
+    }
+
+    /* Otherwise, finish once the last output has been painted. */
+    replay->source_id = 0;
+    if (!replay->fed_time || !replay->frame_clock)
+        replay_finish (replay);
+    return G_SOURCE_REMOVE;
+}
+
+
+static void
+replay_after_paint (GdkFrameClock *frame_clock,
+                    TermReplay    *replay)
+{
+    if (!replay->fed_time)
+        return;
+
+    GdkFrameTimings *timings = gdk_frame_clock_get_current_timings (frame_clock);
+    gint64 presentation_time = timings
+        ? gdk_frame_timings_get_predicted_presentation_time (timings) : 0;
+    if (!presentation_time)
+        presentation_time = g_get_monotonic_time ();
+    gint64 refresh_interval = timings
+        ? gdk_frame_timings_get_refresh_interval (timings) : 0;
+    if (!refresh_interval)
+        refresh_interval = G_TIME_SPAN_SECOND / 60;
+
+    const gint64 frame_time = presentation_time - replay->fed_time;
+    if (replay->n_frame_times < REPLAY_MAX_FRAMES)
+        replay->frame_times[replay->n_frame_times++] = frame_time;
+    if (frame_time > 2 * refresh_interval)
+        replay->n_dropped += frame_time / refresh_interval - 2;
+    replay->n_frames++;
+    replay->fed_time = 0;
+
+    if (replay->next == replay->cast->events->len && !replay->source_id)
+        replay_finish (replay);
+}
+
+
+static void
+replay_loaded (GObject      *source,
+               GAsyncResult *result,
+               gpointer      userdata)
+{
+    VteTerminal *vtterm = userdata;
+    TermReplay *replay = g_object_get_data (G_OBJECT (vtterm), "dwt-replay");
+
+    /* The terminal may have been closed meanwhile. */
+    if (!replay || !gtk_widget_get_parent (GTK_WIDGET (vtterm))) {
+        g_object_unref (vtterm);
+        return;
+    }
+
+    g_autoptr(GError) error = NULL;
+    g_autofree gchar *contents = NULL;
+    gsize length = 0;
+    if (g_file_load_contents_finish (G_FILE (source), result, &contents, &length, NULL, &error))
+        replay->cast = dwt_cast_parse (contents, length, &error);
+    if (!replay->cast) {
+        g_printerr ("Cannot replay recording: %s\n", error->message);
+        g_signal_emit_by_name (vtterm, "child-exited", 1);
+        g_object_unref (vtterm);
+        return;
+    }
+
+    vte_terminal_set_size (vtterm, replay->cast->width, replay->cast->height);
+
+    GdkFrameClock *frame_clock = gtk_widget_get_frame_clock (GTK_WIDGET (vtterm));
+    if (frame_clock) {
+        replay->frame_clock = g_object_ref (frame_clock);
+        replay->after_paint_id =
+            g_signal_connect (G_OBJECT (frame_clock), "after-paint",
+                              G_CALLBACK (replay_after_paint), replay);
+    }
+
+    replay->start_time = g_get_monotonic_time ();
+    replay->source_id = g_idle_add (replay_tick, replay);
+    g_object_unref (vtterm);
+}
+
+
+static void
+term_start_replay (VteTerminal *vtterm,
+                   const gchar *path,
+                   gdouble      speed)
+{
+    TermReplay *replay = g_new0 (TermReplay, 1);
+    replay->vtterm = vtterm;
+    replay->speed = MAX (speed, 0.0);
+    g_object_set_data_full (G_OBJECT (vtterm), "dwt-replay",
+                            replay, term_replay_free);
+
+    g_autoptr(GFile) file = g_file_new_for_commandline_arg (path);
+    g_file_load_contents_async (file, NULL, replay_loaded, g_object_ref (vtterm));
+}
+
+
+static void
+term_child_exited (VteTerminal *vtterm,
+                   gint         status,
+                   gpointer     userdata)
+{
+    HeadlessRun *run = window_get_headless_run (GTK_WINDOW (userdata));
+    if (run)
+        headless_child_exited (run, vtterm, status);
+    else
+        window_remove_terminal (GTK_WINDOW (userdata), vtterm);
+}
+
+
+/*
+ * When the "restore-session" setting is enabled, the windows and the
+ * contents of their terminals are saved on exit (and periodically, in
+ * case of crashes) and restored the next time the program is started.
+ * Windows are recreated right away, and the saved scrollback is loaded in
+ * the background once they are shown, so restoring many windows does not
+ * wait for disk I/O. Each terminal starts its child process once the
+ * scrollback has been fed to it, so nothing the child writes at startup
+ * gets mixed with it.
+ *
+ * The session is a key file with one group per window and tab, plus a
+ * compressed snapshot of the contents of each terminal. Snapshots are
+ * only rewritten for terminals which have produced output since their
+ * last snapshot was taken. Text can only be obtained from VTE in the
+ * main thread, but compressing and writing it is done in a worker thread;
+ * only the final save on exit waits for it. The session is saved when
+ * the last window is closed, and not when the application exits without
+ * windows, which would leave an empty session.
+ */
+#define SESSION_SAVE_INTERVAL 60  /* seconds */
+#define SESSION_FILE_NAME     "session.ini"
+
+typedef struct {
+    gchar   *command;
+    gchar   *workdir;
+    gchar   *snapshot;
+    gint64   snapshot_time;
+    gint64   spawn_time;
+    gboolean restore_pending;
+    gchar  **pending_argv;  /* Child to spawn once the snapshot is fed. */
+    gchar  **pending_envv;
+    gchar   *pending_record;
+} TermSessionState;
+
+
+static guint session_timer_id = 0;
+static gboolean session_saved = FALSE;
+static gboolean session_save_running = FALSE;
+
+/* Saves may overlap on exit, older ones are skipped then. */
+static GMutex session_save_lock;
+static gint session_generation = 0;
+static gint session_generation_saved = 0;
+
+
+static void
+term_session_state_free (gpointer userdata)
+{
+    TermSessionState *state = userdata;
+    g_free (state->command);
+    g_free (state->workdir);
+    g_free (state->snapshot);
+    g_strfreev (state->pending_argv);
+    g_strfreev (state->pending_envv);
+    g_free (state->pending_record);
+    g_free (state);
+}
+
+
+static TermSessionState*
+term_get_session_state (VteTerminal *vtterm)
+{
+    return g_object_get_data (G_OBJECT (vtterm), "dwt-session-state");
+}
+
+
+static gchar*
+session_get_dir (void)
+{
+    return g_build_filename (g_get_user_data_dir (),
+                             g_get_prgname (),
+                             "session",
+                             NULL);
+}
+
+
+typedef struct {
+    gchar *name;
+    gchar *source;  /* File to copy, if set... */
+    gchar *text;    /* ...otherwise, text to save. */
+} SnapshotWrite;
+
+
+static void
+snapshot_write_free (gpointer userdata)
+{
+    SnapshotWrite *write = userdata;
+    g_free (write->name);
+    g_free (write->source);
+    g_free (write->text);
+    g_free (write);
+}
+
+
+typedef struct {
+    gint        generation;
+    gchar      *session_dir;
+    gchar      *keyfile_data;
+    gsize       keyfile_length;
+    GPtrArray  *writes;     /* SnapshotWrite */
+    GHashTable *snapshots;  /* Names of the snapshots in use. */
+} SessionSave;
+
+
+static void
+session_save_free (gpointer userdata)
+{
+    SessionSave *save = userdata;
+    g_free (save->session_dir);
+    g_free (save->keyfile_data);
+    g_ptr_array_unref (save->writes);
+    g_hash_table_unref (save->snapshots);
+    g_free (save);
+}
+
+
+/* Returns the snapshot to write, if it needs to be written at all. */
+static SnapshotWrite*
+term_save_snapshot (VteTerminal *vtterm,
+                    const gchar *session_dir)
+{
+    TermSessionState *state = term_get_session_state (vtterm);
+    TermHibernateState *hibernate_state = term_get_hibernate_state (vtterm);
+
+    /* Keep the previous snapshot if it is still to be loaded, or current. */
+    if (state->restore_pending ||
+        (state->snapshot && state->snapshot_time > hibernate_state->last_activity))
+        return NULL;
+
+    if (!state->snapshot) {
+        g_autofree gchar *path = g_build_filename (session_dir,
+                                                   "scrollback-XXXXXX",
+                                                   NULL);
+        gint fd = g_mkstemp (path);
+        if (fd == -1) {
+            g_warning ("Cannot create scrollback snapshot: %s", g_strerror (errno));
+            return NULL;
+        }
+        g_close (fd, NULL);
+        state->snapshot = g_path_get_basename (path);
+    }
+
+    /* Hibernated terminals already have their history in a file. */
+    SnapshotWrite *write = g_new0 (SnapshotWrite, 1);
+    write->name = g_strdup (state->snapshot);
+    if (hibernate_state->path)
+        write->source = g_strdup (hibernate_state->path);
+    else
+        write->text = term_get_history (vtterm, TRUE);
+
+    /* Reset if writing fails, see session_save_done(). */
+    state->snapshot_time = g_get_monotonic_time ();
+    return write;
+}
+
+
+static SnapshotWrite*
+term_save_session (VteTerminal *vtterm,
+                   GKeyFile    *keyfile,
+                   const gchar *group,
+                   const gchar *session_dir)
+{
+    TermSessionState *state = term_get_session_state (vtterm);
+
+    g_key_file_set_string (keyfile, group, "title",
+                           gtk_label_get_text (term_get_notify_state (vtterm)->tab_label));
+
+    const char *cwd_uri = vte_terminal_get_current_directory_uri (vtterm);
+    g_autofree gchar *cwd = cwd_uri ? g_filename_from_uri (cwd_uri, NULL, NULL) : NULL;
+    if (cwd || state->workdir)
+        g_key_file_set_string (keyfile, group, "workdir", cwd ? cwd : state->workdir);
+
+    if (state->command)
+        g_key_file_set_string (keyfile, group, "command", state->command);
+
+    const gchar *theme = g_object_get_data (G_OBJECT (vtterm), "dwt-theme");
+    if (theme)
+        g_key_file_set_string (keyfile, group, "theme", theme);
+
+    const PangoFontDescription *fontd = vte_terminal_get_font (vtterm);
+    if (fontd) {
+        g_autofree gchar *font = pango_font_description_to_string (fontd);
+        g_key_file_set_string (keyfile, group, "font", font);
+    }
+
+    SnapshotWrite *write = term_save_snapshot (vtterm, session_dir);
+    if (state->snapshot)
+        g_key_file_set_string (keyfile, group, "scrollback", state->snapshot);
+    return write;
+}
+
+
+static void
+session_save_thread (GTask        *task,
+                     gpointer      source_object,
+                     gpointer      task_data,
+                     GCancellable *cancellable)
+{
+    SessionSave *save = task_data;
+    GPtrArray *failed = g_ptr_array_new_with_free_func (g_free);
+
+    g_mutex_lock (&session_save_lock);
+    if (save->generation < session_generation_saved) {
+        g_mutex_unlock (&session_save_lock);
+        g_task_return_pointer (task, failed, (GDestroyNotify) g_ptr_array_unref);
+        return;
+    }
+
+    for (guint i = 0; i < save->writes->len; i++) {
+        SnapshotWrite *write = g_ptr_array_index (save->writes, i);
+        g_autofree gchar *path = g_build_filename (save->session_dir, write->name, NULL);
+        g_autoptr(GFile) file = g_file_new_for_path (path);
+        g_autoptr(GError) error = NULL;
+        gboolean saved;
+
+        if (write->source) {
+            g_autoptr(GFile) source = g_file_new_for_path (write->source);
+            saved = g_file_copy (source, file, G_FILE_COPY_OVERWRITE,
+                                 NULL, NULL, NULL, &error);
+        } else {
+            saved = save_history (file, write->text, NULL, &error);
+        }
+        if (!saved) {
+            g_warning ("Cannot save scrollback snapshot: %s", error->message);
+            g_ptr_array_add (failed, g_strdup (write->name));
+        }
+    }
+
+    g_autoptr(GError) error = NULL;
+    g_autofree gchar *path = g_build_filename (save->session_dir, SESSION_FILE_NAME, NULL);
+    if (g_file_set_contents (path, save->keyfile_data, save->keyfile_length, &error)) {
+        /* Remove snapshots of terminals which are gone. */
+        g_autoptr(GDir) dir = g_dir_open (save->session_dir, 0, NULL);
+        const gchar *name;
+        while (dir && (name = g_dir_read_name (dir))) {
+            if (g_str_has_prefix (name, "scrollback-") &&
+                !g_hash_table_contains (save->snapshots, name))
+            {
+                g_autofree gchar *snapshot_path =
+                    g_build_filename (save->session_dir, name, NULL);
+                g_unlink (snapshot_path);
+            }
+        }
+    } else {
+        g_warning ("Cannot save session: %s", error->message);
+    }
+
+    session_generation_saved = save->generation;
+    g_mutex_unlock (&session_save_lock);
+    g_task_return_pointer (task, failed, (GDestroyNotify) g_ptr_array_unref);
+}
+
+
+static void
+session_save_done (GObject      *source_object,
+                   GAsyncResult *result,
+                   gpointer      userdata)
+{
+    session_save_running = FALSE;
+
+    /* Snapshots which could not be written are written again next time. */
+    g_autoptr(GPtrArray) failed = g_task_propagate_pointer (G_TASK (result), NULL);
+    if (!failed || !failed->len)
+        return;
+
+    for (GList *item = gtk_application_get_windows (GTK_APPLICATION (source_object));
+         item; item = g_list_next (item))
+    {
+        WindowState *window_state = window_get_state (GTK_WINDOW (item->data));
+        if (!window_state)
+            continue;
+
+        const gint n_pages = gtk_notebook_get_n_pages (window_state->notebook);
+        for (gint i = 0; i < n_pages; i++) {
+            VteTerminal *vtterm =
+                VTE_TERMINAL (gtk_notebook_get_nth_page (window_state->notebook, i));
+            TermSessionState *state = term_get_session_state (vtterm);
+            for (guint j = 0; state->snapshot && j < failed->len; j++)
+                if (g_str_equal (state->snapshot, g_ptr_array_index (failed, j)))
+                    state->snapshot_time = 0;
+        }
+    }
+}
+
+
+static void
+session_save (GtkApplication *application,
+              gboolean        wait)
+{
+    /* Without windows the session would be empty, keep the last one. */
+    if (!gtk_application_get_windows (application))
+        return;
+
+    /* Periodic saves are skipped while the previous one is in progress. */
+    if (session_save_running && !wait)
+        return;
+
+    g_autofree gchar *session_dir = session_get_dir ();
+    if (g_mkdir_with_parents (session_dir, 0700) == -1) {
+        g_warning ("Cannot create directory '%s': %s",
+                   session_dir, g_strerror (errno));
+        return;
+    }
+
+    g_autoptr(GKeyFile) keyfile = g_key_file_new ();
+    SessionSave *save = g_new0 (SessionSave, 1);
+    save->generation = ++session_generation;
+    save->writes = g_ptr_array_new_with_free_func (snapshot_write_free);
+    save->snapshots = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    gint n_windows = 0;
+
+    for (GList *item = gtk_application_get_windows (application);
+         item; item = g_list_next (item))
+    {
+        WindowState *window_state = window_get_state (GTK_WINDOW (item->data));
+        if (!window_state)
+            continue;
+
+        g_autofree gchar *group = g_strdup_printf ("window%d", n_windows++);
+        gint width, height;
+        gtk_window_get_size (window_state->window, &width, &height);
+        g_key_file_set_integer (keyfile, group, "width", width);
+        g_key_file_set_integer (keyfile, group, "height", height);
+        g_key_file_set_boolean (keyfile, group, "maximized",
+                                gtk_window_is_maximized (window_state->window));
+
+        const gint n_pages = gtk_notebook_get_n_pages (window_state->notebook);
+        g_key_file_set_integer (keyfile, group, "tabs", n_pages);
+        g_key_file_set_integer (keyfile, group, "current",
+                                gtk_notebook_get_current_page (window_state->notebook));
+
+        for (gint i = 0; i < n_pages; i++) {
+            VteTerminal *vtterm =
+                VTE_TERMINAL (gtk_notebook_get_nth_page (window_state->notebook, i));
+            g_autofree gchar *tab_group = g_strdup_printf ("%s-tab%d", group, i);
+            SnapshotWrite *write = term_save_session (vtterm, keyfile, tab_group, session_dir);
+            if (write)
+                g_ptr_array_add (save->writes, write);
+
+            TermSessionState *state = term_get_session_state (vtterm);
+            if (state->snapshot)
+                g_hash_table_add (save->snapshots, g_strdup (state->snapshot));
+        }
+    }
+    g_key_file_set_integer (keyfile, "session", "windows", n_windows);
+
+    save->session_dir = g_steal_pointer (&session_dir);
+    save->keyfile_data = g_key_file_to_data (keyfile, &save->keyfile_length, NULL);
+
+    g_autoptr(GTask) task = g_task_new (application, NULL, session_save_done, NULL);
+    g_task_set_task_data (task, save, session_save_free);
+    if (wait) {
+        g_task_run_in_thread_sync (task, session_save_thread);
+        g_autoptr(GPtrArray) failed = g_task_propagate_pointer (task, NULL);
+    } else {
+        session_save_running = TRUE;
+        g_task_run_in_thread (task, session_save_thread);
+    }
+}
+
+
+static gboolean
+session_timer_tick (gpointer userdata)
+{
+    g_autoptr(DgSettingsSnapshot) settings = dwt_settings_get_snapshot ();
+    if (dwt_settings_get_restore_session (settings))
+        session_save (GTK_APPLICATION (userdata), FALSE);
+    return TRUE;
+}
+
+
+static gboolean
+window_deleted (GtkWidget *widget,
+                GdkEvent  *event,
+                gpointer   userdata)
+{
+    /* Save the session while the last window still has its terminals. */
+    GtkApplication *application = gtk_window_get_application (GTK_WINDOW (widget));
+    WindowState *state = window_get_state (GTK_WINDOW (widget));
+    g_autoptr(DgSettingsSnapshot) settings = dwt_settings_get_snapshot ();
+    if (application && state && !headless_mode && dwt_settings_get_restore_session (settings) &&
+        !g_list_next (gtk_application_get_windows (application)) &&
+        gtk_notebook_get_n_pages (state->notebook) > 0)
+    {
+        session_save (application, TRUE);
+        session_saved = TRUE;
+    }
+    return FALSE;
+}
+
+
+static void
+load_snapshot_thread (GTask        *task,
+                      gpointer      source_object,
+                      gpointer      task_data,
+                      GCancellable *cancellable)
+{
+    g_autoptr(GFile) file = g_file_new_for_path (task_data);
+    g_autoptr(GError) error = NULL;
+    GBytes *history = load_history (file, cancellable, &error);
+    if (history)
+        g_task_return_pointer (task, history, (GDestroyNotify) g_bytes_unref);
+    else
+        g_task_return_error (task, g_steal_pointer (&error));
+}
+
+
+static void
+term_snapshot_loaded (GObject      *source_object,
+                      GAsyncResult *result,
+                      gpointer      userdata)
+{
+    VteTerminal *vtterm = VTE_TERMINAL (source_object);
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GBytes) history = g_task_propagate_pointer (G_TASK (result), &error);
+
+    /* The terminal may have been closed while loading. */
+    if (!gtk_widget_get_parent (GTK_WIDGET (vtterm)))
+        return;
+
+    TermSessionState *state = term_get_session_state (vtterm);
+    state->restore_pending = FALSE;
+
+    if (history) {
+        /* Trailing empty lines of the screen are left out. */
+        gsize length = 0;
+        const gchar *data = g_bytes_get_data (history, &length);
+        while (length && data[length - 1] == '\n')
+            length--;
+        term_feed_text (vtterm, data, length, FALSE);
+        vte_terminal_feed (vtterm, "\r\n", 2);
+    } else {
+        g_warning ("Cannot load scrollback snapshot: %s", error->message);
+        g_clear_pointer (&state->snapshot, g_free);
+    }
+    term_spawn_pending (vtterm);
+}
+
+
+static gboolean
+window_load_snapshots (gpointer userdata)
+{
+    WindowState *window_state = window_get_state (GTK_WINDOW (userdata));
+    if (!window_state)
+        return G_SOURCE_REMOVE;
+
+    g_autofree gchar *session_dir = session_get_dir ();
+    const gint n_pages = gtk_notebook_get_n_pages (window_state->notebook);
+    for (gint i = 0; i < n_pages; i++) {
+        VteTerminal *vtterm =
+            VTE_TERMINAL (gtk_notebook_get_nth_page (window_state->notebook, i));
+        TermSessionState *state = term_get_session_state (vtterm);
+        if (!state->restore_pending)
+            continue;
+
+        g_autoptr(GTask) task = g_task_new (vtterm, NULL, term_snapshot_loaded, NULL);
+        g_task_set_task_data (task,
+                              g_build_filename (session_dir, state->snapshot, NULL),
+                              g_free);
+        g_task_run_in_thread (task, load_snapshot_thread);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+
+static gboolean
+window_first_frame_tick (GtkWidget     *widget,
+                         GdkFrameClock *frame_clock,
+                         gpointer       userdata)
+{
+    /* The idle source runs once this first frame has been painted. */
+    g_idle_add_full (G_PRIORITY_LOW,
+                     window_load_snapshots,
+                     g_object_ref (widget),
+                     g_object_unref);
+    return G_SOURCE_REMOVE;
+}
+
+
+static void
+session_restore_window (GtkApplication *application,
+                        GKeyFile       *keyfile,
+                        const gchar    *group)
+{
+    const gint n_tabs = g_key_file_get_integer (keyfile, group, "tabs", NULL);
+    GtkWindow *window = NULL;
+
+    for (gint i = 0; i < n_tabs; i++) {
+        g_autofree gchar *tab_group = g_strdup_printf ("%s-tab%d", group, i);
+        g_autoptr(GVariantDict) options = g_variant_dict_new (NULL);
+
+        /* The "snapshot" option is only set here, see window_add_terminal(). */
+        g_autofree gchar *snapshot =
+            g_key_file_get_string (keyfile, tab_group, "scrollback", NULL);
+        if (snapshot)
+            g_variant_dict_insert (options, "snapshot", "s", snapshot);
+
+        static const gchar *const keys[] = {
+            "title", "workdir", "command", "theme", "font",
+        };
+        for (guint j = 0; j < G_N_ELEMENTS (keys); j++) {
+            g_autofree gchar *value =
+                g_key_file_get_string (keyfile, tab_group, keys[j], NULL);
+            if (value)
+                g_variant_dict_insert (options, keys[j], "s", value);
+        }
+
+        if (window) {
+            window_add_terminal (window, options);
+        } else {
+            GtkWidget *widget = create_new_window (application, options);
+            if (widget)
+                window = GTK_WINDOW (widget);
+        }
+    }
+
+    if (!window)
+        return;
+
+    gtk_notebook_set_current_page (window_get_state (window)->notebook,
+                                   g_key_file_get_integer (keyfile, group, "current", NULL));
+
+    const gint width = g_key_file_get_integer (keyfile, group, "width", NULL);
+    const gint height = g_key_file_get_integer (keyfile, group, "height", NULL);
+    if (width > 0 && height > 0)
+        gtk_window_resize (window, width, height);
+    if (g_key_file_get_boolean (keyfile, group, "maximized", NULL))
+        gtk_window_maximize (window);
+
+    gtk_widget_add_tick_callback (GTK_WIDGET (window),
+                                  window_first_frame_tick,
+                                  NULL, NULL);
+}
+
+
+static gint
+session_restore (GtkApplication *application)
+{
+    g_autofree gchar *session_dir = session_get_dir ();
+    g_autofree gchar *path = g_build_filename (session_dir, SESSION_FILE_NAME, NULL);
+    g_autoptr(GKeyFile) keyfile = g_key_file_new ();
+    g_autoptr(GError) error = NULL;
+
+    if (!g_key_file_load_from_file (keyfile, path, G_KEY_FILE_NONE, &error)) {
+        if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+            g_warning ("Cannot load session: %s", error->message);
+        return 0;
+    }
+
+    const gint n_windows = g_key_file_get_integer (keyfile, "session", "windows", NULL);
+    for (gint i = 0; i < n_windows; i++) {
+        g_autofree gchar *group = g_strdup_printf ("window%d", i);
+        session_restore_window (application, keyfile, group);
+    }
+    return g_list_length (gtk_application_get_windows (application));
+}
+
+
+static void
+font_size_action_ativated (GSimpleAction *action,
+                           GVariant      *parameter,
+                           gpointer       userdata)
+{
+    VteTerminal *vtterm = window_get_term_widget (GTK_WINDOW (userdata));
+    const gint modifier = g_variant_get_int32 (parameter);
+
+    const PangoFontDescription *fontd = vte_terminal_get_font (vtterm);
+    gint old_size = pango_font_description_get_size (fontd);
+    if (default_font_size == 0)
+      default_font_size = old_size;
+    PangoFontDescription *new_fontd;
+    gint new_size;
+
+    switch (modifier) {
+      case 0:
+        old_size = default_font_size;
+        /* fall-through */
+      case 1:
+      case -1:
+        new_size = old_size + modifier * PANGO_SCALE;
+        new_fontd = pango_font_description_copy_static (fontd);
+        pango_font_description_set_size (new_fontd, new_size);
+        vte_terminal_set_font (vtterm, new_fontd);
+        break;
+
+      default:
+        g_printerr ("%s: invalid modifier '%i'", __func__, modifier);
+        return;
+    }
+
+    pango_font_description_free (new_fontd);
 }
 
 
@@ -664,135 +4811,716 @@ paste_action_activated (GSimpleAction *action,
                         GVariant      *parameter,
                         gpointer       userdata)
 {
-    vte_terminal_paste_clipboard (window_get_term_widget (GTK_WINDOW (userdata)));
+    VteTerminal *vtterm = window_get_term_widget (GTK_WINDOW (userdata));
+#if VTE_CHECK_VERSION (0, 68, 0)
+    gtk_clipboard_request_contents (gtk_widget_get_clipboard (GTK_WIDGET (vtterm),
+                                                              GDK_SELECTION_CLIPBOARD),
+                                    gdk_atom_intern_static_string ("UTF8_STRING"),
+                                    paste_contents_received,
+                                    g_object_ref (vtterm));
+#else
+    vte_terminal_paste_clipboard (vtterm);
+#endif /* VTE_CHECK_VERSION (0, 68, 0) */
+}
+
+
+static void
+paste_cancel_action_activated (GSimpleAction *action,
+                               GVariant      *parameter,
+                               gpointer       userdata)
+{
+    VteTerminal *vtterm = window_get_term_widget (GTK_WINDOW (userdata));
+    if (vtterm)
+        term_paste_stop (vtterm);
+}
+
+
+#if VTE_CHECK_VERSION (0, 70, 0)
+/*
+ * Copied text is extracted from the terminal once, and the same buffers
+ * are then handed to applications requesting either the CLIPBOARD or the
+ * PRIMARY selection, for as long as dwt owns any of them. VTE has no API
+ * to get the bounds of the selection, and only tells that it changed once
+ * it is gone, so the text cannot be extracted later on demand. Owning the
+ * PRIMARY selection makes VTE drop its own selection in the terminal.
+ */
+enum {
+    COPY_TARGET_TEXT,
+    COPY_TARGET_HTML,
+};
+
+typedef struct {
+    guint   ref_count;
+    GBytes *text;
+    GBytes *html;
+} CopyData;
+
+
+static void
+copy_data_unref (gpointer userdata)
+{
+    CopyData *data = userdata;
+    if (--data->ref_count)
+        return;
+
+    g_bytes_unref (data->text);
+    g_clear_pointer (&data->html, g_bytes_unref);
+    g_free (data);
+}
+
+
+static void
+copy_data_get (GtkClipboard     *clipboard,
+               GtkSelectionData *selection_data,
+               guint             info,
+               gpointer          userdata)
+{
+    CopyData *data = userdata;
+    gsize length = 0;
+
+    switch (info) {
+        case COPY_TARGET_TEXT: {
+            const gchar *text = g_bytes_get_data (data->text, &length);
+            gtk_selection_data_set_text (selection_data, text, length);
+            break;
+        }
+        case COPY_TARGET_HTML: {
+            if (!data->html)
+                break;
+            const guchar *html = g_bytes_get_data (data->html, &length);
+            gtk_selection_data_set (selection_data,
+                                    gdk_atom_intern_static_string ("text/html"),
+                                    8, html, length);
+            break;
+        }
+    }
+}
+
+
+static void
+term_copy_selection (VteTerminal *vtterm)
+{
+    if (!vte_terminal_get_has_selection (vtterm))
+        return;
+
+    const gint64 start = g_get_monotonic_time ();
+    CopyData *data = g_new0 (CopyData, 1);
+    gchar *text = vte_terminal_get_text_selected (vtterm, VTE_FORMAT_TEXT);
+    data->text = text ? g_bytes_new_take (text, strlen (text)) : g_bytes_new (NULL, 0);
+    g_autoptr(DgSettingsSnapshot) settings = dwt_settings_get_snapshot ();
+    if (dwt_settings_get_copy_html (settings)) {
+        gchar *html = vte_terminal_get_text_selected (vtterm, VTE_FORMAT_HTML);
+        if (html)
+            data->html = g_bytes_new_take (html, strlen (html));
+    }
+    g_debug ("Extracted %" G_GSIZE_FORMAT " bytes of text%s in %.3f ms",
+             g_bytes_get_size (data->text), data->html ? " and HTML" : "",
+             (g_get_monotonic_time () - start) / 1000.0);
+
+    g_autoptr(GtkTargetList) target_list = gtk_target_list_new (NULL, 0);
+    gtk_target_list_add_text_targets (target_list, COPY_TARGET_TEXT);
+    if (data->html)
+        gtk_target_list_add (target_list,
+                             gdk_atom_intern_static_string ("text/html"),
+                             0, COPY_TARGET_HTML);
+    gint n_targets = 0;
+    GtkTargetEntry *targets = gtk_target_table_new_from_list (target_list, &n_targets);
+
+    /* Each selection releases its reference when it is owned by someone else. */
+    const GdkAtom selections[] = { GDK_SELECTION_CLIPBOARD, GDK_SELECTION_PRIMARY };
+    data->ref_count = 1;
+    for (guint i = 0; i < G_N_ELEMENTS (selections); i++) {
+        GtkClipboard *clipboard = gtk_widget_get_clipboard (GTK_WIDGET (vtterm),
+                                                            selections[i]);
+        data->ref_count++;
+        if (!gtk_clipboard_set_with_data (clipboard, targets, n_targets,
+                                          copy_data_get, copy_data_unref, data))
+            copy_data_unref (data);
+    }
+    gtk_target_table_free (targets, n_targets);
+    copy_data_unref (data);
+}
+#endif /* VTE_CHECK_VERSION (0, 70, 0) */
+
+
+static void
+copy_action_activated (GSimpleAction *action,
+                       GVariant      *parameter,
+                       gpointer       userdata)
+{
+    VteTerminal *vtterm = window_get_term_widget (GTK_WINDOW (userdata));
+#if VTE_CHECK_VERSION (0, 70, 0)
+    term_copy_selection (vtterm);
+#else
+    vte_terminal_copy_clipboard_format (vtterm, VTE_FORMAT_TEXT);
+    vte_terminal_copy_primary (vtterm);
+#endif /* VTE_CHECK_VERSION (0, 70, 0) */
+}
+
+
+static void
+new_terminal_action_activated (GSimpleAction *action,
+                               GVariant      *parameter,
+                               gpointer       userdata)
+{
+    create_new_window (GTK_APPLICATION (userdata), NULL);
+}
+
+
+static void
+about_action_activated (GSimpleAction *action,
+                       GVariant      *parameter,
+                       gpointer       userdata)
+{
+    static const gchar* authors[] = {
+        "Adrián Pérez de Castro",
+        NULL,
+    };
+
+    gtk_show_about_dialog (NULL,
+                           "authors",        authors,
+                           "logo-icon-name", "terminal",
+                           "license-type",   GTK_LICENSE_MIT_X11,
+                           "comments",       "A sleek terminal emulator",
+                           "website",        "https://github.com/aperezdc/dwt",
+                           NULL);
+}
+
+
+static void
+quit_action_activated (GSimpleAction *action,
+                       GVariant      *parameter,
+                       gpointer       userdata)
+{
+    g_autoptr(DgSettingsSnapshot) settings = dwt_settings_get_snapshot ();
+    if (dwt_settings_get_restore_session (settings)) {
+        session_save (GTK_APPLICATION (userdata), TRUE);
+        session_saved = TRUE;
+    }
+    g_application_quit (G_APPLICATION (userdata));
+}
+
+
+static void
+copy_url_action_activated (GSimpleAction *action,
+                           GVariant      *parameter,
+                           gpointer       userdata)
+{
+    gtk_clipboard_set_text (gtk_clipboard_get (GDK_SELECTION_PRIMARY),
+                            last_match_text, -1);
+    gtk_clipboard_set_text (gtk_clipboard_get (GDK_SELECTION_CLIPBOARD),
+                            last_match_text, -1);
+
+    g_free (last_match_text);
+    last_match_text = NULL;
+}
+
+
+static void
+open_url_action_activated (GSimpleAction *action,
+                           GVariant      *parameter,
+                           gpointer       userdata)
+{
+    g_autoptr(GError) error = NULL;
+    if (!gtk_show_uri_on_window (GTK_WINDOW (userdata),
+                                 last_match_text,
+                                 GDK_CURRENT_TIME,
+                                 &error))
+        g_warning ("Could not open URL: %s", error->message);
+    g_clear_pointer (&last_match_text, g_free);
+}
+
+
+static void
+new_tab_action_activated (GSimpleAction *action,
+                          GVariant      *parameter,
+                          gpointer       userdata)
+{
+    /* Start the new terminal in the directory of the current one. */
+    g_autoptr(GVariantDict) options = g_variant_dict_new (NULL);
+    VteTerminal *vtterm = window_get_term_widget (GTK_WINDOW (userdata));
+    const char *cwd_uri = vtterm ? vte_terminal_get_current_directory_uri (vtterm) : NULL;
+    if (cwd_uri) {
+        g_autofree char *cwd = g_filename_from_uri (cwd_uri, NULL, NULL);
+        if (cwd)
+            g_variant_dict_insert (options, "workdir", "s", cwd);
+    }
+    window_add_terminal (GTK_WINDOW (userdata), options);
+}
+
+
+static void
+switch_tab_action_activated (GSimpleAction *action,
+                             GVariant      *parameter,
+                             gpointer       userdata)
+{
+    GtkNotebook *notebook = window_get_state (GTK_WINDOW (userdata))->notebook;
+    const gint n_pages = gtk_notebook_get_n_pages (notebook);
+    const gint page = gtk_notebook_get_current_page (notebook) +
+        g_variant_get_int32 (parameter);
+    gtk_notebook_set_current_page (notebook, (page + n_pages) % n_pages);
+}
+
+
+static void
+find_action_activated (GSimpleAction *action,
+                       GVariant      *parameter,
+                       gpointer       userdata)
+{
+    WindowState *state = window_get_state (GTK_WINDOW (userdata));
+    gtk_search_bar_set_search_mode (state->search_bar, TRUE);
+    gtk_widget_grab_focus (GTK_WIDGET (state->search_entry));
+}
+
+
+static void
+find_match_action_activated (GSimpleAction *action,
+                             GVariant      *parameter,
+                             gpointer       userdata)
+{
+    window_search_find (window_get_state (GTK_WINDOW (userdata)),
+                        g_variant_get_boolean (parameter));
+}
+
+
+static void
+find_wrap_around_changed (GSimpleAction *action,
+                          GVariant      *value,
+                          gpointer       userdata)
+{
+    window_get_state (GTK_WINDOW (userdata))->search_wrap_around =
+        g_variant_get_boolean (value);
+    g_simple_action_set_state (action, value);
+}
+
+
+static void
+command_history_action_activated (GSimpleAction *action,
+                                  GVariant      *parameter,
+                                  gpointer       userdata)
+{
+    WindowState *state = window_get_state (GTK_WINDOW (userdata));
+    VteTerminal *vtterm = window_get_term_widget (GTK_WINDOW (userdata));
+    if (!vtterm)
+        return;
+
+    g_autofree gchar *text = window_format_commands (state);
+    GtkWidget *label = gtk_label_new (text);
+    gtk_label_set_selectable (GTK_LABEL (label), TRUE);
+    gtk_label_set_xalign (GTK_LABEL (label), 0.0);
+
+    PangoAttrList *attrs = pango_attr_list_new ();
+    pango_attr_list_insert (attrs, pango_attr_family_new ("monospace"));
+    gtk_label_set_attributes (GTK_LABEL (label), attrs);
+    pango_attr_list_unref (attrs);
+
+    GtkWidget *scrolled = gtk_scrolled_window_new (NULL, NULL);
+    gtk_scrolled_window_set_propagate_natural_width (GTK_SCROLLED_WINDOW (scrolled), TRUE);
+    gtk_scrolled_window_set_propagate_natural_height (GTK_SCROLLED_WINDOW (scrolled), TRUE);
+    gtk_scrolled_window_set_max_content_height (GTK_SCROLLED_WINDOW (scrolled), 400);
+    gtk_container_add (GTK_CONTAINER (scrolled), label);
+    gtk_widget_show_all (scrolled);
+
+    GtkWidget *popover = gtk_popover_new (GTK_WIDGET (vtterm));
+    gtk_container_add (GTK_CONTAINER (popover), scrolled);
+    g_signal_connect (G_OBJECT (popover), "closed",
+                      G_CALLBACK (image_popover_closed), NULL);
+    gtk_popover_popup (GTK_POPOVER (popover));
+}
+
+
+static const GActionEntry win_actions[] = {
+    { "font-reset",       font_size_action_ativated,         "i",     "0", NULL },
+    { "font-bigger",      font_size_action_ativated,         "i",     "1", NULL },
+    { "font-smaller",     font_size_action_ativated,         "i",    "-1", NULL },
+    { "copy",             copy_action_activated,            NULL,    NULL, NULL },
+    { "paste",            paste_action_activated,           NULL,    NULL, NULL },
+    { "paste-cancel",     paste_cancel_action_activated,    NULL,    NULL, NULL },
+    { "copy-url",         copy_url_action_activated,        NULL,    NULL, NULL },
+    { "open-url",         open_url_action_activated,        NULL,    NULL, NULL },
+    { "new-tab",          new_tab_action_activated,         NULL,    NULL, NULL },
+    { "next-tab",         switch_tab_action_activated,       "i",     "1", NULL },
+    { "previous-tab",     switch_tab_action_activated,       "i",    "-1", NULL },
+    { "find",             find_action_activated,            NULL,    NULL, NULL },
+    { "find-next",        find_match_action_activated,       "b", "false", NULL },
+    { "find-previous",    find_match_action_activated,       "b",  "true", NULL },
+    { "find-wrap-around", NULL,                             NULL,  "true", find_wrap_around_changed },
+    { "command-history",  command_history_action_activated, NULL,    NULL, NULL },
+};
+
+static const GActionEntry app_actions[] = {
+    { "new-terminal", new_terminal_action_activated, NULL, NULL, NULL },
+    { "about",        about_action_activated,        NULL, NULL, NULL },
+    { "quit",         quit_action_activated,         NULL, NULL, NULL },
+};
+
+
+/* Resident set size of the process, in KiB. */
+static guint64
+get_resident_size (void)
+{
+    g_autofree gchar *status = NULL;
+    if (!g_file_get_contents ("/proc/self/status", &status, NULL, NULL))
+        return 0;
+
+    const gchar *line = strstr (status, "\nVmRSS:");
+    return line ? g_ascii_strtoull (line + strlen ("\nVmRSS:"), NULL, 10) : 0;
+}
+
+
+static void
+on_child_spawned (VteTerminal *vtterm,
+                  GPid pid, GError *error, void *userdata)
+{
+    if (pid == -1) {
+        // Error: report and close the terminal.
+        g_assert_nonnull (error);
+        window_remove_terminal (GTK_WINDOW (userdata), vtterm);
+        g_error ("Cannot spawn child process: %s", error->message);
+    } else {
+        g_assert_null (error);
+
+        g_object_set_data (G_OBJECT (vtterm), "dwt-child-pid", GINT_TO_POINTER (pid));
+        resource_timer_wake ();
+
+        TermSessionState *session_state = term_get_session_state (vtterm);
+        g_debug ("Child %d spawned in %.2f ms, resident set size %" G_GUINT64_FORMAT " KiB",
+                 pid,
+                 (g_get_monotonic_time () - session_state->spawn_time) / 1000.0,
+                 get_resident_size ());
+
+        HeadlessRun *headless_run = window_get_headless_run (GTK_WINDOW (userdata));
+        if (headless_run)
+            headless_child_spawned (headless_run, vtterm);
+    }
+}
+
+
+/*
+ * When the "spawn-helper" setting is enabled, children are started by a
+ * small helper process (see dwt-spawn.c), so spawning does not get slower
+ * as this process grows. Those children are not ours, and VTE cannot
+ * watch them: the helper reports when they exit instead, and the
+ * "child-exited" signal is emitted for their terminals here. If the
+ * helper is not running, children are spawned directly.
+ */
+static DwtSpawnHelper *spawn_helper = NULL;
+
+
+static void
+spawn_helper_child_exited (GPid     pid,
+                           gint     status,
+                           gpointer userdata)
+{
+    GList *windows = gtk_application_get_windows (GTK_APPLICATION (userdata));
+    for (GList *item = windows; item; item = g_list_next (item)) {
+        WindowState *state = window_get_state (GTK_WINDOW (item->data));
+        if (!state)
+            continue;
+
+        const gint n_pages = gtk_notebook_get_n_pages (state->notebook);
+        for (gint i = 0; i < n_pages; i++) {
+            GObject *vtterm = G_OBJECT (gtk_notebook_get_nth_page (state->notebook, i));
+            if (GPOINTER_TO_INT (g_object_get_data (vtterm, "dwt-helper-pid")) == pid) {
+                g_signal_emit_by_name (vtterm, "child-exited", status);
+                return;
+            }
+        }
+    }
+}
+
+
+static void
+spawn_helper_start (GtkApplication *application)
+{
+    g_autoptr(DgSettingsSnapshot) settings = dwt_settings_get_snapshot ();
+    if (!dwt_settings_get_spawn_helper (settings))
+        return;
+
+    g_autoptr(GError) error = NULL;
+    spawn_helper = dwt_spawn_helper_new ("/proc/self/exe",
+                                         spawn_helper_child_exited,
+                                         application,
+                                         &error);
+    if (!spawn_helper)
+        g_warning ("Cannot start spawn helper: %s", error->message);
 }
 
 
+typedef struct {
+    VteTerminal *vtterm;
+    VtePty      *pty;
+    gchar       *workdir;
+    gchar      **argv;
+    gchar      **envv;
+} SpawnData;
+
+
 static void
-copy_action_activated (GSimpleAction *action,
-                       GVariant      *parameter,
-                       gpointer       userdata)
+spawn_data_free (gpointer userdata)
 {
-    VteTerminal *vtterm = window_get_term_widget (GTK_WINDOW (userdata));
-    vte_terminal_copy_clipboard_format (vtterm, VTE_FORMAT_TEXT);
-    vte_terminal_copy_primary (vtterm);
+    SpawnData *data = userdata;
+    g_object_unref (data->vtterm);
+    g_object_unref (data->pty);
+    g_free (data->workdir);
+    g_strfreev (data->argv);
+    g_strfreev (data->envv);
+    g_free (data);
 }
 
 
 static void
-new_terminal_action_activated (GSimpleAction *action,
-                               GVariant      *parameter,
-                               gpointer       userdata)
+term_pty_child_spawned (GObject      *source,
+                        GAsyncResult *result,
+                        gpointer      userdata)
 {
-    create_new_window (GTK_APPLICATION (userdata), NULL);
+    VteTerminal *vtterm = VTE_TERMINAL (userdata);
+    GError *error = NULL;
+    GPid pid = -1;
+
+    if (!vte_pty_spawn_finish (VTE_PTY (source), result, &pid, &error))
+        pid = -1;
+
+    /* The terminal may have been closed meanwhile. */
+    GtkWidget *toplevel = gtk_widget_get_toplevel (GTK_WIDGET (vtterm));
+    if (GTK_IS_WINDOW (toplevel)) {
+        if (pid != -1)
+            vte_terminal_watch_child (vtterm, pid);
+        on_child_spawned (vtterm, pid, error, toplevel);
+    }
+
+    g_clear_error (&error);
+    g_object_unref (vtterm);
 }
 
 
 static void
-about_action_activated (GSimpleAction *action,
-                       GVariant      *parameter,
-                       gpointer       userdata)
+term_helper_child_spawned (GPid          pid,
+                           const GError *error,
+                           gpointer      userdata)
 {
-    static const gchar* authors[] = {
-        "Adrián Pérez de Castro",
-        NULL,
-    };
+    SpawnData *data = userdata;
+
+    if (pid == -1 && !dwt_spawn_helper_is_running (spawn_helper)) {
+        /* The helper went away, try again without it. */
+        vte_pty_spawn_async (data->pty,
+                             data->workdir,
+                             data->argv,
+                             data->envv,
+                             G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                             NULL,
+                             NULL,
+                             NULL,
+                             -1,
+                             NULL,
+                             term_pty_child_spawned,
+                             g_object_ref (data->vtterm));
+        return;
+    }
 
-    gtk_show_about_dialog (NULL,
-                           "authors",        authors,
-                           "logo-icon-name", "terminal",
-                           "license-type",   GTK_LICENSE_MIT_X11,
-                           "comments",       "A sleek terminal emulator",
-                           "website",        "https://github.com/aperezdc/dwt",
-                           NULL);
+    GtkWidget *toplevel = gtk_widget_get_toplevel (GTK_WIDGET (data->vtterm));
+    if (GTK_IS_WINDOW (toplevel)) {
+        if (pid != -1)
+            g_object_set_data (G_OBJECT (data->vtterm), "dwt-helper-pid",
+                               GINT_TO_POINTER (pid));
+        on_child_spawned (data->vtterm, pid, (GError*) error, toplevel);
+    }
 }
 
 
-static void
-quit_action_activated (GSimpleAction *action,
-                       GVariant      *parameter,
-                       gpointer       userdata)
+/*
+ * Environment for children spawned without VTE, with the variables VTE
+ * sets itself when spawning (see __vte_pty_merge_environ() in vtepty.cc,
+ * unchanged from VTE 0.60 to 0.78). Keep in sync when VTE changes them.
+ */
+static gchar**
+term_child_environ (gchar      **envv,
+                    const gchar *workdir)
 {
-    g_application_quit (G_APPLICATION (userdata));
+    g_autofree gchar *vte_version =
+        g_strdup_printf ("%u", vte_get_major_version () * 10000 +
+                               vte_get_minor_version () * 100 +
+                               vte_get_micro_version ());
+    gchar **child_envv = g_strdupv (envv);
+    child_envv = g_environ_setenv (child_envv, "COLORTERM", "truecolor", TRUE);
+    child_envv = g_environ_setenv (child_envv, "VTE_VERSION", vte_version, TRUE);
+    child_envv = g_environ_setenv (child_envv, "TERM", "xterm-256color", TRUE);
+    if (workdir)
+        child_envv = g_environ_setenv (child_envv, "PWD", workdir, TRUE);
+    return child_envv;
 }
 
 
 static void
-copy_url_action_activated (GSimpleAction *action,
-                           GVariant      *parameter,
-                           gpointer       userdata)
+term_spawn_on_pty (VteTerminal *vtterm,
+                   VtePty      *pty,
+                   const gchar *workdir,
+                   gchar      **argv,
+                   gchar      **envv)
 {
-    gtk_clipboard_set_text (gtk_clipboard_get (GDK_SELECTION_PRIMARY),
-                            last_match_text, -1);
-    gtk_clipboard_set_text (gtk_clipboard_get (GDK_SELECTION_CLIPBOARD),
-                            last_match_text, -1);
+    if (spawn_helper && dwt_spawn_helper_is_running (spawn_helper)) {
+        SpawnData *data = g_new0 (SpawnData, 1);
+        data->vtterm = g_object_ref (vtterm);
+        data->pty = g_object_ref (pty);
+        data->workdir = g_strdup (workdir);
+        data->argv = g_strdupv (argv);
+        data->envv = g_strdupv (envv);
+
+        g_auto(GStrv) helper_envv = term_child_environ (envv, workdir);
+
+        g_autoptr(GError) error = NULL;
+        if (dwt_spawn_helper_spawn (spawn_helper,
+                                    vte_pty_get_fd (pty),
+                                    workdir,
+                                    argv,
+                                    helper_envv,
+                                    term_helper_child_spawned,
+                                    data,
+                                    spawn_data_free,
+                                    &error))
+            return;
+
+        g_warning ("Cannot use spawn helper: %s", error->message);
+        spawn_data_free (data);
+    }
 
-    g_free (last_match_text);
-    last_match_text = NULL;
+    vte_pty_spawn_async (pty,
+                         workdir,
+                         argv,
+                         envv,
+                         G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                         NULL,
+                         NULL,
+                         NULL,
+                         -1,
+                         NULL,
+                         term_pty_child_spawned,
+                         g_object_ref (vtterm));
 }
 
 
-static void
-open_url_action_activated (GSimpleAction *action,
-                           GVariant      *parameter,
-                           gpointer       userdata)
+static gboolean
+term_spawn_relayed (VteTerminal *vtterm,
+                    GtkWindow   *window,
+                    const gchar *workdir,
+                    gchar      **argv,
+                    gchar      **envv,
+                    const gchar *record_path)
 {
+    const gchar *log_directory = window_get_state (window)->log_directory;
+    g_autoptr(DgSettingsSnapshot) settings = dwt_settings_get_snapshot ();
+    if (!dwt_settings_get_background_input_budget (settings) && !record_path && !log_directory)
+        return FALSE;
+
     g_autoptr(GError) error = NULL;
-    if (!gtk_show_uri_on_window (GTK_WINDOW (userdata),
-                                 last_match_text,
-                                 GDK_CURRENT_TIME,
-                                 &error))
-        g_warning ("Could not open URL: %s", error->message);
-    g_clear_pointer (&last_match_text, g_free);
+    VtePty *term_pty = vte_terminal_pty_new_sync (vtterm, VTE_PTY_DEFAULT, NULL, &error);
+    VtePty *child_pty = term_pty ? vte_pty_new_sync (VTE_PTY_DEFAULT, NULL, &error) : NULL;
+    DwtRelay *relay = child_pty ? dwt_relay_new (vte_pty_get_fd (term_pty),
+                                                 vte_pty_get_fd (child_pty),
+                                                 &error) : NULL;
+    if (!relay) {
+        g_warning ("Cannot relay terminal output: %s", error->message);
+        g_clear_object (&child_pty);
+        g_clear_object (&term_pty);
+        return FALSE;
+    }
+
+    vte_terminal_set_pty (vtterm, term_pty);
+    g_object_unref (term_pty);
+
+    TermRelayState *relay_state = g_new0 (TermRelayState, 1);
+    relay_state->pty = child_pty;
+    relay_state->relay = relay;
+    g_object_set_data_full (G_OBJECT (vtterm), "dwt-relay-state",
+                            relay_state, term_relay_state_free);
+    g_signal_connect_after (G_OBJECT (vtterm), "size-allocate",
+                            G_CALLBACK (term_relay_size_allocated), relay_state);
+    relay_state->columns = vte_terminal_get_column_count (vtterm);
+    relay_state->rows = vte_terminal_get_row_count (vtterm);
+    vte_pty_set_size (child_pty, relay_state->rows, relay_state->columns, NULL);
+    window_update_relay_budgets (window_get_state (window));
+
+    if (record_path) {
+        relay_state->recorder = dwt_cast_writer_new (record_path,
+                                                     relay_state->columns,
+                                                     relay_state->rows,
+                                                     &error);
+        if (!relay_state->recorder)
+            g_warning ("Cannot record terminal output: %s", error->message);
+    }
+    if (log_directory)
+        relay_state->log = term_open_log (log_directory);
+    dwt_relay_set_output_func (relay, term_relay_output, relay_state);
+
+    term_spawn_on_pty (vtterm, child_pty, workdir, argv, envv);
+    return TRUE;
 }
 
 
-static const GActionEntry win_actions[] = {
-    { "font-reset",   font_size_action_ativated,  "i",  "0", NULL },
-    { "font-bigger",  font_size_action_ativated,  "i",  "1", NULL },
-    { "font-smaller", font_size_action_ativated,  "i", "-1", NULL },
-    { "copy",         copy_action_activated,     NULL, NULL, NULL },
-    { "paste",        paste_action_activated,    NULL, NULL, NULL },
-    { "copy-url",     copy_url_action_activated, NULL, NULL, NULL },
-    { "open-url",     open_url_action_activated, NULL, NULL, NULL },
-};
+static void
+term_spawn (VteTerminal *vtterm,
+            GtkWindow   *window,
+            const gchar *workdir,
+            gchar      **argv,
+            gchar      **envv,
+            const gchar *record_path)
+{
+    if (term_spawn_relayed (vtterm, window, workdir, argv, envv, record_path))
+        return;
 
-static const GActionEntry app_actions[] = {
-    { "new-terminal", new_terminal_action_activated, NULL, NULL, NULL },
-    { "about",        about_action_activated,        NULL, NULL, NULL },
-    { "quit",         quit_action_activated,         NULL, NULL, NULL },
-};
+    if (spawn_helper && dwt_spawn_helper_is_running (spawn_helper)) {
+        g_autoptr(GError) error = NULL;
+        VtePty *pty = vte_terminal_pty_new_sync (vtterm, VTE_PTY_DEFAULT, NULL, &error);
+        if (pty) {
+            vte_terminal_set_pty (vtterm, pty);
+            term_spawn_on_pty (vtterm, pty, workdir, argv, envv);
+            g_object_unref (pty);
+            return;
+        }
+        g_warning ("Cannot create PTY: %s", error->message);
+    }
 
+    vte_terminal_spawn_async (vtterm,
+                              VTE_PTY_DEFAULT,
+                              workdir,
+                              argv,
+                              envv,
+                              G_SPAWN_SEARCH_PATH,
+                              NULL,
+                              NULL,
+                              NULL,
+                              -1,
+                              NULL,
+                              on_child_spawned,
+                              window);
+}
 
+
+/* Spawns the child deferred by window_add_terminal(), if any. */
 static void
-on_child_spawned (G_GNUC_UNUSED VteTerminal *vtterm,
-                  GPid pid, GError *error, void *userdata)
+term_spawn_pending (VteTerminal *vtterm)
 {
-    if (pid == -1) {
-        // Error: report and close window.
-        g_assert_nonnull (error);
-        gtk_window_close (GTK_WINDOW (userdata));
-        g_error ("Cannot spawn child process: %s", error->message);
-    } else {
-        g_assert_null (error);
-    }
+    TermSessionState *state = term_get_session_state (vtterm);
+    GtkWidget *window = gtk_widget_get_toplevel (GTK_WIDGET (vtterm));
+    if (!state->pending_argv || !GTK_IS_WINDOW (window))
+        return;
+
+    g_auto(GStrv) argv = g_steal_pointer (&state->pending_argv);
+    g_auto(GStrv) envv = g_steal_pointer (&state->pending_envv);
+    g_autofree gchar *record_path = g_steal_pointer (&state->pending_record);
+    state->spawn_time = g_get_monotonic_time ();
+    term_spawn (vtterm, GTK_WINDOW (window), state->workdir, argv, envv, record_path);
 }
 
 
-static GtkWidget*
-create_new_window (GtkApplication *application,
-                   GVariantDict   *options)
+static VteTerminal*
+window_add_terminal (GtkWindow    *window,
+                     GVariantDict *options)
 {
     g_autofree char *command = NULL;
     g_autofree char *title = NULL;
-    gboolean opt_show_title;
-    gboolean opt_update_title;
-    gboolean opt_no_headerbar;
 
     g_object_get (dwt_settings_get_instance (),
-                  "show-title", &opt_show_title,
-                  "update-title", &opt_update_title,
-                  "no-header-bar", &opt_no_headerbar,
                   "command", &command,
                   "title", &title,
                   NULL);
@@ -800,19 +5528,26 @@ create_new_window (GtkApplication *application,
     const gchar *opt_command = command;
     const gchar *opt_title   = title;
     const gchar *opt_workdir = NULL;
+    const gchar *opt_record  = NULL;
+    const gchar *opt_replay  = NULL;
+    const gchar *opt_snapshot = NULL;
+    gdouble opt_replay_speed = 1.0;
+
+    TermSessionState *session_state = g_new0 (TermSessionState, 1);
 
     if (options) {
-        gboolean opt_no_auto_title = FALSE;
-        g_variant_dict_lookup (options, "title-on-maximize", "b", &opt_show_title);
-        g_variant_dict_lookup (options, "no-header-bar", "b", &opt_no_headerbar);
-        g_variant_dict_lookup (options, "no-auto-title", "b", &opt_no_auto_title);
         g_variant_dict_lookup (options, "workdir", "&s", &opt_workdir);
         g_variant_dict_lookup (options, "command", "&s", &opt_command);
         g_variant_dict_lookup (options, "title",   "&s", &opt_title);
-        if (opt_no_auto_title)
-            opt_update_title = FALSE;
+        g_variant_dict_lookup (options, "record",  "&s", &opt_record);
+        g_variant_dict_lookup (options, "replay",  "&s", &opt_replay);
+        g_variant_dict_lookup (options, "replay-speed", "d", &opt_replay_speed);
+        g_variant_dict_lookup (options, "snapshot", "&s", &opt_snapshot);
+        if (opt_command != command)
+            session_state->command = g_strdup (opt_command);
     }
     if (!opt_workdir) opt_workdir = g_get_home_dir ();
+    session_state->workdir = g_strdup (opt_workdir);
     if (!opt_command) opt_command = guess_shell ();
 
     /*
@@ -833,63 +5568,103 @@ create_new_window (GtkApplication *application,
     {
         g_printerr ("%s: coult not parse command: %s\n",
                     __func__, error->message);
+        term_session_state_free (session_state);
         return NULL;
     }
 
-    GtkWidget *window = gtk_application_window_new (application);
-    gtk_widget_set_visual (window,
-                           gdk_screen_get_system_visual (gtk_widget_get_screen (window)));
-    gtk_application_window_set_show_menubar (GTK_APPLICATION_WINDOW (window),
-                                             FALSE);
-    gtk_window_set_title (GTK_WINDOW (window), opt_title);
-    gtk_window_set_hide_titlebar_when_maximized (GTK_WINDOW (window),
-                                                 !opt_show_title);
-
-    g_action_map_add_action_entries (G_ACTION_MAP (window), win_actions,
-                                     G_N_ELEMENTS (win_actions), window);
-
     VteTerminal *vtterm = VTE_TERMINAL (vte_terminal_new ());
     configure_term_widget (vtterm, options);
-    term_char_size_changed (vtterm,
-                            vte_terminal_get_char_width (vtterm),
-                            vte_terminal_get_char_height (vtterm),
-                            window);
 
-    g_signal_connect (G_OBJECT (window), "notify::has-toplevel-focus",
-                      G_CALLBACK (window_has_toplevel_focus_notified),
-                      vtterm);
+    g_object_set_data_full (G_OBJECT (vtterm), "dwt-session-state",
+                            session_state, term_session_state_free);
+
+    TermResizeState *resize_state = g_new0 (TermResizeState, 1);
+    resize_state->window = window;
+    g_object_set_data_full (G_OBJECT (vtterm), "dwt-resize-state",
+                            resize_state, g_free);
 
     g_signal_connect (G_OBJECT (vtterm), "char-size-changed",
-                      G_CALLBACK (term_char_size_changed), window);
+                      G_CALLBACK (term_char_size_changed), resize_state);
+    g_signal_connect (G_OBJECT (vtterm), "size-allocate",
+                      G_CALLBACK (term_size_allocated), resize_state);
     g_signal_connect (G_OBJECT (vtterm), "child-exited",
                       G_CALLBACK (term_child_exited), window);
+
+    TermHibernateState *hibernate_state = g_new0 (TermHibernateState, 1);
+    hibernate_state->last_activity = g_get_monotonic_time ();
+    g_object_set_data_full (G_OBJECT (vtterm), "dwt-hibernate-state",
+                            hibernate_state, term_hibernate_state_free);
+    g_signal_connect (G_OBJECT (vtterm), "contents-changed",
+                      G_CALLBACK (term_contents_changed), hibernate_state);
+
+    WindowState *state = window_get_state (window);
+
+    GtkWidget *tab_label = gtk_label_new (opt_title);
+    gtk_label_set_ellipsize (GTK_LABEL (tab_label), PANGO_ELLIPSIZE_END);
+
+    TermNotifyState *notify_state = g_new0 (TermNotifyState, 1);
+    notify_state->window = window;
+    notify_state->tab_label = GTK_LABEL (tab_label);
+    g_object_set_data_full (G_OBJECT (vtterm), "dwt-notify-state",
+                            notify_state, term_notify_state_free);
+
     g_signal_connect (G_OBJECT (vtterm), "bell",
-                      G_CALLBACK (term_beeped), window);
+                      G_CALLBACK (term_beeped), notify_state);
+    g_signal_connect (G_OBJECT (vtterm), "notify::window-title",
+                      G_CALLBACK (term_title_changed), notify_state);
+
+    TermCommandState *command_state = g_new0 (TermCommandState, 1);
+    command_state->window = window;
+    g_object_set_data_full (G_OBJECT (vtterm), "dwt-command-state",
+                            command_state, term_command_state_free);
+#if VTE_CHECK_VERSION (0, 78, 0)
+    g_signal_connect (G_OBJECT (vtterm), "termprop-changed::" VTE_TERMPROP_SHELL_PREEXEC,
+                      G_CALLBACK (term_shell_preexec), command_state);
+    g_signal_connect (G_OBJECT (vtterm), "termprop-changed::" VTE_TERMPROP_SHELL_POSTEXEC,
+                      G_CALLBACK (term_shell_postexec), command_state);
+#endif /* VTE_CHECK_VERSION (0, 78, 0) */
     g_signal_connect (G_OBJECT (vtterm), "button-release-event",
                       G_CALLBACK (term_mouse_button_released),
-                      setup_popover (vtterm));
-
-    /*
-     * Propagate title changes to the window.
-     */
-    if (opt_update_title)
-        g_object_bind_property (G_OBJECT (vtterm), "window-title",
-                                G_OBJECT (window), "title",
-                                G_BINDING_DEFAULT);
+                      NULL);
+
+    LatencyProbe *latency_probe = window_get_latency_probe (window);
+    if (latency_probe) {
+        g_signal_connect (G_OBJECT (vtterm), "key-press-event",
+                          G_CALLBACK (term_latency_key_pressed), latency_probe);
+        g_signal_connect (G_OBJECT (vtterm), "contents-changed",
+                          G_CALLBACK (term_latency_contents_changed), latency_probe);
+    }
 
-    if (!opt_no_headerbar)
-        setup_header_bar (window, vtterm, opt_show_title);
+    HeadlessRun *headless_run = window_get_headless_run (window);
+    if (headless_run) {
+        g_signal_connect (G_OBJECT (vtterm), "draw",
+                          G_CALLBACK (term_headless_draw_started), headless_run);
+        g_signal_connect_after (G_OBJECT (vtterm), "draw",
+                                G_CALLBACK (term_headless_draw_finished), headless_run);
+        g_signal_connect (G_OBJECT (vtterm), "contents-changed",
+                          G_CALLBACK (term_headless_contents_changed), headless_run);
+    }
 
-    gtk_container_add (GTK_CONTAINER (window), GTK_WIDGET (vtterm));
     gtk_widget_set_receives_default (GTK_WIDGET (vtterm), TRUE);
+    gtk_widget_show (GTK_WIDGET (vtterm));
+
+    gint page = gtk_notebook_append_page (state->notebook,
+                                          GTK_WIDGET (vtterm),
+                                          tab_label);
+    gtk_container_child_set (GTK_CONTAINER (state->notebook),
+                             GTK_WIDGET (vtterm),
+                             "tab-expand", TRUE,
+                             NULL);
 
     /* We need to realize and show the window for it to have a valid XID */
-    gtk_widget_show_all (window);
+    gtk_widget_show_all (GTK_WIDGET (window));
+    gtk_notebook_set_current_page (state->notebook, page);
+    gtk_widget_grab_focus (GTK_WIDGET (vtterm));
 
     gchar **command_env = g_get_environ ();
 #ifdef GDK_WINDOWING_X11
-    if (GDK_IS_X11_SCREEN (gtk_widget_get_screen (window))) {
-        GdkWindow *gdk_window = gtk_widget_get_window (window);
+    if (GDK_IS_X11_SCREEN (gtk_widget_get_screen (GTK_WIDGET (window))) && !headless_run) {
+        GdkWindow *gdk_window = gtk_widget_get_window (GTK_WIDGET (window));
         if (gdk_window) {
             gchar window_id[NDIGITS10(unsigned long)];
             snprintf (window_id,
@@ -906,23 +5681,284 @@ create_new_window (GtkApplication *application,
     }
 #endif /* GDK_WINDOWING_X11 */
 
-    vte_terminal_spawn_async (VTE_TERMINAL (vtterm),
-                              VTE_PTY_DEFAULT,
-                              opt_workdir,
-                              command_argv,
-                              command_env,
-                              G_SPAWN_SEARCH_PATH,
-                              NULL,
-                              NULL,
-                              NULL,
-                              -1,
-                              NULL,
-                              on_child_spawned,
-                              window);
+    if (opt_replay) {
+        term_start_replay (vtterm, opt_replay, opt_replay_speed);
+        g_strfreev (command_argv);
+        g_strfreev (command_env);
+        return vtterm;
+    }
+
+    /* Restored terminals get their child once the snapshot is fed. */
+    if (opt_snapshot) {
+        session_state->snapshot = g_strdup (opt_snapshot);
+        session_state->restore_pending = TRUE;
+        session_state->pending_argv = command_argv;
+        session_state->pending_envv = command_env;
+        session_state->pending_record = g_strdup (opt_record);
+        return vtterm;
+    }
+
+    session_state->spawn_time = g_get_monotonic_time ();
+    term_spawn (vtterm, window, opt_workdir, command_argv, command_env, opt_record);
+    return vtterm;
+}
+
+
+static GtkWidget*
+create_new_window (GtkApplication *application,
+                   GVariantDict   *options)
+{
+    g_autofree char *title = NULL;
+    gboolean opt_show_title;
+    gboolean opt_update_title;
+    gboolean opt_no_headerbar;
+    g_autofree char *log_directory = NULL;
+
+    g_object_get (dwt_settings_get_instance (),
+                  "show-title", &opt_show_title,
+                  "update-title", &opt_update_title,
+                  "no-header-bar", &opt_no_headerbar,
+                  "title", &title,
+                  "log-directory", &log_directory,
+                  NULL);
+
+    const gchar *opt_title = title;
+    gboolean opt_headless = FALSE;
+
+    if (options) {
+        gboolean opt_no_auto_title = FALSE;
+        g_variant_dict_lookup (options, "headless", "b", &opt_headless);
+        g_variant_dict_lookup (options, "title-on-maximize", "b", &opt_show_title);
+        g_variant_dict_lookup (options, "no-header-bar", "b", &opt_no_headerbar);
+        g_variant_dict_lookup (options, "no-auto-title", "b", &opt_no_auto_title);
+        g_variant_dict_lookup (options, "title",   "&s", &opt_title);
+
+        g_autofree char *cmd_log_directory = NULL;
+        g_variant_dict_lookup (options, "log-directory", "s", &cmd_log_directory);
+        if (cmd_log_directory) SWAP (gchar*, cmd_log_directory, log_directory);
+
+        if (opt_no_auto_title)
+            opt_update_title = FALSE;
+    }
+
+    GtkWidget *window;
+    if (opt_headless) {
+        window = gtk_offscreen_window_new ();
+        gtk_window_set_application (GTK_WINDOW (window), application);
+    } else {
+        window = gtk_application_window_new (application);
+        gtk_application_window_set_show_menubar (GTK_APPLICATION_WINDOW (window),
+                                                 FALSE);
+        g_action_map_add_action_entries (G_ACTION_MAP (window), win_actions,
+                                         G_N_ELEMENTS (win_actions), window);
+    }
+    gtk_widget_set_visual (window,
+                           gdk_screen_get_system_visual (gtk_widget_get_screen (window)));
+    gtk_window_set_title (GTK_WINDOW (window), opt_title);
+    gtk_window_set_hide_titlebar_when_maximized (GTK_WINDOW (window),
+                                                 !opt_show_title);
+
+    WindowState *state = g_new0 (WindowState, 1);
+    state->window = GTK_WINDOW (window);
+    state->update_title = opt_update_title;
+    state->log_directory = g_steal_pointer (&log_directory);
+    g_object_set_data_full (G_OBJECT (window), "dwt-window-state",
+                            state, window_state_free);
+
+    state->notebook = GTK_NOTEBOOK (gtk_notebook_new ());
+    gtk_notebook_set_show_border (state->notebook, FALSE);
+    gtk_notebook_set_show_tabs (state->notebook, FALSE);
+    gtk_notebook_set_scrollable (state->notebook, TRUE);
+
+    GtkWidget *box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
+    gtk_container_add (GTK_CONTAINER (box), setup_search_bar (state));
+    gtk_box_pack_start (GTK_BOX (box), GTK_WIDGET (state->notebook), TRUE, TRUE, 0);
+    gtk_container_add (GTK_CONTAINER (window), box);
+
+    g_signal_connect_after (G_OBJECT (state->notebook), "switch-page",
+                            G_CALLBACK (notebook_page_switched), state);
+    g_signal_connect (G_OBJECT (state->notebook), "page-added",
+                      G_CALLBACK (notebook_pages_changed), NULL);
+    g_signal_connect (G_OBJECT (state->notebook), "page-removed",
+                      G_CALLBACK (notebook_pages_changed), NULL);
+
+    g_signal_connect (G_OBJECT (window), "notify::has-toplevel-focus",
+                      G_CALLBACK (window_has_toplevel_focus_notified),
+                      state);
+
+    gtk_widget_add_events (window, GDK_VISIBILITY_NOTIFY_MASK);
+    g_signal_connect (G_OBJECT (window), "window-state-event",
+                      G_CALLBACK (window_state_changed), state);
+    g_signal_connect (G_OBJECT (window), "visibility-notify-event",
+                      G_CALLBACK (window_visibility_changed), state);
+    g_signal_connect (G_OBJECT (window), "realize",
+                      G_CALLBACK (window_throttle_realized), state);
+    g_signal_connect (G_OBJECT (window), "unrealize",
+                      G_CALLBACK (window_throttle_unrealized), state);
+
+    if (!opt_no_headerbar && !opt_headless)
+        setup_header_bar (state, opt_show_title);
+
+    if (opt_headless)
+        window_start_headless_run (GTK_WINDOW (window), options);
+
+    if (options) {
+        gboolean opt_latency_probe = FALSE;
+        gint opt_latency_probe_keys = 0;
+        g_variant_dict_lookup (options, "latency-probe", "b", &opt_latency_probe);
+        g_variant_dict_lookup (options, "latency-probe-keys", "i", &opt_latency_probe_keys);
+        if (opt_latency_probe || opt_latency_probe_keys > 0)
+            window_start_latency_probe (GTK_WINDOW (window),
+                                        MAX (opt_latency_probe_keys, 0));
+    }
+
+    static gboolean first_window = TRUE;
+    if (first_window) {
+        g_signal_connect_after (G_OBJECT (window), "draw",
+                                G_CALLBACK (window_first_drawn), NULL);
+        first_window = FALSE;
+    }
+
+    if (!headless_mode)
+        g_signal_connect (G_OBJECT (window), "delete-event",
+                          G_CALLBACK (window_deleted), NULL);
+
+    if (!window_add_terminal (GTK_WINDOW (window), options)) {
+        gtk_widget_destroy (window);
+        return NULL;
+    }
     return window;
 }
 
 
+/*
+ * Resolving fonts the first time (and building the fontconfig caches if
+ * they are cold) may take long, especially when fallback fonts for CJK or
+ * emoji are needed. To avoid doing it all when the first window is shown,
+ * the configured font, and the one given with --font, are laid out and
+ * rendered in a worker thread during startup. The thread uses its own font map, as Pango objects may not be
+ * shared between threads, but fontconfig and the font files loaded from
+ * disk are shared by the whole process.
+ *
+ * Setting DWT_NO_FONT_WARMUP in the environment skips this, to compare
+ * the time to the first frame (logged with G_MESSAGES_DEBUG=all).
+ */
+static const gchar font_warmup_text[] =
+    " !\"#$%&'()*+,-./0123456789:;<=>?@ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]^_`"
+    "abcdefghijklmnopqrstuvwxyz{|}~"
+    "\u2500\u2502\u250c\u2510\u2514\u2518\u2588"  /* Box drawing.     */
+    "\u00e1\u00e9\u00f1\u00fc\u00df\u20ac"        /* Latin-1, euro.   */
+    "\u6f22\u5b57\u304b\u306a\ud55c\uae00"        /* CJK fallbacks.   */
+    "\U0001F600\U0001F44D";                     /* Emoji fallbacks. */
+
+typedef struct {
+    GPtrArray *fonts;  /* PangoFontDescription */
+    gboolean   bold;
+} FontWarmup;
+
+
+static void
+font_warmup_free (gpointer userdata)
+{
+    FontWarmup *warmup = userdata;
+    g_ptr_array_unref (warmup->fonts);
+    g_free (warmup);
+}
+
+
+static void
+font_warmup_thread (GTask        *task,
+                    gpointer      source_object,
+                    gpointer      task_data,
+                    GCancellable *cancellable)
+{
+    FontWarmup *warmup = task_data;
+    const gint64 start = g_get_monotonic_time ();
+
+    PangoFontMap *fontmap = pango_cairo_font_map_new ();
+    PangoContext *context = pango_font_map_create_context (fontmap);
+    PangoLayout *layout = pango_layout_new (context);
+    pango_layout_set_text (layout, font_warmup_text, -1);
+
+    cairo_surface_t *surface = cairo_image_surface_create (CAIRO_FORMAT_A8, 1024, 64);
+    cairo_t *cr = cairo_create (surface);
+
+    /* Rendering rasterizes the glyphs, including those from fallbacks. */
+    for (guint i = 0; i < warmup->fonts->len; i++) {
+        PangoFontDescription *fontd = g_ptr_array_index (warmup->fonts, i);
+        pango_layout_set_font_description (layout, fontd);
+        pango_cairo_show_layout (cr, layout);
+        if (warmup->bold) {
+            pango_font_description_set_weight (fontd, PANGO_WEIGHT_BOLD);
+            pango_layout_set_font_description (layout, fontd);
+            pango_cairo_show_layout (cr, layout);
+        }
+    }
+
+    cairo_destroy (cr);
+    cairo_surface_destroy (surface);
+    g_object_unref (layout);
+    g_object_unref (context);
+    g_object_unref (fontmap);
+
+    g_debug ("Font warm-up took %.3f ms for %u fonts",
+             (g_get_monotonic_time () - start) / 1000.0, warmup->fonts->len);
+    g_task_return_boolean (task, TRUE);
+}
+
+
+static void
+font_warmup_start (void)
+{
+    if (g_getenv ("DWT_NO_FONT_WARMUP"))
+        return;
+
+    g_autofree char *font = NULL;
+    gboolean allow_bold;
+    g_object_get (dwt_settings_get_instance (),
+                  "font", &font,
+                  "allow-bold", &allow_bold,
+                  NULL);
+
+    FontWarmup *warmup = g_new0 (FontWarmup, 1);
+    warmup->fonts = g_ptr_array_new_with_free_func ((GDestroyNotify) pango_font_description_free);
+    warmup->bold = allow_bold;
+
+    const gchar *fonts[] = { font, startup_font };
+    for (guint i = 0; i < G_N_ELEMENTS (fonts); i++) {
+        PangoFontDescription *fontd =
+            fonts[i] ? font_description_from_string (fonts[i]) : NULL;
+        if (!fontd)
+            continue;
+        if (warmup->fonts->len &&
+            pango_font_description_equal (fontd, g_ptr_array_index (warmup->fonts, 0)))
+            pango_font_description_free (fontd);
+        else
+            g_ptr_array_add (warmup->fonts, fontd);
+    }
+    if (!warmup->fonts->len) {
+        font_warmup_free (warmup);
+        return;
+    }
+
+    g_autoptr(GTask) task = g_task_new (NULL, NULL, NULL, NULL);
+    g_task_set_task_data (task, warmup, font_warmup_free);
+    g_task_run_in_thread (task, font_warmup_thread);
+}
+
+
+static gboolean
+window_first_drawn (GtkWidget *widget,
+                    cairo_t   *cr,
+                    gpointer   userdata)
+{
+    g_debug ("First frame drawn %.3f ms after startup",
+             (g_get_monotonic_time () - startup_time) / 1000.0);
+    g_signal_handlers_disconnect_by_func (widget, window_first_drawn, userdata);
+    return FALSE;
+}
+
+
 static void
 app_started (GApplication *application, gpointer userdata)
 {
@@ -947,6 +5983,25 @@ app_started (GApplication *application, gpointer userdata)
         cursor_inactive.alpha = 0.5 * cursor_active.alpha;
     }
 
+    /* Headless runs are short, and must not touch the user session. */
+    if (!headless_mode) {
+        g_autoptr(DgSettingsSnapshot) settings = dwt_settings_get_snapshot ();
+        hibernate_timer_update (GTK_APPLICATION (application),
+                                dwt_settings_get_hibernate_timeout (settings));
+        g_signal_connect (dwt_settings_get_instance (), "notify::hibernate-timeout",
+                          G_CALLBACK (hibernate_timeout_notified), application);
+        session_timer_id = g_timeout_add_seconds (SESSION_SAVE_INTERVAL,
+                                                  session_timer_tick,
+                                                  application);
+        resource_timer_start (GTK_APPLICATION (application));
+    }
+
+    g_signal_connect (dwt_settings_get_instance (), "notify::background-input-budget",
+                      G_CALLBACK (background_input_budget_notified), application);
+
+    font_warmup_start ();
+    spawn_helper_start (GTK_APPLICATION (application));
+
 	image_regex = g_regex_new (image_regex_string, G_REGEX_CASELESS | G_REGEX_OPTIMIZE, 0, NULL);
 	g_assert (image_regex);
 
@@ -954,20 +6009,29 @@ app_started (GApplication *application, gpointer userdata)
                                      G_N_ELEMENTS (app_actions), application);
 
     g_autoptr(GtkBuilder) builder = gtk_builder_new_from_resource (DWT_GRESOURCE ("menus.xml"));
-    gtk_application_set_app_menu (GTK_APPLICATION (application),
-        G_MENU_MODEL (gtk_builder_get_object (builder, "app-menu")));
+    app_menu_model =
+        g_object_ref (G_MENU_MODEL (gtk_builder_get_object (builder, "app-menu")));
+    popover_menu_model =
+        g_object_ref (G_MENU_MODEL (gtk_builder_get_object (builder, "popover-menu")));
+    gtk_application_set_app_menu (GTK_APPLICATION (application), app_menu_model);
 
     const struct {
         const gchar *action;
         const gchar *accel;
         GVariant    *param;
     } accel_map[] = {
-        { "app.new-terminal", "<Ctrl><Shift>n", NULL                     },
-        { "win.font-reset",   "<Super>0",       g_variant_new_int32 (+0) },
-        { "win.font-bigger",  "<Super>plus",    g_variant_new_int32 (+1) },
-        { "win.font-smaller", "<Super>minus",   g_variant_new_int32 (-1) },
-        { "win.copy",         "<Ctrl><Shift>c", NULL                     },
-        { "win.paste",        "<Ctrl><Shift>p", NULL                     },
+        { "app.new-terminal",  "<Ctrl><Shift>n",  NULL                          },
+        { "win.font-reset",    "<Super>0",        g_variant_new_int32 (+0)      },
+        { "win.font-bigger",   "<Super>plus",     g_variant_new_int32 (+1)      },
+        { "win.font-smaller",  "<Super>minus",    g_variant_new_int32 (-1)      },
+        { "win.copy",          "<Ctrl><Shift>c",  NULL                          },
+        { "win.paste",         "<Ctrl><Shift>p",  NULL                          },
+        { "win.new-tab",       "<Ctrl><Shift>t",  NULL                          },
+        { "win.next-tab",      "<Ctrl>Page_Down", g_variant_new_int32 (+1)      },
+        { "win.previous-tab",  "<Ctrl>Page_Up",   g_variant_new_int32 (-1)      },
+        { "win.find",          "<Ctrl><Shift>f",  NULL                          },
+        { "win.find-next",     "<Ctrl><Shift>g",  g_variant_new_boolean (FALSE) },
+        { "win.find-previous", "<Ctrl><Shift>h",  g_variant_new_boolean (TRUE)  },
     };
 
     for (guint i = 0; i < G_N_ELEMENTS (accel_map); i++) {
@@ -983,6 +6047,26 @@ static void
 app_shutdown (GApplication *application, gpointer userdata)
 {
 	g_regex_unref (image_regex);
+    g_clear_pointer (&path_cache, g_hash_table_unref);
+    g_signal_handlers_disconnect_by_func (dwt_settings_get_instance (),
+                                          hibernate_timeout_notified, application);
+    hibernate_timer_update (GTK_APPLICATION (application), 0);
+    if (session_timer_id)
+        g_source_remove (session_timer_id);
+    resource_timer_stop ();
+    g_clear_pointer (&spawn_helper, dwt_spawn_helper_free);
+
+    g_autoptr(DgSettingsSnapshot) settings = dwt_settings_get_snapshot ();
+    if (dwt_settings_get_restore_session (settings) && !session_saved && !headless_mode)
+        session_save (GTK_APPLICATION (application), TRUE);
+
+    /* Windows are left open when quitting, close them to finish recordings. */
+    GList *windows;
+    while ((windows = gtk_application_get_windows (GTK_APPLICATION (application))))
+        gtk_widget_destroy (GTK_WIDGET (windows->data));
+
+    g_clear_object (&popover_menu_model);
+    g_clear_object (&app_menu_model);
 }
 
 
@@ -995,11 +6079,24 @@ app_command_line_received (GApplication            *application,
 
     g_autofree char *opt_theme = NULL;
     if (g_variant_dict_lookup (options, "theme", "s", &opt_theme) && g_str_equal (opt_theme, "list")) {
-        for (size_t i = 0; i < G_N_ELEMENTS (themes); i++) {
-            g_print ("%s\n", themes[i].name);
+        g_autofree const gchar **names = dwt_themes_list_names ();
+        for (size_t i = 0; names[i]; i++) {
+            g_print ("%s\n", names[i]);
         }
     } else {
-        create_new_window (GTK_APPLICATION (application), options);
+        /*
+         * The saved session is restored only by the first instance, and
+         * a new window is still opened if a command was given.
+         */
+        static gboolean first_run = TRUE;
+        gint n_restored = 0;
+        g_autoptr(DgSettingsSnapshot) settings = dwt_settings_get_snapshot ();
+        if (first_run && !headless_mode && dwt_settings_get_restore_session (settings))
+            n_restored = session_restore (GTK_APPLICATION (application));
+        first_run = FALSE;
+
+        if (n_restored == 0 || g_variant_dict_contains (options, "command"))
+            create_new_window (GTK_APPLICATION (application), options);
     }
     g_variant_dict_unref (options);
     g_application_release (application);
@@ -1030,9 +6127,36 @@ get_application_id (const gchar* argv0) {
 int
 main (int argc, char *argv[])
 {
+    if (argc == 2 && g_str_equal (argv[1], DWT_SPAWN_HELPER_ARG))
+        return dwt_spawn_helper_main ();
+
+    startup_time = g_get_monotonic_time ();
+
+    /* Headless runs do not use (nor become) the primary instance. */
+    const gchar *app_id = get_application_id (argv[0]);
+    for (int i = 1; i < argc; i++) {
+        if (g_str_equal (argv[i], "--headless"))
+            headless_mode = TRUE;
+        else if (g_str_has_prefix (argv[i], "--font="))
+            startup_font = argv[i] + strlen ("--font=");
+        else if ((g_str_equal (argv[i], "--font") || g_str_equal (argv[i], "-f")) && i + 1 < argc)
+            startup_font = argv[++i];
+        else if (g_str_has_prefix (argv[i], "-f") && argv[i][2] != '-')
+            startup_font = argv[i] + 2;
+    }
+
+    if (headless_mode) {
+        app_id = NULL;
+        if (!gtk_init_check (&argc, &argv)) {
+            g_printerr ("%s: cannot open display; without an X11 or Wayland"
+                        " server, use GDK_BACKEND=broadway with broadwayd\n",
+                        argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
     g_autoptr(GtkApplication) application =
-        gtk_application_new (get_application_id (argv[0]),
-                             G_APPLICATION_HANDLES_COMMAND_LINE);
+        gtk_application_new (app_id, G_APPLICATION_HANDLES_COMMAND_LINE);
 
     g_application_add_main_option_entries (G_APPLICATION (application),
                                            option_entries);
@@ -1044,6 +6168,7 @@ main (int argc, char *argv[])
     g_signal_connect (G_OBJECT (application), "command-line",
                       G_CALLBACK (app_command_line_received), NULL);
 
-    return g_application_run (G_APPLICATION (application), argc, argv);
+    const int status = g_application_run (G_APPLICATION (application), argc, argv);
+    return headless_mode ? headless_exit_code : status;
 }
 
@@ -0,0 +1,218 @@
+/*
+ * test-cast.c
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Distributed under terms of the MIT license.
+ */
+
+#include "../dwt-cast.h"
+#include <glib.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+
+static const gchar cast_header[] =
+    "{\"version\": 2, \"width\": 80, \"height\": 24,"
+    " \"timestamp\": 1500000000, \"env\": {\"TERM\": \"xterm-256color\"}}\n";
+
+
+static DwtCast*
+parse_events (const gchar *events)
+{
+    g_autofree gchar *text = g_strconcat (cast_header, events, NULL);
+    g_autoptr(GError) error = NULL;
+    DwtCast *cast = dwt_cast_parse (text, strlen (text), &error);
+    g_assert_no_error (error);
+    g_assert_nonnull (cast);
+    return cast;
+}
+
+
+static const DwtCastEvent*
+cast_event (const DwtCast *cast, guint index)
+{
+    g_assert_cmpuint (index, <, cast->events->len);
+    return &g_array_index (cast->events, DwtCastEvent, index);
+}
+
+
+static void
+test_cast_parse_header (void)
+{
+    g_autoptr(DwtCast) cast = parse_events ("");
+    g_assert_cmpuint (cast->width, ==, 80);
+    g_assert_cmpuint (cast->height, ==, 24);
+    g_assert_cmpuint (cast->events->len, ==, 0);
+}
+
+
+static void
+test_cast_parse_events (void)
+{
+    g_autoptr(DwtCast) cast =
+        parse_events ("[0.5, \"o\", \"hello\"]\n"
+                      "\n"
+                      "[1.25, \"i\", \"ignored\"]\n"
+                      "[2, \"r\", \"100x40\"]\n"
+                      "[3.0, \"m\", \"marker\"]\n"
+                      "[4.5, \"o\", \"bye\"]");
+
+    g_assert_cmpuint (cast->events->len, ==, 3);
+
+    const DwtCastEvent *event = cast_event (cast, 0);
+    g_assert_cmpfloat (event->time, ==, 0.5);
+    g_assert_cmpint (event->type, ==, DWT_CAST_OUTPUT);
+    g_assert_cmpstr (event->data, ==, "hello");
+    g_assert_cmpuint (event->length, ==, 5);
+
+    event = cast_event (cast, 1);
+    g_assert_cmpfloat (event->time, ==, 2.0);
+    g_assert_cmpint (event->type, ==, DWT_CAST_RESIZE);
+    g_assert_cmpstr (event->data, ==, "100x40");
+
+    event = cast_event (cast, 2);
+    g_assert_cmpfloat (event->time, ==, 4.5);
+    g_assert_cmpstr (event->data, ==, "bye");
+}
+
+
+static void
+test_cast_parse_escapes (void)
+{
+    g_autoptr(DwtCast) cast =
+        parse_events ("[0.1, \"o\", \"\\u001b[1m\\\"a\\\\b\\/c\\r\\n\\t\"]\n"
+                      "[0.2, \"o\", \"\\u00e9\\u20ac\"]\n"
+                      "[0.3, \"o\", \"\\ud83d\\ude00\"]\n"
+                      "[0.4, \"o\", \"a\\u0000b\"]\n");
+
+    g_assert_cmpuint (cast->events->len, ==, 4);
+    g_assert_cmpstr (cast_event (cast, 0)->data, ==, "\033[1m\"a\\b/c\r\n\t");
+    g_assert_cmpstr (cast_event (cast, 1)->data, ==, "\xc3\xa9\xe2\x82\xac");
+    g_assert_cmpstr (cast_event (cast, 2)->data, ==, "\xf0\x9f\x98\x80");
+
+    const DwtCastEvent *event = cast_event (cast, 3);
+    g_assert_cmpuint (event->length, ==, 3);
+    g_assert_cmpmem (event->data, event->length, "a\0b", 3);
+}
+
+
+static void
+test_cast_parse_invalid (void)
+{
+    static const gchar *invalid[] = {
+        "",
+        "not json\n",
+        "{\"version\": 1, \"width\": 80, \"height\": 24}\n",
+        "{\"version\": 2, \"height\": 24}\n",
+        "{\"version\": 2, \"width\": 80, \"height\": 24}\n[0.1, \"o\"]\n",
+        "{\"version\": 2, \"width\": 80, \"height\": 24}\n[0.1, \"o\", \"abc]\n",
+        "{\"version\": 2, \"width\": 80, \"height\": 24}\n[0.1, \"o\", \"\\x\"]\n",
+    };
+
+    for (guint i = 0; i < G_N_ELEMENTS (invalid); i++) {
+        g_autoptr(GError) error = NULL;
+        g_autoptr(DwtCast) cast = dwt_cast_parse (invalid[i], strlen (invalid[i]), &error);
+        g_assert_null (cast);
+        g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+    }
+}
+
+
+static DwtCast*
+load_cast (const gchar *path)
+{
+    g_autofree gchar *contents = NULL;
+    gsize length = 0;
+    g_assert_true (g_file_get_contents (path, &contents, &length, NULL));
+
+    g_autoptr(GError) error = NULL;
+    DwtCast *cast = dwt_cast_parse (contents, length, &error);
+    g_assert_no_error (error);
+    g_assert_nonnull (cast);
+    return cast;
+}
+
+
+static void
+test_cast_write (void)
+{
+    g_autofree gchar *dir_path = g_dir_make_tmp ("test-cast-XXXXXX", NULL);
+    g_assert_nonnull (dir_path);
+    g_autofree gchar *path = g_build_filename (dir_path, "test.cast", NULL);
+
+    g_autoptr(GError) error = NULL;
+    DwtCastWriter *writer = dwt_cast_writer_new (path, 80, 24, &error);
+    g_assert_no_error (error);
+    g_assert_nonnull (writer);
+
+    /* The last character is split between two chunks of output. */
+    dwt_cast_writer_output (writer, "\033[1mbold\"\xe2\x82", 11);
+    dwt_cast_writer_resize (writer, 132, 43);
+    dwt_cast_writer_output (writer, "\xac\n\xff", 3);
+
+    /* Everything must be in the file once freed, without a main loop. */
+    dwt_cast_writer_free (writer);
+
+    g_autoptr(DwtCast) cast = load_cast (path);
+    g_assert_cmpuint (cast->width, ==, 80);
+    g_assert_cmpuint (cast->height, ==, 24);
+    g_assert_cmpuint (cast->events->len, ==, 3);
+
+    const DwtCastEvent *event = cast_event (cast, 0);
+    g_assert_cmpint (event->type, ==, DWT_CAST_OUTPUT);
+    g_assert_cmpstr (event->data, ==, "\033[1mbold\"");
+
+    event = cast_event (cast, 1);
+    g_assert_cmpint (event->type, ==, DWT_CAST_RESIZE);
+    g_assert_cmpstr (event->data, ==, "132x43");
+
+    event = cast_event (cast, 2);
+    g_assert_cmpint (event->type, ==, DWT_CAST_OUTPUT);
+    g_assert_cmpstr (event->data, ==, "\xe2\x82\xac\n\xef\xbf\xbd");
+    g_assert_cmpfloat (event->time, >=, cast_event (cast, 0)->time);
+
+    g_remove (path);
+    g_rmdir (dir_path);
+}
+
+
+static void
+test_cast_write_replace (void)
+{
+    g_autofree gchar *dir_path = g_dir_make_tmp ("test-cast-XXXXXX", NULL);
+    g_assert_nonnull (dir_path);
+    g_autofree gchar *path = g_build_filename (dir_path, "test.cast", NULL);
+    g_assert_true (g_file_set_contents (path, "previous contents\n", -1, NULL));
+
+    /* More than a batch, so some of it is written from the worker thread. */
+    g_autofree gchar *line = g_strnfill (1023, 'x');
+    g_autoptr(GError) error = NULL;
+    DwtCastWriter *writer = dwt_cast_writer_new (path, 80, 24, &error);
+    g_assert_no_error (error);
+    for (guint i = 0; i < 200; i++)
+        dwt_cast_writer_output (writer, line, strlen (line));
+    dwt_cast_writer_free (writer);
+
+    g_autoptr(DwtCast) cast = load_cast (path);
+    g_assert_cmpuint (cast->events->len, ==, 200);
+    for (guint i = 0; i < cast->events->len; i++)
+        g_assert_cmpstr (cast_event (cast, i)->data, ==, line);
+
+    g_remove (path);
+    g_rmdir (dir_path);
+}
+
+
+int
+main (int argc, char *argv[])
+{
+    g_test_init (&argc, &argv, NULL);
+    g_test_add_func ("/cast/parse-header", test_cast_parse_header);
+    g_test_add_func ("/cast/parse-events", test_cast_parse_events);
+    g_test_add_func ("/cast/parse-escapes", test_cast_parse_escapes);
+    g_test_add_func ("/cast/parse-invalid", test_cast_parse_invalid);
+    g_test_add_func ("/cast/write", test_cast_write);
+    g_test_add_func ("/cast/write-replace", test_cast_write_replace);
+    return g_test_run ();
+}
@@ -6,7 +6,6 @@
  */
 
 #include "../dg-settings.h"
-#include "../dg-util.h"
 #include <glib.h>
 #include <gio/gio.h>
 #include <glib/gstdio.h>
@@ -25,12 +24,12 @@ DG_SETTINGS_CLASS_END
 static void
 delete_settings_dir (gpointer userdata)
 {
-    dg_lmem gchar *dir_path = userdata;
+    g_autofree gchar *dir_path = userdata;
     GDir *dir = g_dir_open (dir_path, 0, NULL);
     const gchar *name;
 
     while ((name = g_dir_read_name (dir))) {
-        dg_lmem gchar *file_path = g_build_filename (dir_path, name, NULL);
+        g_autofree gchar *file_path = g_build_filename (dir_path, name, NULL);
         g_remove (file_path);
     }
     g_dir_close (dir);
@@ -77,8 +76,8 @@ populate_setting (const gchar *settings_path,
                   const gchar *setting_name,
                   const gchar *value_as_string)
 {
-    dg_lmem gchar *path = g_build_filename (settings_path, setting_name, NULL);
-    dg_lobj GFile *file = g_file_new_for_path (path);
+    g_autofree gchar *path = g_build_filename (settings_path, setting_name, NULL);
+    g_autoptr(GFile) file = g_file_new_for_path (path);
     g_file_replace_contents (file,
                              value_as_string,
                              strlen (value_as_string),
@@ -119,12 +118,131 @@ test_settings_read (void)
 }
 
 
+static void
+test_settings_snapshot (void)
+{
+    const gchar* settings_path = temporary_settings_dir ();
+    populate_setting (settings_path, "baz", "42");
+
+    TestSettings *settings = test_settings_new (settings_path, FALSE);
+    g_test_queue_unref (settings);
+
+    g_autoptr(DgSettingsSnapshot) before = dg_settings_get_snapshot (DG_SETTINGS (settings));
+    populate_setting (settings_path, "baz", "43");
+    dg_settings_reload (DG_SETTINGS (settings), "baz");
+    g_autoptr(DgSettingsSnapshot) after = dg_settings_get_snapshot (DG_SETTINGS (settings));
+
+    /* Snapshots never change once taken. */
+    g_assert_cmpuint (dg_settings_snapshot_get_uint (before, "baz"), ==, 42);
+    g_assert_cmpuint (dg_settings_snapshot_get_uint (after, "baz"), ==, 43);
+    g_assert_false (dg_settings_snapshot_get_boolean (after, "foo"));
+    g_assert_cmpstr (dg_settings_snapshot_get_string (after, "bar"), ==, "BAR");
+}
+
+
+static void
+test_settings_snapshot_nth (void)
+{
+    const gchar* settings_path = temporary_settings_dir ();
+    populate_setting (settings_path, "baz", "42");
+
+    TestSettings *settings = test_settings_new (settings_path, FALSE);
+    g_test_queue_unref (settings);
+
+    /* Settings are numbered in the order they were installed. */
+    g_autoptr(DgSettingsSnapshot) snapshot = dg_settings_get_snapshot (DG_SETTINGS (settings));
+    g_assert_false (g_value_get_boolean (dg_settings_snapshot_get_nth (snapshot, 0)));
+    g_assert_cmpuint (g_value_get_uint (dg_settings_snapshot_get_nth (snapshot, 1)), ==, 42);
+    g_assert_cmpstr (g_value_get_string (dg_settings_snapshot_get_nth (snapshot, 2)), ==, "BAR");
+
+    /* Properties read the snapshot, not the files, until reloaded. */
+    populate_setting (settings_path, "baz", "43");
+    guint uint_value = 0;
+    g_object_get (G_OBJECT (settings), "baz", &uint_value, NULL);
+    g_assert_cmpuint (uint_value, ==, 42);
+
+    dg_settings_reload (DG_SETTINGS (settings), "baz");
+    g_object_get (G_OBJECT (settings), "baz", &uint_value, NULL);
+    g_assert_cmpuint (uint_value, ==, 43);
+}
+
+
+#define STRESS_READERS 8
+#define STRESS_UPDATES 500
+
+typedef struct {
+    TestSettings *settings;
+    gint          done;
+} StressData;
+
+
+static gpointer
+stress_reader_thread (gpointer userdata)
+{
+    StressData *data = userdata;
+    guint last_value = 0;
+    guint n_reads = 0;
+
+    do {
+        g_autoptr(DgSettingsSnapshot) snapshot =
+            dg_settings_get_snapshot (DG_SETTINGS (data->settings));
+
+        /* Both settings are updated together, each snapshot has a pair. */
+        const guint value = dg_settings_snapshot_get_uint (snapshot, "baz");
+        g_autofree gchar *expected = g_strdup_printf ("value %u", value);
+        g_assert_cmpstr (dg_settings_snapshot_get_string (snapshot, "bar"), ==, expected);
+
+        /* Newer snapshots never go back in time. */
+        g_assert_cmpuint (value, >=, last_value);
+        last_value = value;
+        n_reads++;
+    } while (!g_atomic_int_get (&data->done));
+    return GUINT_TO_POINTER (n_reads);
+}
+
+
+static void
+test_settings_snapshot_stress (void)
+{
+    const gchar* settings_path = temporary_settings_dir ();
+    populate_setting (settings_path, "baz", "0");
+    populate_setting (settings_path, "bar", "value 0");
+
+    StressData data = {
+        .settings = test_settings_new (settings_path, FALSE),
+    };
+    g_test_queue_unref (data.settings);
+
+    GThread *threads[STRESS_READERS];
+    for (guint i = 0; i < STRESS_READERS; i++)
+        threads[i] = g_thread_new ("reader", stress_reader_thread, &data);
+
+    for (guint i = 1; i <= STRESS_UPDATES; i++) {
+        g_autofree gchar *baz = g_strdup_printf ("%u", i);
+        g_autofree gchar *bar = g_strdup_printf ("value %u", i);
+        populate_setting (settings_path, "baz", baz);
+        populate_setting (settings_path, "bar", bar);
+        dg_settings_reload (DG_SETTINGS (data.settings), NULL);
+    }
+    g_atomic_int_set (&data.done, TRUE);
+
+    for (guint i = 0; i < STRESS_READERS; i++)
+        g_assert_cmpuint (GPOINTER_TO_UINT (g_thread_join (threads[i])), >, 0);
+
+    g_autoptr(DgSettingsSnapshot) snapshot = dg_settings_get_snapshot (DG_SETTINGS (data.settings));
+    g_assert_cmpuint (dg_settings_snapshot_get_uint (snapshot, "baz"), ==, STRESS_UPDATES);
+}
+
+
 int
 main (int argc, char *argv[])
 {
     g_test_init (&argc, &argv, NULL);
     g_test_add_func ("/settings/read-defaults", test_settings_read_defaults);
     g_test_add_func ("/settings/read", test_settings_read);
+    g_test_add_func ("/settings/snapshot", test_settings_snapshot);
+    g_test_add_func ("/settings/snapshot-nth", test_settings_snapshot_nth);
+    g_test_add_func ("/settings/snapshot-stress", test_settings_snapshot_stress);
     return g_test_run ();
 }
 
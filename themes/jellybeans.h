@@ -1,26 +0,0 @@
-#ifndef THEME_JELLYBEANS_H
-#define THEME_JELLYBEANS_H 1
-{
-  .name = "jellybeans",
-  .fg = { 0.870588, 0.870588, 0.870588, 1.000000 }, /* #dedede */
-  .bg = { 0.070588, 0.070588, 0.070588, 1.000000 }, /* #121212 */
-  .colors = {
-    { 0.572549, 0.572549, 0.572549, 1.000000 }, /* #929292 */
-    { 0.886275, 0.450980, 0.450980, 1.000000 }, /* #e27373 */
-    { 0.580392, 0.725490, 0.474510, 1.000000 }, /* #94b979 */
-    { 1.000000, 0.729412, 0.482353, 1.000000 }, /* #ffba7b */
-    { 0.592157, 0.745098, 0.862745, 1.000000 }, /* #97bedc */
-    { 0.882353, 0.752941, 0.980392, 1.000000 }, /* #e1c0fa */
-    { 0.000000, 0.596078, 0.556863, 1.000000 }, /* #00988e */
-    { 0.870588, 0.870588, 0.870588, 1.000000 }, /* #dedede */
-    { 0.741176, 0.741176, 0.741176, 1.000000 }, /* #bdbdbd */
-    { 1.000000, 0.631373, 0.631373, 1.000000 }, /* #ffa1a1 */
-    { 0.741176, 0.870588, 0.670588, 1.000000 }, /* #bddeab */
-    { 1.000000, 0.862745, 0.627451, 1.000000 }, /* #ffdca0 */
-    { 0.694118, 0.847059, 0.964706, 1.000000 }, /* #b1d8f6 */
-    { 0.984314, 0.854902, 1.000000, 1.000000 }, /* #fbdaff */
-    { 0.101961, 0.698039, 0.658824, 1.000000 }, /* #1ab2a8 */
-    { 1.000000, 1.000000, 1.000000, 1.000000 }, /* #ffffff */
-  },
-},
-#endif /* THEME_JELLYBEANS */
@@ -1,26 +0,0 @@
-#ifndef THEME_MOLOKAI_H
-#define THEME_MOLOKAI_H 1
-{
-  .name = "molokai",
-  .fg = { 0.733333, 0.733333, 0.733333, 1.000000 }, /* #bbbbbb */
-  .bg = { 0.070588, 0.070588, 0.070588, 1.000000 }, /* #121212 */
-  .colors = {
-    { 0.070588, 0.070588, 0.070588, 1.000000 }, /* #121212 */
-    { 0.980392, 0.145098, 0.450980, 1.000000 }, /* #fa2573 */
-    { 0.596078, 0.882353, 0.137255, 1.000000 }, /* #98e123 */
-    { 0.874510, 0.831373, 0.376471, 1.000000 }, /* #dfd460 */
-    { 0.062745, 0.501961, 0.815686, 1.000000 }, /* #1080d0 */
-    { 0.529412, 0.000000, 1.000000, 1.000000 }, /* #8700ff */
-    { 0.262745, 0.658824, 0.815686, 1.000000 }, /* #43a8d0 */
-    { 0.733333, 0.733333, 0.733333, 1.000000 }, /* #bbbbbb */
-    { 0.333333, 0.333333, 0.333333, 1.000000 }, /* #555555 */
-    { 0.964706, 0.400000, 0.615686, 1.000000 }, /* #f6669d */
-    { 0.694118, 0.878431, 0.372549, 1.000000 }, /* #b1e05f */
-    { 1.000000, 0.949020, 0.427451, 1.000000 }, /* #fff26d */
-    { 0.000000, 0.686275, 1.000000, 1.000000 }, /* #00afff */
-    { 0.686275, 0.529412, 1.000000, 1.000000 }, /* #af87ff */
-    { 0.317647, 0.807843, 1.000000, 1.000000 }, /* #51ceff */
-    { 1.000000, 1.000000, 1.000000, 1.000000 }, /* #ffffff */
-  },
-},
-#endif /* THEME_MOLOKAI */
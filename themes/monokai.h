@@ -1,26 +0,0 @@
-#ifndef THEME_MONOKAI_H
-#define THEME_MONOKAI_H 1
-{
-  .name = "monokai",
-  .fg = { 0.768627, 0.772549, 0.709804, 1.000000 }, /* #c4c5b5 */
-  .bg = { 0.101961, 0.101961, 0.101961, 1.000000 }, /* #1a1a1a */
-  .colors = {
-    { 0.101961, 0.101961, 0.101961, 1.000000 }, /* #1a1a1a */
-    { 0.956863, 0.000000, 0.372549, 1.000000 }, /* #f4005f */
-    { 0.596078, 0.878431, 0.141176, 1.000000 }, /* #98e024 */
-    { 0.980392, 0.517647, 0.098039, 1.000000 }, /* #fa8419 */
-    { 0.615686, 0.396078, 1.000000, 1.000000 }, /* #9d65ff */
-    { 0.956863, 0.000000, 0.372549, 1.000000 }, /* #f4005f */
-    { 0.345098, 0.819608, 0.921569, 1.000000 }, /* #58d1eb */
-    { 0.768627, 0.772549, 0.709804, 1.000000 }, /* #c4c5b5 */
-    { 0.384314, 0.368627, 0.298039, 1.000000 }, /* #625e4c */
-    { 0.956863, 0.000000, 0.372549, 1.000000 }, /* #f4005f */
-    { 0.596078, 0.878431, 0.141176, 1.000000 }, /* #98e024 */
-    { 0.878431, 0.835294, 0.380392, 1.000000 }, /* #e0d561 */
-    { 0.615686, 0.396078, 1.000000, 1.000000 }, /* #9d65ff */
-    { 0.956863, 0.000000, 0.372549, 1.000000 }, /* #f4005f */
-    { 0.345098, 0.819608, 0.921569, 1.000000 }, /* #58d1eb */
-    { 0.964706, 0.964706, 0.937255, 1.000000 }, /* #f6f6ef */
-  },
-},
-#endif /* THEME_MONOKAI */
@@ -1,26 +0,0 @@
-#ifndef THEME_SOLARIZED_H
-#define THEME_SOLARIZED_H 1
-{
-  .name = "solarized",
-  .fg = { 0.611765, 0.760784, 0.764706, 1.000000 }, /* #9cc2c3 */
-  .bg = { 0.000000, 0.117647, 0.152941, 1.000000 }, /* #001e27 */
-  .colors = {
-    { 0.000000, 0.156863, 0.192157, 1.000000 }, /* #002831 */
-    { 0.819608, 0.109804, 0.141176, 1.000000 }, /* #d11c24 */
-    { 0.423529, 0.745098, 0.423529, 1.000000 }, /* #6cbe6c */
-    { 0.647059, 0.466667, 0.023529, 1.000000 }, /* #a57706 */
-    { 0.129412, 0.462745, 0.780392, 1.000000 }, /* #2176c7 */
-    { 0.776471, 0.109804, 0.435294, 1.000000 }, /* #c61c6f */
-    { 0.145098, 0.572549, 0.525490, 1.000000 }, /* #259286 */
-    { 0.917647, 0.890196, 0.796078, 1.000000 }, /* #eae3cb */
-    { 0.000000, 0.392157, 0.533333, 1.000000 }, /* #006488 */
-    { 0.960784, 0.086275, 0.231373, 1.000000 }, /* #f5163b */
-    { 0.317647, 0.937255, 0.517647, 1.000000 }, /* #51ef84 */
-    { 0.698039, 0.494118, 0.156863, 1.000000 }, /* #b27e28 */
-    { 0.090196, 0.556863, 0.784314, 1.000000 }, /* #178ec8 */
-    { 0.886275, 0.301961, 0.556863, 1.000000 }, /* #e24d8e */
-    { 0.000000, 0.701961, 0.619608, 1.000000 }, /* #00b39e */
-    { 0.988235, 0.956863, 0.862745, 1.000000 }, /* #fcf4dc */
-  },
-},
-#endif /* THEME_SOLARIZED */
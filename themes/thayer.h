@@ -1,26 +0,0 @@
-#ifndef THEME_THAYER_H
-#define THEME_THAYER_H 1
-{
-  .name = "thayer",
-  .fg = { 0.972549, 0.972549, 0.972549, 1.000000 }, /* #f8f8f8 */
-  .bg = { 0.105882, 0.113725, 0.117647, 1.000000 }, /* #1b1d1e */
-  .colors = {
-    { 0.105882, 0.113725, 0.117647, 1.000000 }, /* #1b1d1e */
-    { 0.976471, 0.149020, 0.447059, 1.000000 }, /* #f92672 */
-    { 0.301961, 0.972549, 0.250980, 1.000000 }, /* #4df840 */
-    { 0.956863, 0.992157, 0.133333, 1.000000 }, /* #f4fd22 */
-    { 0.152941, 0.341176, 0.839216, 1.000000 }, /* #2757d6 */
-    { 0.549020, 0.329412, 0.996078, 1.000000 }, /* #8c54fe */
-    { 0.219608, 0.784314, 0.709804, 1.000000 }, /* #38c8b5 */
-    { 0.800000, 0.800000, 0.776471, 1.000000 }, /* #ccccc6 */
-    { 0.313725, 0.325490, 0.329412, 1.000000 }, /* #505354 */
-    { 1.000000, 0.349020, 0.584314, 1.000000 }, /* #ff5995 */
-    { 0.713725, 0.890196, 0.329412, 1.000000 }, /* #b6e354 */
-    { 0.996078, 0.929412, 0.423529, 1.000000 }, /* #feed6c */
-    { 0.247059, 0.470588, 1.000000, 1.000000 }, /* #3f78ff */
-    { 0.619608, 0.435294, 0.996078, 1.000000 }, /* #9e6ffe */
-    { 0.137255, 0.811765, 0.835294, 1.000000 }, /* #23cfd5 */
-    { 0.972549, 0.972549, 0.949020, 1.000000 }, /* #f8f8f2 */
-  },
-},
-#endif /* THEME_THAYER */
@@ -1,26 +0,0 @@
-#ifndef THEME_WOMBAT_H
-#define THEME_WOMBAT_H 1
-{
-  .name = "wombat",
-  .fg = { 0.870588, 0.854902, 0.811765, 1.000000 }, /* #dedacf */
-  .bg = { 0.090196, 0.090196, 0.090196, 1.000000 }, /* #171717 */
-  .colors = {
-    { 0.000000, 0.000000, 0.000000, 1.000000 }, /* #000000 */
-    { 1.000000, 0.380392, 0.352941, 1.000000 }, /* #ff615a */
-    { 0.694118, 0.913725, 0.411765, 1.000000 }, /* #b1e969 */
-    { 0.921569, 0.850980, 0.611765, 1.000000 }, /* #ebd99c */
-    { 0.364706, 0.662745, 0.964706, 1.000000 }, /* #5da9f6 */
-    { 0.909804, 0.415686, 1.000000, 1.000000 }, /* #e86aff */
-    { 0.509804, 1.000000, 0.968627, 1.000000 }, /* #82fff7 */
-    { 0.870588, 0.854902, 0.811765, 1.000000 }, /* #dedacf */
-    { 0.192157, 0.192157, 0.192157, 1.000000 }, /* #313131 */
-    { 0.960784, 0.549020, 0.501961, 1.000000 }, /* #f58c80 */
-    { 0.866667, 0.972549, 0.560784, 1.000000 }, /* #ddf88f */
-    { 0.933333, 0.898039, 0.698039, 1.000000 }, /* #eee5b2 */
-    { 0.647059, 0.780392, 1.000000, 1.000000 }, /* #a5c7ff */
-    { 0.866667, 0.666667, 1.000000, 1.000000 }, /* #ddaaff */
-    { 0.717647, 1.000000, 0.976471, 1.000000 }, /* #b7fff9 */
-    { 1.000000, 1.000000, 1.000000, 1.000000 }, /* #ffffff */
-  },
-},
-#endif /* THEME_WOMBAT */
@@ -1,26 +0,0 @@
-#ifndef THEME_ZENBURN_H
-#define THEME_ZENBURN_H 1
-{
-  .name = "zenburn",
-  .fg = { 0.862745, 0.862745, 0.800000, 1.000000 }, /* #dcdccc */
-  .bg = { 0.247059, 0.247059, 0.247059, 1.000000 }, /* #3f3f3f */
-  .colors = {
-    { 0.301961, 0.301961, 0.301961, 1.000000 }, /* #4d4d4d */
-    { 0.439216, 0.313725, 0.313725, 1.000000 }, /* #705050 */
-    { 0.376471, 0.705882, 0.541176, 1.000000 }, /* #60b48a */
-    { 0.941176, 0.874510, 0.686275, 1.000000 }, /* #f0dfaf */
-    { 0.313725, 0.376471, 0.439216, 1.000000 }, /* #506070 */
-    { 0.862745, 0.549020, 0.764706, 1.000000 }, /* #dc8cc3 */
-    { 0.549020, 0.815686, 0.827451, 1.000000 }, /* #8cd0d3 */
-    { 0.862745, 0.862745, 0.800000, 1.000000 }, /* #dcdccc */
-    { 0.439216, 0.564706, 0.501961, 1.000000 }, /* #709080 */
-    { 0.862745, 0.639216, 0.639216, 1.000000 }, /* #dca3a3 */
-    { 0.764706, 0.749020, 0.623529, 1.000000 }, /* #c3bf9f */
-    { 0.878431, 0.811765, 0.623529, 1.000000 }, /* #e0cf9f */
-    { 0.580392, 0.749020, 0.952941, 1.000000 }, /* #94bff3 */
-    { 0.925490, 0.576471, 0.827451, 1.000000 }, /* #ec93d3 */
-    { 0.576471, 0.878431, 0.890196, 1.000000 }, /* #93e0e3 */
-    { 1.000000, 1.000000, 1.000000, 1.000000 }, /* #ffffff */
-  },
-},
-#endif /* THEME_ZENBURN */